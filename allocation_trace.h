@@ -0,0 +1,336 @@
+#pragma once
+
+#include "pool_stats.h"
+#include "timer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ss
+{
+	enum class trace_op : uint8_t
+	{
+		allocate = 1,
+		deallocate = 2
+	};
+
+	// One allocate or deallocate as stored in a trace file. pointer is the
+	// address handed out, used by replay only as an id to pair a deallocate
+	// with its allocate.
+	struct trace_record
+	{
+		uint64_t timestamp;
+		uint64_t pointer;
+		uint64_t size;
+		uint32_t thread;
+		trace_op op;
+		uint8_t reserved[3];
+	};
+
+	static_assert(sizeof(trace_record) == 32, "trace_record is a file format");
+
+	struct trace_file_header
+	{
+		static const char *magic_value() noexcept { return "SSTRACE1"; }
+
+		char magic[8];
+		uint32_t version;
+		uint32_t record_size;
+	};
+
+	inline uint64_t trace_timestamp() noexcept
+	{
+		return tsc_clock::now();
+	}
+
+
+	// Process wide recorder. Each thread appends to its own lock-free single
+	// producer ring, a drain thread started by start() moves the rings to the
+	// trace file. A full ring drops the record and counts it rather than
+	// stall the allocating thread.
+	class allocation_trace
+	{
+		static constexpr size_t RING_CAPACITY = 1 << 14;
+
+		struct ring
+		{
+			std::array<trace_record, RING_CAPACITY> records;
+			alignas(64) std::atomic<size_t> head{ 0 };
+			alignas(64) std::atomic<size_t> tail{ 0 };
+			std::atomic<uint64_t> dropped{ 0 };
+			uint32_t thread = 0;
+		};
+
+		// rings are over-aligned, which plain new only honours from C++17 on
+		struct ring_deleter
+		{
+			void operator()(ring *r) const noexcept
+			{
+				r->~ring();
+				std::free(r);
+			}
+		};
+
+		using ring_ptr = std::unique_ptr<ring, ring_deleter>;
+
+		static ring_ptr make_ring()
+		{
+			void *memory = nullptr;
+			if (posix_memalign(&memory, alignof(ring), sizeof(ring)) != 0)
+				throw std::bad_alloc();
+			return ring_ptr(new (memory) ring());
+		}
+
+		std::mutex _mutex;
+		std::vector<ring_ptr> _rings;
+		std::atomic<bool> _enabled{ false };
+		std::atomic<bool> _running{ false };
+		std::FILE *_file = nullptr;
+		std::thread _drainer;
+		uint64_t _written = 0;
+
+		// set while the recorder itself allocates, so a pool behind the global
+		// operator new doesn't trace the recorder's own bookkeeping
+		static bool &reentered() noexcept
+		{
+			thread_local bool flag = false;
+			return flag;
+		}
+
+		ring *local_ring() noexcept
+		{
+			thread_local ring *local = nullptr;
+			if (local == nullptr)
+			{
+				reentered() = true;
+				try
+				{
+					ring_ptr r = make_ring();
+					std::lock_guard<std::mutex> lock(_mutex);
+					r->thread = static_cast<uint32_t>(_rings.size());
+					local = r.get();
+					_rings.push_back(std::move(r));
+				}
+				catch (...)
+				{
+				}
+				reentered() = false;
+			}
+			return local;
+		}
+
+		size_t drain_ring(ring &r)
+		{
+			const size_t tail = r.tail.load(std::memory_order_relaxed);
+			const size_t head = r.head.load(std::memory_order_acquire);
+			size_t n = 0;
+
+			for (size_t i = tail; i != head; )
+			{
+				const size_t index = i % RING_CAPACITY;
+				const size_t contiguous = std::min(head - i, RING_CAPACITY - index);
+				std::fwrite(&r.records[index], sizeof(trace_record), contiguous, _file);
+				i += contiguous;
+				n += contiguous;
+			}
+
+			r.tail.store(head, std::memory_order_release);
+			return n;
+		}
+
+	public:
+		static allocation_trace &get_instance() noexcept
+		{
+			static allocation_trace instance;
+			return instance;
+		}
+
+		~allocation_trace()
+		{
+			stop();
+		}
+
+		// Opens path and starts recording, drained every interval.
+		void start(const std::string &path, std::chrono::milliseconds interval = std::chrono::milliseconds(10))
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_file != nullptr)
+				throw std::runtime_error("allocation trace already started");
+
+			reentered() = true;
+			_file = std::fopen(path.c_str(), "wb");
+			if (_file == nullptr)
+			{
+				reentered() = false;
+				throw std::runtime_error("cannot open trace file " + path);
+			}
+
+			trace_file_header header;
+			std::memcpy(header.magic, trace_file_header::magic_value(), sizeof(header.magic));
+			header.version = 1;
+			header.record_size = sizeof(trace_record);
+			std::fwrite(&header, sizeof(header), 1, _file);
+			_written = 0;
+
+			_running.store(true, std::memory_order_relaxed);
+			_drainer = std::thread([this, interval]()
+			{
+				reentered() = true;
+				while (_running.load(std::memory_order_relaxed))
+				{
+					std::this_thread::sleep_for(interval);
+					drain();
+				}
+			});
+			reentered() = false;
+			_enabled.store(true, std::memory_order_release);
+		}
+
+		// Stops recording, drains what is left and closes the file.
+		void stop()
+		{
+			_enabled.store(false, std::memory_order_release);
+			if (_running.exchange(false) && _drainer.joinable())
+				_drainer.join();
+
+			drain();
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_file != nullptr)
+			{
+				std::fclose(_file);
+				_file = nullptr;
+			}
+		}
+
+		// Writes out every pending record, returns how many.
+		size_t drain()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_file == nullptr)
+				return 0;
+
+			size_t n = 0;
+			for (auto &r : _rings)
+				n += drain_ring(*r);
+			std::fflush(_file);
+			_written += n;
+			return n;
+		}
+
+		bool enabled() const noexcept
+		{
+			return _enabled.load(std::memory_order_relaxed);
+		}
+
+		void record(trace_op op, const void *p, size_t size) noexcept
+		{
+			if (false == enabled() || reentered())
+				return;
+
+			ring *r = local_ring();
+			if (r == nullptr)
+				return;
+
+			const size_t head = r->head.load(std::memory_order_relaxed);
+			if (head - r->tail.load(std::memory_order_acquire) == RING_CAPACITY)
+			{
+				r->dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			trace_record &rec = r->records[head % RING_CAPACITY];
+			rec.timestamp = trace_timestamp();
+			rec.pointer = reinterpret_cast<uintptr_t>(p);
+			rec.size = size;
+			rec.thread = r->thread;
+			rec.op = op;
+			r->head.store(head + 1, std::memory_order_release);
+		}
+
+		uint64_t written() const noexcept { return _written; }
+
+		uint64_t dropped()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			uint64_t n = 0;
+			for (auto &r : _rings)
+				n += r->dropped.load(std::memory_order_relaxed);
+			return n;
+		}
+	};
+
+
+	// Stats policy that sends every allocate and deallocate to the
+	// allocation_trace recorder, then to STATS.
+	template<typename STATS = null_stats>
+	struct traced_stats : STATS
+	{
+		static constexpr bool enabled = true;
+
+		void on_allocate(const void *p, size_t size, size_t block_size, size_t probes) noexcept
+		{
+			allocation_trace::get_instance().record(trace_op::allocate, p, size);
+			STATS::on_allocate(p, size, block_size, probes);
+		}
+
+		void on_deallocate(const void *p, size_t size) noexcept
+		{
+			allocation_trace::get_instance().record(trace_op::deallocate, p, size);
+			STATS::on_deallocate(p, size);
+		}
+	};
+
+
+	// Streams a trace file in batches, throws std::runtime_error on a bad header.
+	class trace_reader
+	{
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> _file;
+
+	public:
+		explicit trace_reader(const std::string &path)
+			: _file(std::fopen(path.c_str(), "rb"), &std::fclose)
+		{
+			if (_file == nullptr)
+				throw std::runtime_error("cannot open trace file " + path);
+
+			trace_file_header header;
+			if (std::fread(&header, sizeof(header), 1, _file.get()) != 1 ||
+				std::memcmp(header.magic, trace_file_header::magic_value(), sizeof(header.magic)) != 0 ||
+				header.record_size != sizeof(trace_record))
+			{
+				throw std::runtime_error(path + " is not an allocation trace");
+			}
+		}
+
+		// Fills up to max_records, returns how many were read, 0 at the end.
+		size_t read(trace_record *records, size_t max_records)
+		{
+			return std::fread(records, sizeof(trace_record), max_records, _file.get());
+		}
+	};
+
+	inline std::vector<trace_record> read_trace(const std::string &path)
+	{
+		trace_reader reader(path);
+		std::vector<trace_record> records;
+		std::array<trace_record, 4096> buffer;
+		size_t n;
+		while ((n = reader.read(buffer.data(), buffer.size())) > 0)
+			records.insert(records.end(), buffer.begin(), buffer.begin() + n);
+
+		return records;
+	}
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <assert.h>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include "offset_ptr.h"
+#include "pool_policies.h"
+#include "pool_stats.h"
+#include "profile_zone.h"
+
+namespace ss
+{
+	// Block list over a caller supplied buffer. static_memory_pool wraps this
+	// around its own storage, growable_memory_pool keeps one per chunk. STATS
+	// is told about every allocate and deallocate, see pool_stats.h; the
+	// default null_stats compiles away. FIT chooses the block to carve from
+	// and ON_ERROR handles failed calls, see pool_policies.h.
+	template<size_t ALIGNMENT = std::alignment_of<uintptr_t>(), typename STATS = null_stats,
+		typename FIT = first_fit, typename ON_ERROR = log_error>
+	class basic_memory_pool : private STATS, private FIT
+	{
+	public:
+		struct free_block_header
+		{
+		private:
+			// Links are relative to the header itself so the block list stays
+			// valid wherever the pool memory is mapped.
+			size_t _size;
+			offset_ptr<free_block_header> _next;
+			offset_ptr<free_block_header> _prev;
+
+		public:
+			const bool is_allocated() const
+			{
+				return (_size & ALLOCATED_FLAG) > 0;
+			}
+
+			void set_size( size_t new_size, bool allocated=false)
+			{
+				if( allocated )
+				{
+					// Set the upper most bit to indicate that the block is allocated
+					_size = (new_size | ALLOCATED_FLAG);
+				}
+				else
+				{
+					_size = new_size;
+				}
+			}
+
+			const size_t get_size() const noexcept
+			{
+				return static_cast<size_t>(_size & ~ALLOCATED_FLAG);
+			}
+
+			const free_block_header *get_next() const noexcept
+			{
+				return _next.get();
+			}
+
+			free_block_header *get_next() noexcept
+			{
+				return _next.get();
+			}
+
+			void set_next(free_block_header *const next)
+			{
+				_next = next;
+			}
+
+			const free_block_header *get_prev() const noexcept
+			{
+				return _prev.get();
+			}
+
+			free_block_header *get_prev() noexcept
+			{
+				return _prev.get();
+			}
+
+			void set_prev(free_block_header *const prev)
+			{
+				_prev = prev;
+			}
+
+
+		};
+
+		static constexpr size_t HEADER_SIZE = sizeof(free_block_header);
+		static constexpr size_t ALIGNMENT_MASK = ALIGNMENT - 1;
+		static constexpr size_t ALIGNED_HEADER_SIZE = (HEADER_SIZE + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+		static constexpr size_t ALLOCATED_FLAG = ~(std::numeric_limits<size_t>::max() >> 1);
+
+	private:
+
+		// The buffer is located relative to the pool object as well, so a pool
+		// placed inside the memory it manages can be mapped by several processes.
+		std::ptrdiff_t _buffer_offset = 0;
+		size_t _pool_size = 0;
+
+		size_t _allocated = 0;
+		size_t _deallocated = 0;
+
+	public:
+
+		basic_memory_pool() = default;
+		basic_memory_pool(const basic_memory_pool&) = delete;
+		basic_memory_pool &operator=(const basic_memory_pool&) = delete;
+
+		basic_memory_pool(void *buffer, size_t pool_size)
+		{
+			init(buffer, pool_size);
+		}
+
+		void init(void *buffer, size_t pool_size)
+		{
+			assert(((size_t)buffer & ALIGNMENT_MASK) == 0);
+			assert(pool_size > ALIGNED_HEADER_SIZE);
+			_pool_size = pool_size;
+			_buffer_offset = reinterpret_cast<intptr_t>(buffer) - reinterpret_cast<intptr_t>(this);
+			reset();
+		}
+
+		void reset()
+		{
+			STATS::reset();
+			FIT::reset();
+			_allocated = 0;
+			_deallocated = 0;
+			free_block_header *first = free_list();
+			first->set_size( _pool_size - ALIGNED_HEADER_SIZE );
+			first->set_next( nullptr );
+			first->set_prev( nullptr );
+			FIT::on_release(first);
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept
+		{
+			return (addr >= (buffer_start() + ALIGNED_HEADER_SIZE) && addr < (buffer_end() - ALIGNED_HEADER_SIZE));
+		}
+
+		void *allocate(size_t requested_size, bool throw_exception = false)
+		{
+			SS_PROFILE_ZONE("ss::allocate");
+
+			if (requested_size == 0)
+				return nullptr;
+
+			if (requested_size > _pool_size)
+			{
+				ON_ERROR::too_large(requested_size, _pool_size, throw_exception);
+				return nullptr;
+			}
+
+			// whole ALIGNMENT units, so the header split off behind the block is aligned;
+			// STATS still sees the size the caller asked for
+			const size_t block_size = (requested_size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+			const size_t requested_size_with_header = block_size + ALIGNED_HEADER_SIZE;
+
+			size_t probes = 0;
+			void *result = nullptr;
+			free_block_header *it = FIT::template reuse<free_block_header>(block_size);
+			if (it != nullptr)
+			{
+				// a deferred block of exactly this size, still marked allocated
+				result = reinterpret_cast<uint8_t*>(it) + ALIGNED_HEADER_SIZE;
+				_allocated += block_size;
+			}
+			else
+			{
+				if (FIT::reclaim_on_miss)
+					reclaim_deferred();
+				it = FIT::find(free_list(), requested_size_with_header, probes);
+				if (it == nullptr && reclaim_deferred())
+					it = FIT::find(free_list(), requested_size_with_header, probes);
+			}
+
+			if (result == nullptr && it != nullptr)
+			{
+				//move data pointer to after the header
+				result = reinterpret_cast<uint8_t*>(it) + ALIGNED_HEADER_SIZE;
+
+				// create new block
+				free_block_header *next = it->get_next();
+				if (next == nullptr || it->get_size() > block_size)
+				{
+					free_block_header *new_block = reinterpret_cast<free_block_header*>(
+						reinterpret_cast<uint8_t*>(result) + block_size);
+
+					const size_t remaining_size = (it->get_size() - requested_size_with_header);
+
+					if ((buffer_end() - ALIGNED_HEADER_SIZE) < reinterpret_cast<uintptr_t>(new_block))
+					{
+						// no room for the trailing header, fails like any other miss below
+						result = nullptr;
+					}
+					else
+					{
+						FIT::on_use(it);
+						it->set_next(new_block);
+						it->set_size(block_size, true);
+
+						new_block->set_size(remaining_size);
+						new_block->set_next(next);
+						new_block->set_prev(it);
+
+						if (next != nullptr)
+						{
+							next->set_prev(new_block);
+						}
+						FIT::on_release(new_block);
+					}
+				}
+
+				if (result != nullptr)
+					_allocated += block_size;
+			}
+
+			if (result == nullptr)
+			{
+				// only bounded_fit sends anything elsewhere
+				result = FIT::overflow_allocate(block_size, ALIGNMENT);
+				if (result != nullptr)
+					_allocated += block_size;
+			}
+
+			if (result != nullptr)
+				STATS::on_allocate(result, requested_size, block_size, probes);
+			else
+			{
+				STATS::on_failed_allocate(requested_size, probes);
+				ON_ERROR::exhausted(requested_size, throw_exception);
+			}
+
+			return result;
+		}
+
+
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			SS_PROFILE_ZONE("ss::deallocate");
+
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+			if ( false == is_inside_pool(addr) )
+			{
+				size_t overflow_size = 0;
+				if (p != nullptr && FIT::overflow_deallocate(p, overflow_size))
+				{
+					_deallocated += overflow_size;
+					STATS::on_deallocate(p, overflow_size);
+					return;
+				}
+
+				ON_ERROR::invalid_pointer(pool_error::outside_pool, p, throw_exception);
+				return;
+			}
+
+			free_block_header *hdr = reinterpret_cast<free_block_header *>(
+				reinterpret_cast<uint8_t*>(addr) - ALIGNED_HEADER_SIZE);
+
+			if (false == hdr->is_allocated() || FIT::is_deferred(hdr))
+			{
+				ON_ERROR::invalid_pointer(pool_error::not_allocated, p, throw_exception);
+				return;
+			}
+
+			_deallocated += hdr->get_size();
+			STATS::on_deallocate(p, hdr->get_size());
+
+			if (false == FIT::defer(hdr))
+				release(hdr);
+		}
+
+	private:
+
+		// returns an allocated block to the list, merged with its free neighbours
+		void release(free_block_header *hdr)
+		{
+			size_t block_size = hdr->get_size();
+
+			// coalesce blocks ahead
+			free_block_header *next_it = hdr->get_next();
+			while ( next_it != nullptr && false == next_it->is_allocated() )
+			{
+				block_size += next_it->get_size() + ALIGNED_HEADER_SIZE;
+				FIT::on_absorb(next_it);
+				next_it = next_it->get_next();
+			}
+
+			// coalesce blocks behind
+			free_block_header *prev_it = hdr->get_prev();
+			while ( prev_it != nullptr && false == prev_it->is_allocated() )
+			{
+				block_size += prev_it->get_size() + ALIGNED_HEADER_SIZE;
+				FIT::on_absorb(prev_it);
+				prev_it = prev_it->get_prev();
+			}
+
+			//Can move free block to start of free list
+			if (prev_it == nullptr)
+			{
+				hdr = free_list();
+			}
+			//Can move free block backwards, the first free block after prev_it absorbs the rest
+			else if (prev_it != hdr->get_prev())
+			{
+				hdr = prev_it->get_next();
+			}
+
+ 			if( next_it != nullptr )
+ 				next_it->set_prev( hdr );
+
+			hdr->set_next(next_it);
+			hdr->set_size(block_size);
+			FIT::on_release(hdr);
+		}
+
+		// Releases the blocks FIT deferred, true if there were any. Deferred
+		// blocks next to each other are joined first and coalesced as one,
+		// so blocks reclaimed in address order merge in a single pass.
+		bool reclaim_deferred()
+		{
+			free_block_header *run = FIT::template reclaim<free_block_header>();
+			const bool reclaimed = run != nullptr;
+			while (run != nullptr)
+			{
+				free_block_header *next = FIT::template reclaim<free_block_header>();
+				if (next != nullptr && run->get_next() == next)
+				{
+					free_block_header *after = next->get_next();
+					run->set_size(run->get_size() + ALIGNED_HEADER_SIZE + next->get_size(), true);
+					run->set_next(after);
+					if (after != nullptr)
+						after->set_prev(run);
+				}
+				else
+				{
+					release(run);
+					run = next;
+				}
+			}
+			return reclaimed;
+		}
+
+	public:
+
+		// coalesces the blocks FIT deferred, see quick_fit and unsorted_fit
+		void consolidate()
+		{
+			reclaim_deferred();
+		}
+
+		// for debugging
+		free_block_header *free_list () const noexcept
+		{
+			return reinterpret_cast<free_block_header*>(buffer_start());
+		}
+
+		// True when the block list tiles the buffer: each block starts where the
+		// one before it ends and links back to it, the last one ends the buffer.
+		// Meant for memory another process may have left half updated.
+		bool validate() const noexcept
+		{
+			uintptr_t expected = buffer_start();
+			const free_block_header *prev = nullptr;
+			for (const free_block_header *it = free_list(); it != nullptr; it = it->get_next())
+			{
+				const uintptr_t addr = reinterpret_cast<uintptr_t>(it);
+				if (addr != expected || buffer_end() - addr < ALIGNED_HEADER_SIZE || it->get_prev() != prev ||
+					it->get_size() > buffer_end() - addr - ALIGNED_HEADER_SIZE)
+					return false;
+				expected = addr + ALIGNED_HEADER_SIZE + it->get_size();
+				prev = it;
+			}
+			return expected == buffer_end();
+		}
+
+		// Counters come from STATS and may be read while other threads allocate,
+		// the block walk must not race with allocate()/deallocate().
+		pool_stats stats() const noexcept
+		{
+			pool_stats result;
+			for (const free_block_header *it = free_list(); it != nullptr; it = it->get_next())
+			{
+				if (it->is_allocated())
+				{
+					result.bytes_in_use += it->get_size();
+					++result.live_blocks;
+				}
+				else
+				{
+					result.free_bytes += it->get_size();
+					++result.free_blocks;
+					if (it->get_size() > result.largest_free_block)
+						result.largest_free_block = it->get_size();
+				}
+			}
+
+			if (result.free_bytes > 0)
+				result.fragmentation = 1.0 - double(result.largest_free_block) / double(result.free_bytes);
+
+			STATS::collect(result);
+			FIT::collect(result);
+			return result;
+		}
+
+		FIT &fit() noexcept { return *this; }
+		const FIT &fit() const noexcept { return *this; }
+
+		const size_t allocated() const noexcept { return _allocated; }
+		const size_t deallocated() const noexcept { return _deallocated; }
+		const size_t capacity() const noexcept { return _pool_size; }
+		const uintptr_t buffer_start() const noexcept { return reinterpret_cast<uintptr_t>(this) + _buffer_offset; }
+		const uintptr_t buffer_end() const noexcept { return buffer_start() + _pool_size; }
+	};
+}
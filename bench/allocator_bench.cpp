@@ -0,0 +1,1053 @@
+// Standard allocator workloads against every pool engine, glibc malloc and
+// the std::pmr pool resources. Reports throughput, per call latency, peak
+// footprint (RSS or malloc heap growth) and the memory held beyond the live
+// bytes, as a table and optionally as JSON for regression tracking.
+// Where perf_event_open is allowed, hardware counters per operation explain
+// the differences: cycles, instructions, L1D, LLC and dTLB misses, branch
+// misses. Unavailable counters show as "-" and null.
+//
+// The block list engines, one per FIT policy, also report the mean search
+// length per allocation and the fragmentation of their free memory, sampled
+// every 4096 calls outside the timed region; other engines show "-". The
+// free tail of a large pool hides fragmentation, compare the fit policies
+// with a --pool-size a few times the live bytes, e.g. --pool-size 4194304.
+//
+// --repeat runs every workload and engine pair n times, interleaved so drift
+// hits all engines alike; tools/bench_compare compares two such runs.
+//
+// usage: allocator_bench [--workload name[,name...]] [--engine name[,name...]]
+//                        [--threads n] [--scale x] [--pool-size bytes] [--repeat n] [--json path]
+//
+// workloads: churn random larson threadtest cache-scratch cache-thrash xmalloc linux-scalability
+// engines:   static static-next static-best static-tree static-quick static-unsorted
+//            static-bounded growable shared size-class span malloc pmr-sync pmr-unsync
+//
+// Engines that are not thread safe (the static ones, growable, size-class,
+// span, pmr-unsync) run the multi-threaded workloads behind a mutex, the way
+// they'd have to be shared today. Every call is timed with
+// tsc_clock, so the reported throughput includes the two fenced counter
+// reads per call for every engine alike.
+
+#include "basic_memory_pool.h"
+#include "growable_memory_pool.h"
+#include "shared_memory_pool.h"
+#include "size_class_pool.h"
+#include "span_pool.h"
+#include "chunk_source.h"
+#include "perf_counters.h"
+#include "timer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace ss;
+
+namespace
+{
+	struct options
+	{
+		size_t threads = std::max<size_t>(2, std::thread::hardware_concurrency());
+		double scale = 1.0;
+		size_t pool_size = size_t(1) << 30;
+		size_t repeat = 1;
+	};
+
+	size_t scaled(size_t n, const options &opt)
+	{
+		return std::max<size_t>(1, static_cast<size_t>(double(n) * opt.scale));
+	}
+
+
+	// engines
+
+	// counts searches without atomics, engines are used by one thread at a time
+	class search_stats
+	{
+		uint64_t _allocations = 0;
+		uint64_t _failed = 0;
+		uint64_t _probes = 0;
+
+	public:
+		static constexpr bool enabled = true;
+
+		void on_allocate(const void *, size_t, size_t, size_t probes) noexcept { ++_allocations; _probes += probes; }
+		void on_failed_allocate(size_t, size_t probes) noexcept { ++_failed; _probes += probes; }
+		void on_deallocate(const void *, size_t) noexcept {}
+
+		void collect(pool_stats &out) const noexcept
+		{
+			out.allocations += _allocations;
+			out.failed_allocations += _failed;
+			out.probes += _probes;
+		}
+
+		void reset() noexcept
+		{
+			_allocations = 0;
+			_failed = 0;
+			_probes = 0;
+		}
+	};
+
+	struct fit_report
+	{
+		bool valid = false;
+		double mean_search = 0;
+		double fragmentation = 0;
+		double peak_fragmentation = 0;
+	};
+
+	template<typename ENGINE, typename = void>
+	struct has_fit_report : std::false_type {};
+
+	template<typename ENGINE>
+	struct has_fit_report<ENGINE, std::void_t<decltype(std::declval<ENGINE&>().report())>> : std::true_type {};
+
+	template<typename ENGINE>
+	void sample_fit(ENGINE &engine)
+	{
+		if constexpr (has_fit_report<ENGINE>::value)
+			engine.sample();
+	}
+
+	template<typename ENGINE>
+	fit_report report_fit(const ENGINE &engine)
+	{
+		if constexpr (has_fit_report<ENGINE>::value)
+			return engine.report();
+		else
+			return fit_report();
+	}
+
+	template<typename POOL>
+	class basic_engine
+	{
+		size_t _size;
+		void *_memory;
+		POOL _pool;
+		double _fragmentation_sum = 0;
+		double _peak_fragmentation = 0;
+		size_t _samples = 0;
+
+	public:
+		static constexpr bool thread_safe = false;
+
+		explicit basic_engine(size_t size)
+			: _size(size), _memory(mmap_chunk_source::acquire(size))
+		{
+			if (_memory == nullptr)
+				throw std::runtime_error("cannot map pool buffer");
+			_pool.init(_memory, size);
+		}
+
+		~basic_engine() { mmap_chunk_source::release(_memory, _size); }
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+
+		void sample()
+		{
+			const double fragmentation = _pool.stats().fragmentation;
+			_fragmentation_sum += fragmentation;
+			_peak_fragmentation = std::max(_peak_fragmentation, fragmentation);
+			++_samples;
+		}
+
+		fit_report report() const
+		{
+			const pool_stats stats = _pool.stats();
+			const uint64_t searches = stats.allocations + stats.failed_allocations;
+
+			fit_report r;
+			r.valid = true;
+			r.mean_search = searches > 0 ? double(stats.probes) / double(searches) : 0.0;
+			r.fragmentation = _samples > 0 ? _fragmentation_sum / double(_samples) : 0.0;
+			r.peak_fragmentation = _peak_fragmentation;
+			return r;
+		}
+	};
+
+	template<typename FIT>
+	using fit_engine = basic_engine<basic_memory_pool<alignof(uintptr_t), search_stats, FIT>>;
+
+	using static_engine = fit_engine<first_fit>;
+	using next_engine = fit_engine<next_fit>;
+	using best_engine = fit_engine<best_fit>;
+	using tree_engine = fit_engine<tree_best_fit>;
+	// first fit behind exact size free lists up to 256 bytes
+	using quick_engine = fit_engine<quick_fit<256>>;
+	// first fit behind an unsorted bin coalesced on a miss
+	using unsorted_engine = fit_engine<unsorted_fit<first_fit>>;
+	// first fit giving up after 64 blocks, the rest goes to malloc
+	using bounded_engine = fit_engine<bounded_fit<64, malloc_fallback>>;
+
+	class growable_engine
+	{
+		growable_memory_pool<> _pool;
+
+	public:
+		static constexpr bool thread_safe = false;
+
+		explicit growable_engine(size_t) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+	};
+
+	class shared_engine
+	{
+		shared_memory_pool<> _pool;
+
+	public:
+		static constexpr bool thread_safe = true;
+
+		explicit shared_engine(size_t size) : _pool(shared_memory_pool<>::create_anonymous(size)) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+	};
+
+	class size_class_engine
+	{
+		size_class_pool<> _pool;
+
+	public:
+		static constexpr bool thread_safe = false;
+
+		explicit size_class_engine(size_t) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t size) { _pool.deallocate(p, size); }
+	};
+
+	// small objects in 64 KiB spans over a 256 MiB mapped pool, its page map takes 512 KiB
+	class span_engine
+	{
+		using pool_t = static_memory_pool<(size_t(1) << 28), 16, null_stats, first_fit, null_lock, log_error, mmap_backing>;
+		span_pool<(size_t(1) << 28), size_class_table<16, 128, 4, 1024>, (1 << 16), 12, pool_t> _pool;
+
+	public:
+		static constexpr bool thread_safe = false;
+
+		explicit span_engine(size_t) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+	};
+
+	class malloc_engine
+	{
+	public:
+		static constexpr bool thread_safe = true;
+
+		explicit malloc_engine(size_t) {}
+
+		void *allocate(size_t size) { return std::malloc(size); }
+		void deallocate(void *p, size_t) { std::free(p); }
+	};
+
+	template<typename RESOURCE, bool THREAD_SAFE>
+	class pmr_engine
+	{
+		RESOURCE _resource;
+
+	public:
+		static constexpr bool thread_safe = THREAD_SAFE;
+
+		explicit pmr_engine(size_t) {}
+
+		void *allocate(size_t size) { return _resource.allocate(size, alignof(std::max_align_t)); }
+		void deallocate(void *p, size_t size) { _resource.deallocate(p, size, alignof(std::max_align_t)); }
+	};
+
+	using pmr_sync_engine = pmr_engine<std::pmr::synchronized_pool_resource, true>;
+	using pmr_unsync_engine = pmr_engine<std::pmr::unsynchronized_pool_resource, false>;
+
+	template<typename ENGINE>
+	class locked_engine
+	{
+		std::mutex _mutex;
+		ENGINE _engine;
+
+	public:
+		static constexpr bool thread_safe = true;
+
+		explicit locked_engine(size_t size) : _engine(size) {}
+
+		void *allocate(size_t size)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _engine.allocate(size);
+		}
+
+		void deallocate(void *p, size_t size)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_engine.deallocate(p, size);
+		}
+
+		void sample()
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			sample_fit(_engine);
+		}
+
+		fit_report report() const { return report_fit(_engine); }
+	};
+
+
+	// measurement
+
+	// calls between two fit samples of a thread
+	constexpr uint64_t FIT_SAMPLE_INTERVAL = 4096;
+
+	// per worker thread, live_bytes is read by the RSS sampler
+	struct alignas(64) thread_stats
+	{
+		latency_histogram<> latencies;
+		uint64_t operations = 0;
+		uint64_t failed = 0;
+		std::atomic<int64_t> live_bytes{ 0 };
+	};
+
+	template<typename ENGINE>
+	class bench_context
+	{
+		ENGINE &_engine;
+		thread_stats &_stats;
+
+		void add_live(int64_t delta) noexcept
+		{
+			_stats.live_bytes.store(_stats.live_bytes.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+		}
+
+	public:
+		bench_context(ENGINE &engine, thread_stats &stats) : _engine(engine), _stats(stats) {}
+
+		void *allocate(size_t size)
+		{
+			const uint64_t begin = tsc_clock::start();
+			void *p = _engine.allocate(size);
+			const uint64_t end = tsc_clock::stop();
+
+			_stats.latencies.record(end - begin);
+			if (++_stats.operations % FIT_SAMPLE_INTERVAL == 0)
+				sample_fit(_engine);
+			if (p == nullptr)
+				++_stats.failed;
+			else
+				add_live(static_cast<int64_t>(size));
+			return p;
+		}
+
+		void deallocate(void *p, size_t size)
+		{
+			if (p == nullptr)
+				return;
+
+			const uint64_t begin = tsc_clock::start();
+			_engine.deallocate(p, size);
+			const uint64_t end = tsc_clock::stop();
+
+			_stats.latencies.record(end - begin);
+			if (++_stats.operations % FIT_SAMPLE_INTERVAL == 0)
+				sample_fit(_engine);
+			add_live(-static_cast<int64_t>(size));
+		}
+	};
+
+	size_t resident_bytes()
+	{
+		std::ifstream statm("/proc/self/statm");
+		size_t pages = 0, resident = 0;
+		statm >> pages >> resident;
+		return resident * mmap_chunk_source::page_size();
+	}
+
+	// malloc'ed bytes in use, malloc and the pmr resources reuse memory kept
+	// from earlier runs so RSS alone would not see them grow
+	size_t heap_bytes()
+	{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+		const struct mallinfo2 info = mallinfo2();
+		return info.uordblks + info.hblkhd;
+#else
+		return 0;
+#endif
+	}
+
+	// Samples RSS, the malloc heap and the live bytes of all workers every
+	// millisecond. The footprint is whichever of RSS and heap grew more.
+	class footprint_sampler
+	{
+		const std::vector<thread_stats> &_stats;
+		const size_t _rss_baseline = resident_bytes();
+		const size_t _heap_baseline = heap_bytes();
+		std::atomic<bool> _running{ true };
+		size_t _peak_footprint = 0;
+		int64_t _peak_live = 0;
+		std::thread _thread;
+
+		void sample()
+		{
+			int64_t live = 0;
+			for (const thread_stats &s : _stats)
+				live += s.live_bytes.load(std::memory_order_relaxed);
+			_peak_live = std::max(_peak_live, live);
+
+			const size_t rss = resident_bytes();
+			const size_t heap = heap_bytes();
+			_peak_footprint = std::max(_peak_footprint, std::max(
+				rss > _rss_baseline ? rss - _rss_baseline : 0,
+				heap > _heap_baseline ? heap - _heap_baseline : 0));
+		}
+
+	public:
+		// before the engine is made so its own setup counts
+		explicit footprint_sampler(const std::vector<thread_stats> &stats)
+			: _stats(stats), _thread([this]()
+			{
+				while (_running.load(std::memory_order_relaxed))
+				{
+					sample();
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+			})
+		{
+		}
+
+		void stop()
+		{
+			_running.store(false, std::memory_order_relaxed);
+			_thread.join();
+			sample();
+		}
+
+		size_t peak_footprint() const { return _peak_footprint; }
+		size_t peak_live() const { return static_cast<size_t>(std::max<int64_t>(0, _peak_live)); }
+	};
+
+	// Runs f(thread index) on n threads released together, returns the seconds
+	// from release to the last join.
+	template<typename FUNCTION>
+	double run_threads(size_t n, FUNCTION f)
+	{
+		std::atomic<bool> go{ false };
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < n; ++i)
+		{
+			threads.emplace_back([&, i]()
+			{
+				while (false == go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				f(i);
+			});
+		}
+
+		const auto begin = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		for (auto &t : threads)
+			t.join();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+	class barrier
+	{
+		const size_t _count;
+		std::atomic<size_t> _waiting{ 0 };
+		std::atomic<size_t> _generation{ 0 };
+
+	public:
+		explicit barrier(size_t count) : _count(count) {}
+
+		void wait()
+		{
+			const size_t generation = _generation.load(std::memory_order_acquire);
+			if (_waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == _count)
+			{
+				_waiting.store(0, std::memory_order_relaxed);
+				_generation.fetch_add(1, std::memory_order_release);
+			}
+			else
+			{
+				while (_generation.load(std::memory_order_acquire) == generation)
+					std::this_thread::yield();
+			}
+		}
+	};
+
+	size_t random_size(std::minstd_rand &rng, size_t min_size, size_t max_size)
+	{
+		// log uniform, small blocks dominate as they do in real programs
+		const size_t bits_min = 63 - static_cast<size_t>(__builtin_clzll(min_size));
+		const size_t bits_max = 63 - static_cast<size_t>(__builtin_clzll(max_size));
+		const size_t top = size_t(1) << (bits_min + rng() % (bits_max - bits_min + 1));
+		return std::min(max_size, std::max(min_size, top + rng() % top));
+	}
+
+	void touch(void *p, size_t size, size_t times)
+	{
+		volatile char *c = static_cast<volatile char*>(p);
+		for (size_t t = 0; t < times; ++t)
+			for (size_t i = 0; i < size; ++i)
+				c[i] = static_cast<char>(c[i] + 1);
+	}
+
+
+	// workloads, each returns its wall time in seconds
+
+	struct block
+	{
+		void *p = nullptr;
+		size_t size = 0;
+	};
+
+	// one thread replacing the oldest of 1024 live 64 byte blocks
+	template<typename ENGINE>
+	double churn(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		return run_threads(1, [&](size_t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[0]);
+			std::vector<block> ring(1024);
+			const size_t ops = scaled(1000000, opt);
+			for (size_t i = 0; i < ops; ++i)
+			{
+				block &b = ring[i % ring.size()];
+				ctx.deallocate(b.p, b.size);
+				b.size = 64;
+				b.p = ctx.allocate(b.size);
+			}
+			for (block &b : ring)
+				ctx.deallocate(b.p, b.size);
+		});
+	}
+
+	// one thread replacing random blocks of 16 bytes to 4 KiB among 1024 live ones
+	template<typename ENGINE>
+	double random_sizes(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		return run_threads(1, [&](size_t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[0]);
+			std::minstd_rand rng(42);
+			std::vector<block> live(1024);
+			const size_t ops = scaled(500000, opt);
+			for (size_t i = 0; i < ops; ++i)
+			{
+				block &b = live[rng() % live.size()];
+				ctx.deallocate(b.p, b.size);
+				b.size = random_size(rng, 16, 4096);
+				b.p = ctx.allocate(b.size);
+			}
+			for (block &b : live)
+				ctx.deallocate(b.p, b.size);
+		});
+	}
+
+	// Larson: every thread replaces random blocks of 16 to 1024 bytes in its
+	// slot array, between rounds the arrays move on to the next thread, which
+	// frees what the previous one allocated
+	template<typename ENGINE>
+	double larson(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		const size_t threads = opt.threads;
+		const size_t rounds = 10;
+		std::vector<std::vector<block>> arrays(threads, std::vector<block>(1000));
+		barrier round_end(threads);
+
+		return run_threads(threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			std::minstd_rand rng(static_cast<uint32_t>(t + 1));
+			const size_t ops = scaled(50000, opt) / rounds + 1;
+
+			for (size_t round = 0; round < rounds; ++round)
+			{
+				std::vector<block> &slots = arrays[(t + round) % threads];
+				for (size_t i = 0; i < ops; ++i)
+				{
+					block &b = slots[rng() % slots.size()];
+					ctx.deallocate(b.p, b.size);
+					b.size = random_size(rng, 16, 1024);
+					b.p = ctx.allocate(b.size);
+				}
+				round_end.wait();
+			}
+
+			for (block &b : arrays[t])
+				ctx.deallocate(b.p, b.size);
+		});
+	}
+
+	// threadtest: every thread allocates a batch of small objects and frees them all
+	template<typename ENGINE>
+	double threadtest(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		return run_threads(opt.threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			std::vector<void*> objects(2000);
+			const size_t iterations = scaled(50, opt);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (void *&p : objects)
+					p = ctx.allocate(8);
+				for (void *p : objects)
+					ctx.deallocate(p, 8);
+			}
+		});
+	}
+
+	// cache-scratch: every thread starts by freeing an object allocated next to
+	// the other threads' ones, then reuses whatever it gets back; an allocator
+	// handing that memory out again causes passive false sharing
+	template<typename ENGINE>
+	double cache_scratch(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		std::vector<void*> initial(opt.threads);
+		for (void *&p : initial)
+			p = engine.allocate(8);
+
+		return run_threads(opt.threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			if (initial[t] != nullptr)
+				engine.deallocate(initial[t], 8);
+
+			const size_t iterations = scaled(20000, opt);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				void *p = ctx.allocate(8);
+				if (p != nullptr)
+					touch(p, 8, 50);
+				ctx.deallocate(p, 8);
+			}
+		});
+	}
+
+	// cache-thrash: threads allocate, write and free small objects at the same
+	// time; an allocator placing them on one cache line causes active false sharing
+	template<typename ENGINE>
+	double cache_thrash(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		return run_threads(opt.threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			const size_t iterations = scaled(20000, opt);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				void *p = ctx.allocate(8);
+				if (p != nullptr)
+					touch(p, 8, 50);
+				ctx.deallocate(p, 8);
+			}
+		});
+	}
+
+	// xmalloc: half the threads allocate blocks of 16 to 512 bytes and pass
+	// them on in batches, the other half frees them
+	template<typename ENGINE>
+	double xmalloc(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		const size_t threads = std::max<size_t>(2, opt.threads);
+		const size_t producers = threads / 2;
+		const size_t batch_size = 64;
+
+		std::mutex mutex;
+		std::deque<std::vector<block>> queue;
+		std::atomic<size_t> producing{ producers };
+
+		return run_threads(threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			if (t < producers)
+			{
+				std::minstd_rand rng(static_cast<uint32_t>(t + 1));
+				const size_t batches = scaled(100000, opt) / batch_size + 1;
+				for (size_t i = 0; i < batches; ++i)
+				{
+					std::vector<block> batch(batch_size);
+					for (block &b : batch)
+					{
+						b.size = random_size(rng, 16, 512);
+						b.p = ctx.allocate(b.size);
+					}
+
+					while (true)
+					{
+						{
+							std::lock_guard<std::mutex> lock(mutex);
+							if (queue.size() < 256)
+							{
+								queue.push_back(std::move(batch));
+								break;
+							}
+						}
+						std::this_thread::yield();
+					}
+				}
+				producing.fetch_sub(1, std::memory_order_release);
+			}
+			else
+			{
+				while (true)
+				{
+					std::vector<block> batch;
+					bool done = false;
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						if (false == queue.empty())
+						{
+							batch = std::move(queue.front());
+							queue.pop_front();
+						}
+						else
+							done = producing.load(std::memory_order_acquire) == 0;
+					}
+
+					if (done)
+						break;
+					if (batch.empty())
+						std::this_thread::yield();
+					for (block &b : batch)
+						ctx.deallocate(b.p, b.size);
+				}
+			}
+		});
+	}
+
+	// linux-scalability: every thread allocates many same size blocks, then frees them all
+	template<typename ENGINE>
+	double linux_scalability(ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		return run_threads(opt.threads, [&](size_t t)
+		{
+			bench_context<ENGINE> ctx(engine, stats[t]);
+			std::vector<void*> objects(10000);
+			const size_t iterations = scaled(10, opt);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (void *&p : objects)
+					p = ctx.allocate(512);
+				for (void *p : objects)
+					ctx.deallocate(p, 512);
+			}
+		});
+	}
+
+	struct workload
+	{
+		const char *name;
+		bool multi_threaded;
+	};
+
+	const workload WORKLOADS[] = {
+		{ "churn", false },
+		{ "random", false },
+		{ "larson", true },
+		{ "threadtest", true },
+		{ "cache-scratch", true },
+		{ "cache-thrash", true },
+		{ "xmalloc", true },
+		{ "linux-scalability", true },
+	};
+
+	const char *const ENGINES[] = { "static", "static-next", "static-best", "static-tree", "static-quick", "static-unsorted", "static-bounded", "growable", "shared", "size-class", "span", "malloc", "pmr-sync", "pmr-unsync" };
+
+	template<typename ENGINE>
+	double run_workload(const std::string &name, ENGINE &engine, std::vector<thread_stats> &stats, const options &opt)
+	{
+		if (name == "churn")
+			return churn(engine, stats, opt);
+		if (name == "random")
+			return random_sizes(engine, stats, opt);
+		if (name == "larson")
+			return larson(engine, stats, opt);
+		if (name == "threadtest")
+			return threadtest(engine, stats, opt);
+		if (name == "cache-scratch")
+			return cache_scratch(engine, stats, opt);
+		if (name == "cache-thrash")
+			return cache_thrash(engine, stats, opt);
+		if (name == "xmalloc")
+			return xmalloc(engine, stats, opt);
+		return linux_scalability(engine, stats, opt);
+	}
+
+
+	struct result
+	{
+		std::string workload;
+		std::string engine;
+		size_t trial = 0;
+		size_t threads = 0;
+		uint64_t operations = 0;
+		uint64_t failed = 0;
+		double seconds = 0;
+		uint64_t p50_ns = 0;
+		uint64_t p99_ns = 0;
+		uint64_t p999_ns = 0;
+		uint64_t max_ns = 0;
+		size_t peak_footprint = 0;
+		size_t peak_live = 0;
+		bool locked = false;
+		perf_sample counters;
+		fit_report fit;
+
+		double ops_per_second() const { return seconds > 0 ? double(operations) / seconds : 0.0; }
+
+		// negative when the counter is unavailable
+		double per_operation(size_t counter) const
+		{
+			return counters.valid[counter] && operations > 0 ? double(counters.values[counter]) / double(operations) : -1.0;
+		}
+
+		// memory held beyond what the workload asked for, relative to it
+		double overhead() const
+		{
+			return peak_live == 0 ? 0.0 : (double(peak_footprint) - double(peak_live)) / double(peak_live);
+		}
+	};
+
+	template<typename ENGINE>
+	result measure(const workload &w, const std::string &engine_name, const options &opt, bool locked)
+	{
+#if defined(__GLIBC__)
+		// memory kept by malloc from earlier runs would hide this run's growth
+		malloc_trim(0);
+#endif
+		const size_t threads = w.multi_threaded ? std::max<size_t>(2, opt.threads) : 1;
+		std::vector<thread_stats> stats(threads);
+
+		result r;
+		{
+			footprint_sampler sampler(stats);
+			std::unique_ptr<ENGINE> engine(new ENGINE(opt.pool_size));
+
+			// opened after the sampler thread started so only the workload counts
+			perf_counters counters;
+			counters.start();
+			r.seconds = run_workload(w.name, *engine, stats, opt);
+			counters.stop();
+			r.counters = counters.read();
+			r.fit = report_fit(*engine);
+
+			sampler.stop();
+			r.peak_footprint = sampler.peak_footprint();
+			r.peak_live = sampler.peak_live();
+		}
+
+		latency_histogram<> latencies;
+		for (const thread_stats &s : stats)
+		{
+			latencies.merge(s.latencies);
+			r.operations += s.operations;
+			r.failed += s.failed;
+		}
+
+		r.workload = w.name;
+		r.engine = engine_name;
+		r.threads = threads;
+		r.locked = locked;
+		r.p50_ns = tsc_clock::to_ns(latencies.percentile(0.50));
+		r.p99_ns = tsc_clock::to_ns(latencies.percentile(0.99));
+		r.p999_ns = tsc_clock::to_ns(latencies.percentile(0.999));
+		r.max_ns = tsc_clock::to_ns(latencies.max());
+		return r;
+	}
+
+	template<typename ENGINE>
+	result measure_engine(const workload &w, const std::string &engine_name, const options &opt)
+	{
+		if (ENGINE::thread_safe || false == w.multi_threaded)
+			return measure<ENGINE>(w, engine_name, opt, false);
+		return measure<locked_engine<ENGINE>>(w, engine_name, opt, true);
+	}
+
+	result measure_named(const workload &w, const std::string &engine, const options &opt)
+	{
+		if (engine == "static")
+			return measure_engine<static_engine>(w, engine, opt);
+		if (engine == "static-next")
+			return measure_engine<next_engine>(w, engine, opt);
+		if (engine == "static-best")
+			return measure_engine<best_engine>(w, engine, opt);
+		if (engine == "static-tree")
+			return measure_engine<tree_engine>(w, engine, opt);
+		if (engine == "static-quick")
+			return measure_engine<quick_engine>(w, engine, opt);
+		if (engine == "static-unsorted")
+			return measure_engine<unsorted_engine>(w, engine, opt);
+		if (engine == "static-bounded")
+			return measure_engine<bounded_engine>(w, engine, opt);
+		if (engine == "growable")
+			return measure_engine<growable_engine>(w, engine, opt);
+		if (engine == "shared")
+			return measure_engine<shared_engine>(w, engine, opt);
+		if (engine == "size-class")
+			return measure_engine<size_class_engine>(w, engine, opt);
+		if (engine == "span")
+			return measure_engine<span_engine>(w, engine, opt);
+		if (engine == "malloc")
+			return measure_engine<malloc_engine>(w, engine, opt);
+		if (engine == "pmr-sync")
+			return measure_engine<pmr_sync_engine>(w, engine, opt);
+		return measure_engine<pmr_unsync_engine>(w, engine, opt);
+	}
+
+	void write_json(std::ostream &out, const std::vector<result> &results, const options &opt)
+	{
+		out << "{\"benchmark\":\"allocator_bench\",\"hardware_threads\":" << std::thread::hardware_concurrency()
+			<< ",\"scale\":" << opt.scale << ",\"pool_size\":" << opt.pool_size << ",\"repeat\":" << opt.repeat << ",\"results\":[";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const result &r = results[i];
+			out << (i == 0 ? "" : ",") << "\n{\"workload\":\"" << r.workload << "\",\"engine\":\"" << r.engine
+				<< "\",\"trial\":" << r.trial << ",\"threads\":" << r.threads << ",\"locked\":" << (r.locked ? "true" : "false")
+				<< ",\"operations\":" << r.operations << ",\"failed\":" << r.failed
+				<< ",\"seconds\":" << r.seconds << ",\"ops_per_second\":" << r.ops_per_second()
+				<< ",\"latency_ns\":{\"p50\":" << r.p50_ns << ",\"p99\":" << r.p99_ns
+				<< ",\"p99.9\":" << r.p999_ns << ",\"max\":" << r.max_ns << "}"
+				<< ",\"peak_footprint_bytes\":" << r.peak_footprint << ",\"peak_live_bytes\":" << r.peak_live
+				<< ",\"metadata_overhead\":" << r.overhead() << ",\"fit\":";
+			if (r.fit.valid)
+				out << "{\"mean_search\":" << r.fit.mean_search << ",\"fragmentation\":" << r.fit.fragmentation
+					<< ",\"peak_fragmentation\":" << r.fit.peak_fragmentation << "}";
+			else
+				out << "null";
+			out << ",\"per_operation\":{";
+			for (size_t c = 0; c < perf_counters::COUNTERS; ++c)
+			{
+				out << (c == 0 ? "" : ",") << "\"" << perf_counters::name(static_cast<perf_counters::counter>(c)) << "\":";
+				if (r.per_operation(c) < 0)
+					out << "null";
+				else
+					out << r.per_operation(c);
+			}
+			out << "}}";
+		}
+		out << "]}\n";
+	}
+
+	std::vector<std::string> split(const std::string &list)
+	{
+		std::vector<std::string> items;
+		std::stringstream in(list);
+		std::string item;
+		while (std::getline(in, item, ','))
+			items.push_back(item);
+		return items;
+	}
+
+	int usage()
+	{
+		std::fprintf(stderr, "usage: allocator_bench [--workload name[,name...]] [--engine name[,name...]]\n"
+			"                       [--threads n] [--scale x] [--pool-size bytes] [--repeat n] [--json path]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	options opt;
+	std::vector<std::string> workloads, engines(std::begin(ENGINES), std::end(ENGINES));
+	for (const workload &w : WORKLOADS)
+		workloads.push_back(w.name);
+	std::string json_path;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--workload") == 0 && i + 1 < argc)
+			workloads = split(argv[++i]);
+		else if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+			engines = split(argv[++i]);
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			opt.threads = std::max<size_t>(1, std::stoull(argv[++i]));
+		else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+			opt.scale = std::stod(argv[++i]);
+		else if (std::strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc)
+			opt.pool_size = std::stoull(argv[++i]);
+		else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+			opt.repeat = std::max<size_t>(1, std::stoull(argv[++i]));
+		else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			json_path = argv[++i];
+		else
+			return usage();
+	}
+
+	for (const std::string &e : engines)
+		if (std::find(std::begin(ENGINES), std::end(ENGINES), e) == std::end(ENGINES))
+			return usage();
+
+	std::vector<result> results;
+	std::printf("%-18s %-20s %3s %14s %9s %9s %9s %11s %13s %12s %9s %8s %8s %6s %8s %8s %8s %8s %8s %8s\n", "workload", "engine", "thr",
+		"ops/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "footprint KiB", "live KiB", "overhead", "failed", "search", "frag",
+		"cyc/op", "ins/op", "l1d/op", "llc/op", "dtlb/op", "brm/op");
+
+	for (const std::string &name : workloads)
+	{
+		const workload *w = std::find_if(std::begin(WORKLOADS), std::end(WORKLOADS),
+			[&](const workload &candidate) { return name == candidate.name; });
+		if (w == std::end(WORKLOADS))
+			return usage();
+
+		for (size_t trial = 0; trial < opt.repeat; ++trial)
+		{
+			for (const std::string &engine : engines)
+			{
+				result r = measure_named(*w, engine, opt);
+				r.trial = trial;
+				std::printf("%-18s %-20s %3zu %14.0f %9llu %9llu %9llu %11llu %13zu %12zu %9.2f %8llu",
+					r.workload.c_str(), (r.engine + (r.locked ? "+lock" : "")).c_str(), r.threads, r.ops_per_second(),
+					static_cast<unsigned long long>(r.p50_ns), static_cast<unsigned long long>(r.p99_ns),
+					static_cast<unsigned long long>(r.p999_ns), static_cast<unsigned long long>(r.max_ns),
+					r.peak_footprint / 1024, r.peak_live / 1024, r.overhead(), static_cast<unsigned long long>(r.failed));
+				if (r.fit.valid)
+					std::printf(" %8.1f %6.2f", r.fit.mean_search, r.fit.fragmentation);
+				else
+					std::printf(" %8s %6s", "-", "-");
+				for (size_t c = 0; c < perf_counters::COUNTERS; ++c)
+				{
+					if (r.per_operation(c) < 0)
+						std::printf(" %8s", "-");
+					else
+						std::printf(" %8.2f", r.per_operation(c));
+				}
+				std::printf("\n");
+				std::fflush(stdout);
+				results.push_back(r);
+			}
+		}
+	}
+
+	if (false == json_path.empty())
+	{
+		std::ofstream out(json_path);
+		if (false == out.good())
+		{
+			std::fprintf(stderr, "cannot write %s\n", json_path.c_str());
+			return 1;
+		}
+		write_json(out, results, opt);
+	}
+
+	return 0;
+}
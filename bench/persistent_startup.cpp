@@ -0,0 +1,137 @@
+// Startup cost of a file backed pool: rebuilding an index from scratch
+// against re-mapping the file a previous run left behind.
+//
+// usage: persistent_startup [entries] [path]
+
+#include "shared_memory_pool.h"
+#include "offset_ptr.h"
+#include "timer.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace ss;
+
+using pool_t = shared_memory_pool<>;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+	struct entry
+	{
+		uint64_t key;
+		uint64_t value;
+		offset_ptr<entry> next;
+	};
+
+	struct hash_index
+	{
+		uint64_t num_buckets;
+		uint64_t num_entries;
+		offset_ptr<offset_ptr<entry>> buckets;
+	};
+
+	constexpr size_t ENTRIES_PER_SLAB = 4096;
+
+	uint64_t key_of(uint64_t i)
+	{
+		// splitmix64, stands in for parsing whatever the index is built from
+		uint64_t z = i + 0x9e3779b97f4a7c15ull;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	hash_index *build(pool_t &pool, uint64_t num_entries)
+	{
+		hash_index *idx = static_cast<hash_index*>(pool.allocate(sizeof(hash_index), true));
+		idx->num_buckets = 1;
+		while (idx->num_buckets < num_entries)
+			idx->num_buckets <<= 1;
+		idx->num_entries = num_entries;
+
+		auto *buckets = static_cast<offset_ptr<entry>*>(pool.allocate(idx->num_buckets * sizeof(offset_ptr<entry>), true));
+		for (uint64_t b = 0; b < idx->num_buckets; ++b)
+			new (&buckets[b]) offset_ptr<entry>();
+		idx->buckets = buckets;
+
+		entry *slab = nullptr;
+		for (uint64_t i = 0; i < num_entries; ++i)
+		{
+			if (i % ENTRIES_PER_SLAB == 0)
+				slab = static_cast<entry*>(pool.allocate(ENTRIES_PER_SLAB * sizeof(entry), true));
+
+			entry *e = new (&slab[i % ENTRIES_PER_SLAB]) entry();
+			e->key = key_of(i);
+			e->value = i;
+			offset_ptr<entry> &bucket = buckets[e->key & (idx->num_buckets - 1)];
+			e->next = bucket;
+			bucket = e;
+		}
+
+		pool.set_root(idx);
+		return idx;
+	}
+
+	bool lookup(const hash_index *idx, uint64_t i)
+	{
+		const uint64_t key = key_of(i);
+		for (const entry *e = idx->buckets[key & (idx->num_buckets - 1)].get(); e != nullptr; e = e->next.get())
+		{
+			if (e->key == key)
+				return e->value == i;
+		}
+		return false;
+	}
+
+	size_t pool_size_for(uint64_t num_entries)
+	{
+		const size_t slabs = (num_entries + ENTRIES_PER_SLAB - 1) / ENTRIES_PER_SLAB;
+		return (slabs + 1) * (ENTRIES_PER_SLAB * sizeof(entry) + 4096) + 4 * num_entries * sizeof(offset_ptr<entry>) + (1 << 20);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const uint64_t num_entries = argc > 1 ? std::stoull(argv[1]) : 1000000;
+	const std::string path = argc > 2 ? argv[2] : "/tmp/ss_persistent_startup.pool";
+	::unlink(path.c_str());
+
+	timer<clock_type> t;
+
+	t.tick();
+	{
+		SS_PROFILE_ZONE("rebuild");
+		pool_t pool = pool_t::create_file(path, pool_size_for(num_entries));
+		build(pool, num_entries);
+		pool.sync();
+	}
+	t.tock();
+	const uint64_t rebuild_us = t.duration<std::chrono::microseconds>();
+
+	t.tick();
+	pool_t pool = pool_t::open_file(path);
+	const hash_index *idx = static_cast<const hash_index*>(pool.root());
+	t.tock();
+	const uint64_t remap_us = t.duration<std::chrono::microseconds>();
+
+	// touch a sample of entries so the remap cost includes faulting them in
+	bool ok = idx != nullptr && idx->num_entries == num_entries;
+	t.tick();
+	{
+		SS_PROFILE_ZONE("first probe");
+		for (uint64_t i = 0; ok && i < num_entries; i += 97)
+			ok = lookup(idx, i);
+	}
+	t.tock();
+	const uint64_t probe_us = t.duration<std::chrono::microseconds>();
+
+	std::printf("entries           %llu\n", static_cast<unsigned long long>(num_entries));
+	std::printf("rebuild + sync    %llu us\n", static_cast<unsigned long long>(rebuild_us));
+	std::printf("remap             %llu us\n", static_cast<unsigned long long>(remap_us));
+	std::printf("remap first probe %llu us (every 97th key)\n", static_cast<unsigned long long>(probe_us));
+	std::printf("index intact      %s\n", ok ? "yes" : "NO");
+
+	::unlink(path.c_str());
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// snapshot() latency against pool size, next to a memcpy of the whole pool.
+// "first" snapshots a fully written pool, "incremental" snapshots it again
+// after 1% of its pages were dirtied.
+//
+// usage: snapshot_latency [max pool size in MiB]
+
+#include "shared_memory_pool.h"
+#include "timer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ss;
+
+using pool_t = shared_memory_pool<>;
+using clock_type = std::chrono::steady_clock;
+
+int main(int argc, char **argv)
+{
+	const size_t max_mib = argc > 1 ? std::stoull(argv[1]) : 256;
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+	std::printf("%10s %14s %18s %14s\n", "pool MiB", "first us", "incremental us", "memcpy us");
+
+	for (size_t mib = 4; mib <= max_mib; mib *= 2)
+	{
+		SS_PROFILE_ZONE("pool size");
+		const size_t size = mib << 20;
+		pool_t pool = pool_t::create_private(size);
+
+		const size_t payload = size / 2;
+		uint8_t *data = static_cast<uint8_t*>(pool.allocate(payload, true));
+		std::memset(data, 0xab, payload);
+
+		timer<clock_type> t;
+
+		t.tick();
+		{
+			pool_t snapshot = pool.snapshot();
+		}
+		t.tock();
+		const uint64_t first_us = t.duration<std::chrono::microseconds>();
+
+		for (size_t offset = 0; offset < payload; offset += 100 * page)
+			data[offset] ^= 1;
+
+		t.tick();
+		pool_t snapshot = pool.snapshot();
+		t.tock();
+		const uint64_t incremental_us = t.duration<std::chrono::microseconds>();
+
+		std::vector<uint8_t> copy(size);
+		t.tick();
+		{
+			SS_PROFILE_ZONE("memcpy");
+			std::memcpy(copy.data(), pool.base(), size);
+		}
+		t.tock();
+		const uint64_t memcpy_us = t.duration<std::chrono::microseconds>();
+
+		std::printf("%10zu %14llu %18llu %14llu\n", mib,
+			static_cast<unsigned long long>(first_us),
+			static_cast<unsigned long long>(incremental_us),
+			static_cast<unsigned long long>(memcpy_us));
+	}
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace ss
+{
+	// Statistics for comparing repeated benchmark trials, see
+	// tools/bench_compare.cpp. Nothing here assumes normally distributed
+	// timings: the test is rank based and the interval is a bootstrap.
+
+	inline double median(std::vector<double> values)
+	{
+		if (values.empty())
+			return 0.0;
+		std::sort(values.begin(), values.end());
+		const size_t n = values.size();
+		return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+	}
+
+	inline double mean(const std::vector<double> &values)
+	{
+		double sum = 0;
+		for (double v : values)
+			sum += v;
+		return values.empty() ? 0.0 : sum / double(values.size());
+	}
+
+	// sample standard deviation over the mean, 0 for fewer than 2 values
+	inline double coefficient_of_variation(const std::vector<double> &values)
+	{
+		if (values.size() < 2)
+			return 0.0;
+		const double m = mean(values);
+		double squares = 0;
+		for (double v : values)
+			squares += (v - m) * (v - m);
+		const double sd = std::sqrt(squares / double(values.size() - 1));
+		return m == 0.0 ? 0.0 : sd / std::fabs(m);
+	}
+
+
+	struct mann_whitney_result
+	{
+		// U of the first sample: how often one of its values beats one of the second's
+		double u = 0;
+		// two sided
+		double p_value = 1.0;
+		bool exact = false;
+	};
+
+	// Mann-Whitney U test of whether a and b come from the same distribution.
+	// Small samples without ties get the exact distribution of U, larger
+	// ones the normal approximation with tie correction.
+	inline mann_whitney_result mann_whitney_u(const std::vector<double> &a, const std::vector<double> &b)
+	{
+		mann_whitney_result result;
+		const size_t n1 = a.size();
+		const size_t n2 = b.size();
+		if (n1 == 0 || n2 == 0)
+			return result;
+
+		// rank the pooled sample, ties share the mean of their ranks
+		struct ranked
+		{
+			double value;
+			bool first;
+		};
+		std::vector<ranked> pooled;
+		for (double v : a)
+			pooled.push_back({ v, true });
+		for (double v : b)
+			pooled.push_back({ v, false });
+		std::sort(pooled.begin(), pooled.end(), [](const ranked &x, const ranked &y) { return x.value < y.value; });
+
+		const double n = double(n1 + n2);
+		double rank_sum = 0;
+		double tie_term = 0;
+		bool ties = false;
+		for (size_t i = 0; i < pooled.size(); )
+		{
+			size_t j = i;
+			while (j < pooled.size() && pooled[j].value == pooled[i].value)
+				++j;
+			const double t = double(j - i);
+			const double rank = (double(i + 1) + double(j)) / 2.0;
+			for (size_t k = i; k < j; ++k)
+				if (pooled[k].first)
+					rank_sum += rank;
+			if (t > 1)
+			{
+				ties = true;
+				tie_term += t * t * t - t;
+			}
+			i = j;
+		}
+
+		result.u = rank_sum - double(n1) * double(n1 + 1) / 2.0;
+		const double u_max = double(n1) * double(n2);
+		const double u_small = std::min(result.u, u_max - result.u);
+
+		if (false == ties && n1 <= 20 && n2 <= 20)
+		{
+			// ways(k, m)[u]: orderings of k values of a and m of b with U = u. The
+			// largest value either comes from a, beating all m values of b, or from b.
+			const size_t max_u = n1 * n2;
+			std::vector<std::vector<double>> table((n1 + 1) * (n2 + 1), std::vector<double>(max_u + 1, 0.0));
+			auto ways = [&](size_t k, size_t m) -> std::vector<double>& { return table[k * (n2 + 1) + m]; };
+			for (size_t k = 0; k <= n1; ++k)
+			{
+				for (size_t m = 0; m <= n2; ++m)
+				{
+					if (k == 0 || m == 0)
+					{
+						ways(k, m)[0] = 1.0;
+						continue;
+					}
+					for (size_t u = 0; u <= k * m; ++u)
+						ways(k, m)[u] = (u >= m ? ways(k - 1, m)[u - m] : 0.0) + ways(k, m - 1)[u];
+				}
+			}
+
+			double total = 0, tail = 0;
+			for (size_t u = 0; u <= max_u; ++u)
+			{
+				total += ways(n1, n2)[u];
+				if (double(u) <= u_small)
+					tail += ways(n1, n2)[u];
+			}
+			result.p_value = std::min(1.0, 2.0 * tail / total);
+			result.exact = true;
+			return result;
+		}
+
+		const double mu = u_max / 2.0;
+		const double sigma = std::sqrt(u_max / 12.0 * ((n + 1) - tie_term / (n * (n - 1))));
+		if (sigma == 0.0)
+			return result;
+
+		// continuity correction
+		const double z = (std::fabs(result.u - mu) - 0.5) / sigma;
+		result.p_value = std::min(1.0, std::erfc(std::max(0.0, z) / std::sqrt(2.0)));
+		return result;
+	}
+
+
+	struct confidence_interval
+	{
+		double estimate = 0;
+		double low = 0;
+		double high = 0;
+	};
+
+	// Relative change median(candidate) / median(baseline) - 1 with a
+	// percentile bootstrap interval at the given confidence.
+	inline confidence_interval bootstrap_relative_change(const std::vector<double> &baseline, const std::vector<double> &candidate,
+		double confidence = 0.95, size_t resamples = 2000, uint32_t seed = 1)
+	{
+		confidence_interval result;
+		const double base = median(baseline);
+		if (baseline.empty() || candidate.empty() || base == 0.0)
+			return result;
+		result.estimate = median(candidate) / base - 1.0;
+
+		std::mt19937 rng(seed);
+		std::vector<double> changes;
+		changes.reserve(resamples);
+		std::vector<double> a(baseline.size()), b(candidate.size());
+		for (size_t r = 0; r < resamples; ++r)
+		{
+			for (double &v : a)
+				v = baseline[rng() % baseline.size()];
+			for (double &v : b)
+				v = candidate[rng() % candidate.size()];
+			const double m = median(a);
+			if (m != 0.0)
+				changes.push_back(median(b) / m - 1.0);
+		}
+		if (changes.empty())
+			return result;
+
+		std::sort(changes.begin(), changes.end());
+		const double alpha = (1.0 - confidence) / 2.0;
+		const size_t low = static_cast<size_t>(alpha * double(changes.size()));
+		const size_t high = std::min(changes.size() - 1, static_cast<size_t>((1.0 - alpha) * double(changes.size())));
+		result.low = changes[low];
+		result.high = changes[high];
+		return result;
+	}
+}
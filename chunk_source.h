@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ss
+{
+	// Upstream memory for pools that obtain their storage at runtime.
+	// acquire() returns nullptr on failure, release() gets the same size back.
+
+	struct mmap_chunk_source
+	{
+		static size_t page_size() noexcept
+		{
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return static_cast<size_t>(info.dwPageSize);
+#else
+			static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			return size;
+#endif
+		}
+
+		static void *acquire(size_t size) noexcept
+		{
+#ifdef _WIN32
+			return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+			void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			return p == MAP_FAILED ? nullptr : p;
+#endif
+		}
+
+		static void release(void *p, size_t size) noexcept
+		{
+#ifdef _WIN32
+			(void)size;
+			VirtualFree(p, 0, MEM_RELEASE);
+#else
+			munmap(p, size);
+#endif
+		}
+	};
+
+	struct malloc_chunk_source
+	{
+		static size_t page_size() noexcept
+		{
+			return alignof(std::max_align_t);
+		}
+
+		static void *acquire(size_t size) noexcept
+		{
+			return std::malloc(size);
+		}
+
+		static void release(void *p, size_t) noexcept
+		{
+			std::free(p);
+		}
+	};
+}
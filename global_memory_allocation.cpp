@@ -1,4 +1,5 @@
 #include "static_memory_pool.h"
+#include "pool_registry.h"
 #include <cstdint>
 using namespace ss;
 
@@ -10,28 +11,50 @@ using namespace ss;
 #ifdef GLOBAL_NEW_OVERRIDE
 using static_memory_pool_t = static_memory_pool<POOL_SIZE>;
 
+namespace
+{
+	// the global pool, registered on first use
+	static_memory_pool_t &global_pool() noexcept
+	{
+		static_memory_pool_t &pool = static_memory_pool_t::get_instance();
+		static const pool_owner owner = make_pool_owner(pool, "static");
+		static const bool registered = pool_registry::get_instance().add(
+			reinterpret_cast<void*>(pool.buffer_start()), POOL_SIZE, &owner);
+		(void)registered;
+		return pool;
+	}
+
+	// any registered pool's pointer goes back to its owner, the global pool
+	// reports the rest
+	void route_delete(void *ptr) noexcept
+	{
+		if (ptr != nullptr && false == pool_registry::get_instance().deallocate(ptr))
+			global_pool().deallocate(ptr);
+	}
+}
+
  void* operator new(std::size_t sz) noexcept
  {
- 	return static_memory_pool_t::get_instance().allocate(sz);
+ 	return global_pool().allocate(sz);
  }
 
  void operator delete (void* ptr) noexcept
  {
- 	return static_memory_pool_t::get_instance().deallocate(ptr);
+ 	route_delete(ptr);
  }
 
  void* operator new (std::size_t size, const std::nothrow_t& nothrow_value) noexcept
  {
- 	return static_memory_pool_t::get_instance().allocate(size);
+ 	return global_pool().allocate(size);
  }
 
  void *operator new[](std::size_t s) throw(std::bad_alloc)
  {
-	 return static_memory_pool_t::get_instance().allocate(s, true);
+	 return global_pool().allocate(s, true);
  }
 
 void operator delete[](void *p) noexcept
  {
-	 return static_memory_pool_t::get_instance().deallocate(p);
+	 route_delete(p);
  }
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
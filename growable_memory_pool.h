@@ -0,0 +1,248 @@
+#pragma once
+
+#include "basic_memory_pool.h"
+#include "chunk_source.h"
+#include <array>
+#include <algorithm>
+#include <new>
+
+namespace ss
+{
+	// Pool that obtains another chunk from CHUNK_SOURCE when the existing ones
+	// are exhausted instead of failing. Chunk sizes grow geometrically with the
+	// number of live chunks, each chunk keeps its own block list and
+	// deallocate() routes to the owning chunk by address. A chunk that becomes
+	// empty is handed back upstream, keeping at most one empty chunk around so
+	// a workload oscillating around a chunk boundary doesn't map/unmap on
+	// every call.
+	template<size_t INITIAL_CHUNK_SIZE = (1 << 20), size_t ALIGNMENT = std::alignment_of<uintptr_t>(),
+		size_t GROWTH_FACTOR = 2, size_t MAX_CHUNKS = 32, typename CHUNK_SOURCE = mmap_chunk_source>
+	class growable_memory_pool
+	{
+		static_assert(GROWTH_FACTOR >= 1, "GROWTH_FACTOR must be at least 1");
+		static_assert(MAX_CHUNKS > 0, "MAX_CHUNKS must be positive");
+
+	public:
+		using chunk_pool_t = basic_memory_pool<ALIGNMENT>;
+		static constexpr size_t ALIGNED_HEADER_SIZE = chunk_pool_t::ALIGNED_HEADER_SIZE;
+		static constexpr size_t ALIGNMENT_MASK = chunk_pool_t::ALIGNMENT_MASK;
+
+	private:
+		// each chunk starts with its own pool object, followed by the buffer
+		static constexpr size_t CHUNK_HEADER_SIZE = (sizeof(chunk_pool_t) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+		struct chunk
+		{
+			chunk_pool_t *pool;
+			void *memory;
+			size_t size;
+
+			size_t in_use() const noexcept { return pool->allocated() - pool->deallocated(); }
+		};
+
+		// sorted by chunk address so deallocate() can binary search
+		std::array<chunk, MAX_CHUNKS> _chunks;
+		size_t _num_chunks = 0;
+		size_t _last_used = 0;
+
+		size_t _allocated = 0;
+		size_t _deallocated = 0;
+
+		static size_t round_to_page(size_t size) noexcept
+		{
+			const size_t page = CHUNK_SOURCE::page_size();
+			return (size + page - 1) / page * page;
+		}
+
+		size_t next_chunk_size(size_t requested_size) const noexcept
+		{
+			size_t size = INITIAL_CHUNK_SIZE;
+			for (size_t i = 0; i < _num_chunks && size <= std::numeric_limits<size_t>::max() / GROWTH_FACTOR; ++i)
+				size *= GROWTH_FACTOR;
+
+			// the split in allocate() needs room for a trailing header as well
+			const size_t needed = CHUNK_HEADER_SIZE + requested_size + 2 * ALIGNED_HEADER_SIZE + ALIGNMENT;
+			return round_to_page(std::max(size, needed));
+		}
+
+		chunk *add_chunk(size_t requested_size)
+		{
+			if (_num_chunks == MAX_CHUNKS)
+				return nullptr;
+
+			const size_t size = next_chunk_size(requested_size);
+			void *memory = CHUNK_SOURCE::acquire(size);
+			if (memory == nullptr)
+				return nullptr;
+
+			size_t pos = 0;
+			while (pos < _num_chunks && _chunks[pos].memory < memory)
+				++pos;
+
+			for (size_t i = _num_chunks; i > pos; --i)
+				_chunks[i] = _chunks[i - 1];
+
+			chunk &c = _chunks[pos];
+			c.memory = memory;
+			c.size = size;
+			c.pool = new (memory) chunk_pool_t();
+			c.pool->init(static_cast<uint8_t*>(memory) + CHUNK_HEADER_SIZE, size - CHUNK_HEADER_SIZE);
+			++_num_chunks;
+			return &c;
+		}
+
+		void remove_chunk(size_t index)
+		{
+			_chunks[index].pool->~chunk_pool_t();
+			CHUNK_SOURCE::release(_chunks[index].memory, _chunks[index].size);
+			for (size_t i = index; i + 1 < _num_chunks; ++i)
+				_chunks[i] = _chunks[i + 1];
+			--_num_chunks;
+			_last_used = 0;
+		}
+
+		chunk *find_chunk(uintptr_t addr) noexcept
+		{
+			size_t lo = 0;
+			size_t hi = _num_chunks;
+			while (lo < hi)
+			{
+				const size_t mid = (lo + hi) / 2;
+				const chunk &c = _chunks[mid];
+				if (addr < c.pool->buffer_start())
+					hi = mid;
+				else if (addr >= c.pool->buffer_end())
+					lo = mid + 1;
+				else
+					return &_chunks[mid];
+			}
+			return nullptr;
+		}
+
+		// counts what the chunk pool counts, which is the size rounded to
+		// ALIGNMENT, so allocated() and deallocated() balance
+		void *allocate_from(chunk &c, size_t requested_size)
+		{
+			const size_t before = c.pool->allocated();
+			void *result = c.pool->allocate(requested_size);
+			_allocated += c.pool->allocated() - before;
+			return result;
+		}
+
+		void on_chunk_empty(size_t index)
+		{
+			// keep one empty chunk as a spare, release the smaller of two
+			for (size_t i = 0; i < _num_chunks; ++i)
+			{
+				if (i != index && _chunks[i].in_use() == 0)
+				{
+					remove_chunk(_chunks[i].size < _chunks[index].size ? i : index);
+					return;
+				}
+			}
+		}
+
+	public:
+
+		growable_memory_pool() = default;
+		growable_memory_pool(const growable_memory_pool&) = delete;
+		growable_memory_pool &operator=(const growable_memory_pool&) = delete;
+
+		~growable_memory_pool()
+		{
+			release();
+		}
+
+		static growable_memory_pool &get_instance() noexcept
+		{
+			static growable_memory_pool instance;
+			return instance;
+		}
+
+		// returns every chunk upstream, outstanding pointers become invalid
+		void release()
+		{
+			while (_num_chunks > 0)
+				remove_chunk(_num_chunks - 1);
+			_allocated = 0;
+			_deallocated = 0;
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept
+		{
+			return const_cast<growable_memory_pool*>(this)->find_chunk(addr) != nullptr;
+		}
+
+		void *allocate(size_t requested_size, bool throw_exception = false)
+		{
+			if (requested_size == 0)
+				return nullptr;
+
+			void *result = nullptr;
+
+			if (_last_used < _num_chunks && _chunks[_last_used].pool->capacity() > requested_size)
+				result = allocate_from(_chunks[_last_used], requested_size);
+
+			for (size_t i = _num_chunks; result == nullptr && i-- > 0; )
+			{
+				if (i == _last_used || _chunks[i].pool->capacity() <= requested_size)
+					continue;
+
+				result = allocate_from(_chunks[i], requested_size);
+				if (result != nullptr)
+					_last_used = i;
+			}
+
+			if (result == nullptr)
+			{
+				chunk *c = add_chunk(requested_size);
+				if (c != nullptr)
+				{
+					result = allocate_from(*c, requested_size);
+					_last_used = static_cast<size_t>(c - _chunks.data());
+				}
+			}
+
+			if (result == nullptr && throw_exception)
+				throw std::bad_alloc();
+
+			return result;
+		}
+
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			chunk *c = find_chunk(reinterpret_cast<uintptr_t>(p));
+			if (c == nullptr)
+			{
+				static constexpr const char* msg = "Tried to deallocate pointer outside of pool chunks";
+				if (throw_exception)
+					throw std::runtime_error(msg);
+				else
+				{
+					std::cerr << msg << std::endl;
+					return;
+				}
+			}
+
+			const size_t before = c->pool->deallocated();
+			c->pool->deallocate(p, throw_exception);
+			_deallocated += c->pool->deallocated() - before;
+
+			if (c->in_use() == 0)
+				on_chunk_empty(static_cast<size_t>(c - _chunks.data()));
+		}
+
+		const size_t allocated() const noexcept { return _allocated; }
+		const size_t deallocated() const noexcept { return _deallocated; }
+		const size_t num_chunks() const noexcept { return _num_chunks; }
+
+		// bytes currently obtained from CHUNK_SOURCE
+		const size_t capacity() const noexcept
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < _num_chunks; ++i)
+				total += _chunks[i].size;
+			return total;
+		}
+	};
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "basic_memory_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+namespace ss
+{
+	// One block of the block list. offset is where the block header starts,
+	// relative to the pool buffer, size is the payload after the header.
+	// deferred blocks are freed but kept by FIT, see quick_fit; they count
+	// as not allocated.
+	struct heap_block
+	{
+		uint64_t offset;
+		uint64_t size;
+		bool allocated;
+		bool deferred;
+	};
+
+	// Consecutive blocks summarized as one entry, see heap_run_builder.
+	struct heap_run
+	{
+		uint64_t offset = 0;
+		// headers included, so the runs tile the walked part of the pool
+		uint64_t bytes = 0;
+		bool allocated = false;
+		uint64_t used_blocks = 0;
+		uint64_t used_bytes = 0;
+		uint64_t free_blocks = 0;
+		uint64_t free_bytes = 0;
+		uint64_t largest_free = 0;
+		// of the free blocks
+		uint64_t deferred_blocks = 0;
+	};
+
+	// Calls f(heap_block) for every block in address order. Like stats() this
+	// must not race with allocate()/deallocate().
+	template<size_t ALIGNMENT, typename STATS, typename FIT, typename ON_ERROR, typename FUNCTION>
+	void for_each_block(const basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR> &pool, FUNCTION f)
+	{
+		using header_t = typename basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR>::free_block_header;
+
+		std::vector<const header_t*> deferred;
+		pool.fit().template for_each_deferred<header_t>([&](const header_t *block) { deferred.push_back(block); });
+		std::sort(deferred.begin(), deferred.end());
+
+		for (const header_t *it = pool.free_list(); it != nullptr; it = it->get_next())
+		{
+			const bool is_deferred = it->is_allocated() && std::binary_search(deferred.begin(), deferred.end(), it);
+			f(heap_block{ reinterpret_cast<uintptr_t>(it) - pool.buffer_start(), it->get_size(),
+				it->is_allocated() && false == is_deferred, is_deferred });
+		}
+	}
+
+
+	// Folds blocks into runs of the same state. A free block smaller than
+	// min_free_bytes does not end the allocated run around it but is counted
+	// inside it, so the number of runs stays below capacity / min_free_bytes
+	// however fragmented the pool is. With 0 only neighbours of equal state
+	// are merged.
+	class heap_run_builder
+	{
+		uint64_t _min_free_bytes;
+		uint64_t _header_size;
+		heap_run _run;
+		bool _open = false;
+
+		template<typename FUNCTION>
+		void start(const heap_block &block, bool allocated, FUNCTION &emit)
+		{
+			if (_open)
+				emit(_run);
+			_run = heap_run();
+			_run.offset = block.offset;
+			_run.allocated = allocated;
+			_open = true;
+		}
+
+	public:
+		heap_run_builder(uint64_t header_size, uint64_t min_free_bytes = 0)
+			: _min_free_bytes(min_free_bytes), _header_size(header_size)
+		{
+		}
+
+		// emit(const heap_run&) is called for every run that is complete
+		template<typename FUNCTION>
+		void add(const heap_block &block, FUNCTION emit)
+		{
+			const bool absorbed = false == block.allocated && block.size < _min_free_bytes;
+			const bool allocated = block.allocated || (absorbed && _open && _run.allocated);
+
+			if (false == _open || allocated != _run.allocated)
+				start(block, allocated, emit);
+
+			_run.bytes += block.size + _header_size;
+			if (block.allocated)
+			{
+				++_run.used_blocks;
+				_run.used_bytes += block.size;
+			}
+			else
+			{
+				++_run.free_blocks;
+				_run.free_bytes += block.size;
+				_run.largest_free = std::max(_run.largest_free, block.size);
+				if (block.deferred)
+					++_run.deferred_blocks;
+			}
+		}
+
+		template<typename FUNCTION>
+		void finish(FUNCTION emit)
+		{
+			if (_open)
+				emit(_run);
+			_open = false;
+		}
+	};
+
+
+	// Cell of the heat map, a fixed slice of the pool.
+	struct heap_cell
+	{
+		uint64_t used_bytes = 0;
+		uint64_t free_bytes = 0;
+		// of free_bytes, in blocks FIT keeps
+		uint64_t deferred_bytes = 0;
+		// free blocks starting inside the cell
+		uint64_t free_blocks = 0;
+		uint64_t blocks = 0;
+	};
+
+	// Splits the pool into cells equal slices and sums up what lies in each.
+	// Headers count as used.
+	template<size_t ALIGNMENT, typename STATS, typename FIT, typename ON_ERROR>
+	std::vector<heap_cell> heap_cells(const basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR> &pool, size_t cells)
+	{
+		using pool_t = basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR>;
+		cells = std::max<size_t>(1, std::min(cells, pool.capacity()));
+		const uint64_t cell_size = (pool.capacity() + cells - 1) / cells;
+		std::vector<heap_cell> result(cells);
+
+		auto add = [&](uint64_t begin, uint64_t end, uint64_t heap_cell::*bytes)
+		{
+			end = std::min<uint64_t>(end, pool.capacity());
+			while (begin < end)
+			{
+				const size_t index = static_cast<size_t>(begin / cell_size);
+				const uint64_t cell_end = std::min<uint64_t>(end, (index + 1) * cell_size);
+				result[index].*bytes += cell_end - begin;
+				begin = cell_end;
+			}
+		};
+
+		for_each_block(pool, [&](const heap_block &block)
+		{
+			heap_cell &first = result[std::min<size_t>(cells - 1, static_cast<size_t>(block.offset / cell_size))];
+			++first.blocks;
+			if (false == block.allocated)
+				++first.free_blocks;
+
+			const uint64_t payload = block.offset + pool_t::ALIGNED_HEADER_SIZE;
+			add(block.offset, payload, &heap_cell::used_bytes);
+			add(payload, payload + block.size, block.allocated ? &heap_cell::used_bytes : &heap_cell::free_bytes);
+			if (block.deferred)
+				add(payload, payload + block.size, &heap_cell::deferred_bytes);
+		});
+
+		return result;
+	}
+
+
+	namespace detail
+	{
+		inline void write_stats_json(std::ostream &out, const pool_stats &s)
+		{
+			out << "\"stats\":{\"bytes_in_use\":" << s.bytes_in_use
+				<< ",\"live_blocks\":" << s.live_blocks
+				<< ",\"free_bytes\":" << s.free_bytes
+				<< ",\"free_blocks\":" << s.free_blocks
+				<< ",\"largest_free_block\":" << s.largest_free_block
+				<< ",\"fragmentation\":" << s.fragmentation << "}";
+		}
+
+		inline const char *block_state(const heap_block &block) noexcept
+		{
+			return block.deferred ? "deferred" : block.allocated ? "used" : "free";
+		}
+	}
+
+	// Writes the block map as JSON:
+	//   {"capacity":..,"header_size":..,"stats":{..},"blocks":[{"offset":..,"size":..,"state":"used"|"free"|"deferred"},..]}
+	// For large pools see write_heap_runs_json().
+	template<size_t ALIGNMENT, typename STATS, typename FIT, typename ON_ERROR>
+	void write_heap_json(std::ostream &out, const basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR> &pool)
+	{
+		using pool_t = basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR>;
+		out << "{\"capacity\":" << pool.capacity() << ",\"header_size\":" << pool_t::ALIGNED_HEADER_SIZE << ",";
+		detail::write_stats_json(out, pool.stats());
+		out << ",\"blocks\":[";
+
+		bool first = true;
+		for_each_block(pool, [&](const heap_block &block)
+		{
+			out << (first ? "" : ",") << "\n{\"offset\":" << block.offset << ",\"size\":" << block.size
+				<< ",\"state\":\"" << detail::block_state(block) << "\"}";
+			first = false;
+		});
+		out << "]}\n";
+	}
+
+	// Writes the block map aggregated by heap_run_builder as JSON:
+	//   {.., "min_free_bytes":..,"runs":[{"offset":..,"bytes":..,"state":..,"used_blocks":..,
+	//     "used_bytes":..,"free_blocks":..,"free_bytes":..,"largest_free":..,"deferred_blocks":..},..]}
+	template<size_t ALIGNMENT, typename STATS, typename FIT, typename ON_ERROR>
+	void write_heap_runs_json(std::ostream &out, const basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR> &pool, uint64_t min_free_bytes = 0)
+	{
+		using pool_t = basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR>;
+		out << "{\"capacity\":" << pool.capacity() << ",\"header_size\":" << pool_t::ALIGNED_HEADER_SIZE
+			<< ",\"min_free_bytes\":" << min_free_bytes << ",";
+		detail::write_stats_json(out, pool.stats());
+		out << ",\"runs\":[";
+
+		bool first = true;
+		auto emit = [&](const heap_run &run)
+		{
+			out << (first ? "" : ",") << "\n{\"offset\":" << run.offset << ",\"bytes\":" << run.bytes
+				<< ",\"state\":\"" << (run.allocated ? "used" : "free") << "\""
+				<< ",\"used_blocks\":" << run.used_blocks << ",\"used_bytes\":" << run.used_bytes
+				<< ",\"free_blocks\":" << run.free_blocks << ",\"free_bytes\":" << run.free_bytes
+				<< ",\"largest_free\":" << run.largest_free << ",\"deferred_blocks\":" << run.deferred_blocks << "}";
+			first = false;
+		};
+
+		heap_run_builder builder(pool_t::ALIGNED_HEADER_SIZE, min_free_bytes);
+		for_each_block(pool, [&](const heap_block &block) { builder.add(block, emit); });
+		builder.finish(emit);
+		out << "]}\n";
+	}
+
+	// Renders heap_cells() as an SVG grid, columns cells per row in address
+	// order. The fill goes from white (free) to dark red (used); a cell where
+	// free memory is split over several blocks is drawn orange, brighter the
+	// more pieces, which is where fragmentation lives. A cell holding blocks
+	// FIT deferred is drawn blue instead. Hovering shows the numbers.
+	template<size_t ALIGNMENT, typename STATS, typename FIT, typename ON_ERROR>
+	void write_heap_svg(std::ostream &out, const basic_memory_pool<ALIGNMENT, STATS, FIT, ON_ERROR> &pool,
+		size_t cells = 1024, size_t columns = 64, size_t cell_pixels = 12)
+	{
+		const std::vector<heap_cell> map = heap_cells(pool, cells);
+		const pool_stats s = pool.stats();
+		columns = std::max<size_t>(1, std::min(columns, map.size()));
+		const size_t rows = (map.size() + columns - 1) / columns;
+		const uint64_t cell_size = (pool.capacity() + map.size() - 1) / map.size();
+		const size_t legend = 20;
+
+		out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << columns * cell_pixels
+			<< "\" height=\"" << rows * cell_pixels + legend << "\">\n";
+
+		char text[160];
+		std::snprintf(text, sizeof(text), "%zu bytes, %zu per cell, %zu used, %zu free in %zu blocks, fragmentation %.3f",
+			pool.capacity(), static_cast<size_t>(cell_size), s.bytes_in_use, s.free_bytes, s.free_blocks, s.fragmentation);
+		out << "<text x=\"2\" y=\"14\" font-family=\"monospace\" font-size=\"11\">" << text << "</text>\n";
+
+		for (size_t i = 0; i < map.size(); ++i)
+		{
+			const heap_cell &c = map[i];
+			const uint64_t total = c.used_bytes + c.free_bytes;
+			const double used = total == 0 ? 0.0 : double(c.used_bytes) / double(total);
+
+			int r, g, b;
+			if (c.deferred_bytes > 0)
+			{
+				const double held = double(c.deferred_bytes) / double(total);
+				r = g = static_cast<int>(200 - 140 * held);
+				b = 255;
+			}
+			else if (c.free_blocks > 1)
+			{
+				const double pieces = std::min(1.0, double(c.free_blocks) / 16.0);
+				r = 255;
+				g = static_cast<int>(200 - 110 * pieces);
+				b = 0;
+			}
+			else
+			{
+				r = static_cast<int>(255 - 115 * used);
+				g = b = static_cast<int>(255 * (1.0 - used));
+			}
+
+			out << "<rect x=\"" << (i % columns) * cell_pixels << "\" y=\"" << legend + (i / columns) * cell_pixels
+				<< "\" width=\"" << cell_pixels << "\" height=\"" << cell_pixels
+				<< "\" fill=\"rgb(" << r << "," << g << "," << b << ")\"><title>" << i * cell_size
+				<< ": " << c.used_bytes << " used, " << c.free_bytes << " free, " << c.deferred_bytes << " deferred, "
+				<< c.free_blocks << " free blocks</title></rect>\n";
+		}
+		out << "</svg>\n";
+	}
+}
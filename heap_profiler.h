@@ -0,0 +1,356 @@
+#pragma once
+
+#include "pool_stats.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+namespace ss
+{
+	// Allocation site profile of sampled blocks, raw sample counts. pprof scales
+	// them back up using the sample interval, see heap_profiler::write_pprof().
+	struct heap_profile_entry
+	{
+		std::vector<void*> stack;
+		uint64_t live_count = 0;
+		uint64_t live_bytes = 0;
+		uint64_t total_count = 0;
+		uint64_t total_bytes = 0;
+	};
+
+
+	// Process wide sampling heap profiler. Sampling is a Poisson process over
+	// allocated bytes: each thread draws an exponentially distributed distance
+	// with mean sample_interval and the allocation crossing it is sampled, so
+	// a block of size s is picked with probability 1 - exp(-s / interval)
+	// whatever the allocation pattern. A sample stores the call stack and is
+	// kept in a side table keyed by pointer until the block is freed.
+	//
+	// Unsampled allocations cost a thread local subtraction, unsampled frees a
+	// load from a small counting filter; only sampled blocks take the lock.
+	class heap_profiler
+	{
+		static constexpr size_t MAX_FRAMES = 64;
+		static constexpr size_t FILTER_BITS = 12;
+
+		struct stack_trace
+		{
+			std::array<void*, MAX_FRAMES> frames;
+			size_t depth;
+		};
+
+		struct stack_entry
+		{
+			stack_trace trace;
+			uint64_t live_count = 0;
+			uint64_t live_bytes = 0;
+			uint64_t total_count = 0;
+			uint64_t total_bytes = 0;
+		};
+
+		struct live_sample
+		{
+			uint32_t stack;
+			uint64_t size;
+		};
+
+		std::atomic<size_t> _interval{ 0 };
+
+		mutable std::mutex _mutex;
+		std::vector<stack_entry> _stacks;
+		std::unordered_multimap<uint64_t, uint32_t> _stack_index;
+		std::unordered_map<uintptr_t, live_sample> _live;
+
+		// live samples per pointer hash, a free only looks up _live when its slot is non zero
+		std::array<std::atomic<uint32_t>, size_t(1) << FILTER_BITS> _filter{};
+
+		struct thread_state
+		{
+			int64_t until_sample = -1;
+			bool reentered = false;
+			std::minstd_rand rng{ static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) };
+		};
+
+		static thread_state &local() noexcept
+		{
+			thread_local thread_state state;
+			return state;
+		}
+
+		// set while the profiler itself allocates, so a pool behind the global
+		// operator new doesn't sample the side tables
+		class reentry_guard
+		{
+			bool _previous;
+
+		public:
+			reentry_guard() noexcept : _previous(local().reentered) { local().reentered = true; }
+			~reentry_guard() { local().reentered = _previous; }
+		};
+
+		static size_t filter_slot(const void *p) noexcept
+		{
+			return static_cast<size_t>((reinterpret_cast<uintptr_t>(p) * 0x9e3779b97f4a7c15ull) >> (64 - FILTER_BITS));
+		}
+
+		static uint64_t hash_of(const stack_trace &trace) noexcept
+		{
+			uint64_t h = 0xcbf29ce484222325ull;
+			for (size_t i = 0; i < trace.depth; ++i)
+				h = (h ^ reinterpret_cast<uintptr_t>(trace.frames[i])) * 0x100000001b3ull;
+			return h;
+		}
+
+		static int64_t next_distance(thread_state &state, size_t interval) noexcept
+		{
+			// exponential with mean interval, never 0 so every byte has a chance
+			std::uniform_real_distribution<double> uniform(0.0, 1.0);
+			const double u = std::max(uniform(state.rng), 1e-12);
+			return static_cast<int64_t>(-std::log(u) * double(interval)) + 1;
+		}
+
+		static size_t capture(stack_trace &trace) noexcept
+		{
+#if defined(__linux__) || defined(__APPLE__)
+			const int depth = ::backtrace(trace.frames.data(), static_cast<int>(MAX_FRAMES));
+			return depth > 0 ? static_cast<size_t>(depth) : 0;
+#else
+			return 0;
+#endif
+		}
+
+		void record(const void *p, size_t size)
+		{
+			stack_trace trace;
+			trace.depth = capture(trace);
+			const uint64_t hash = hash_of(trace);
+
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			uint32_t index = UINT32_MAX;
+			auto range = _stack_index.equal_range(hash);
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				const stack_trace &known = _stacks[it->second].trace;
+				if (known.depth == trace.depth && std::equal(known.frames.begin(), known.frames.begin() + known.depth, trace.frames.begin()))
+				{
+					index = it->second;
+					break;
+				}
+			}
+
+			if (index == UINT32_MAX)
+			{
+				index = static_cast<uint32_t>(_stacks.size());
+				_stacks.emplace_back();
+				_stacks.back().trace = trace;
+				_stack_index.emplace(hash, index);
+			}
+
+			stack_entry &entry = _stacks[index];
+			++entry.live_count;
+			entry.live_bytes += size;
+			++entry.total_count;
+			entry.total_bytes += size;
+
+			_live[reinterpret_cast<uintptr_t>(p)] = { index, size };
+			_filter[filter_slot(p)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void forget(const void *p)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _live.find(reinterpret_cast<uintptr_t>(p));
+			if (it == _live.end())
+				return;
+
+			stack_entry &entry = _stacks[it->second.stack];
+			--entry.live_count;
+			entry.live_bytes -= it->second.size;
+			_live.erase(it);
+			_filter[filter_slot(p)].fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		heap_profiler()
+		{
+			// backtrace() allocates the first time it runs, get that out of the way
+			stack_trace warm_up;
+			capture(warm_up);
+		}
+
+	public:
+		static constexpr size_t DEFAULT_INTERVAL = 512 * 1024;
+
+		static heap_profiler &get_instance() noexcept
+		{
+			static heap_profiler instance;
+			return instance;
+		}
+
+		// Starts sampling one allocation every interval bytes on average.
+		void start(size_t interval = DEFAULT_INTERVAL) noexcept
+		{
+			_interval.store(std::max<size_t>(1, interval), std::memory_order_relaxed);
+		}
+
+		// Stops taking new samples, frees of sampled blocks are still tracked.
+		void stop() noexcept
+		{
+			_interval.store(0, std::memory_order_relaxed);
+		}
+
+		size_t sample_interval() const noexcept
+		{
+			return _interval.load(std::memory_order_relaxed);
+		}
+
+		// Drops every sample and stack.
+		void clear()
+		{
+			reentry_guard guard;
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stacks.clear();
+			_stack_index.clear();
+			_live.clear();
+			for (auto &slot : _filter)
+				slot.store(0, std::memory_order_relaxed);
+		}
+
+		void on_allocate(const void *p, size_t size) noexcept
+		{
+			const size_t interval = sample_interval();
+			if (interval == 0)
+				return;
+
+			thread_state &state = local();
+			if (state.reentered)
+				return;
+
+			if (state.until_sample < 0)
+				state.until_sample = next_distance(state, interval);
+
+			state.until_sample -= static_cast<int64_t>(size);
+			if (state.until_sample > 0)
+				return;
+
+			reentry_guard guard;
+			try
+			{
+				record(p, size);
+			}
+			catch (...)
+			{
+			}
+			state.until_sample = next_distance(state, interval);
+		}
+
+		void on_deallocate(const void *p, size_t) noexcept
+		{
+			if (_filter[filter_slot(p)].load(std::memory_order_relaxed) == 0)
+				return;
+
+			if (local().reentered)
+				return;
+
+			reentry_guard guard;
+			forget(p);
+		}
+
+		size_t live_samples() const
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _live.size();
+		}
+
+		// One entry per distinct stack seen since the last clear().
+		std::vector<heap_profile_entry> profile() const
+		{
+			reentry_guard guard;
+			std::lock_guard<std::mutex> lock(_mutex);
+			std::vector<heap_profile_entry> result;
+			result.reserve(_stacks.size());
+			for (const stack_entry &s : _stacks)
+			{
+				heap_profile_entry e;
+				e.stack.assign(s.trace.frames.begin(), s.trace.frames.begin() + s.trace.depth);
+				e.live_count = s.live_count;
+				e.live_bytes = s.live_bytes;
+				e.total_count = s.total_count;
+				e.total_bytes = s.total_bytes;
+				result.push_back(std::move(e));
+			}
+			return result;
+		}
+
+		// Writes the profile in the heap_v2 text format pprof reads, carrying
+		// both the live heap and the cumulative allocations:
+		//   go tool pprof -sample_index=inuse_space <binary> <file>
+		//   go tool pprof -sample_index=alloc_space <binary> <file>
+		void write_pprof(std::ostream &out) const
+		{
+			reentry_guard guard;
+			const std::vector<heap_profile_entry> entries = profile();
+
+			heap_profile_entry total;
+			for (const heap_profile_entry &e : entries)
+			{
+				total.live_count += e.live_count;
+				total.live_bytes += e.live_bytes;
+				total.total_count += e.total_count;
+				total.total_bytes += e.total_bytes;
+			}
+
+			const size_t interval = std::max<size_t>(1, sample_interval() == 0 ? DEFAULT_INTERVAL : sample_interval());
+			out << "heap profile: " << total.live_count << ": " << total.live_bytes << " [" << total.total_count
+				<< ": " << total.total_bytes << "] @ heap_v2/" << interval << "\n";
+
+			for (const heap_profile_entry &e : entries)
+			{
+				out << e.live_count << ": " << e.live_bytes << " [" << e.total_count << ": " << e.total_bytes << "] @";
+				for (void *frame : e.stack)
+					out << " 0x" << std::hex << reinterpret_cast<uintptr_t>(frame) << std::dec;
+				out << "\n";
+			}
+
+			// lets pprof symbolize against the binary and shared objects
+			out << "\nMAPPED_LIBRARIES:\n";
+			std::ifstream maps("/proc/self/maps");
+			if (maps)
+				out << maps.rdbuf();
+		}
+	};
+
+
+	// Stats policy that reports every allocate and deallocate to the
+	// heap_profiler, then to STATS.
+	template<typename STATS = null_stats>
+	struct profiled_stats : STATS
+	{
+		static constexpr bool enabled = true;
+
+		void on_allocate(const void *p, size_t size, size_t block_size, size_t probes) noexcept
+		{
+			heap_profiler::get_instance().on_allocate(p, size);
+			STATS::on_allocate(p, size, block_size, probes);
+		}
+
+		void on_deallocate(const void *p, size_t size) noexcept
+		{
+			heap_profiler::get_instance().on_deallocate(p, size);
+			STATS::on_deallocate(p, size);
+		}
+	};
+}
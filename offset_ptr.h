@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <assert.h>
+
+namespace ss
+{
+	namespace detail
+	{
+		template<typename T>
+		struct pointee_reference
+		{
+			using type = T&;
+		};
+
+		template<>
+		struct pointee_reference<void> { using type = void; };
+
+		template<>
+		struct pointee_reference<const void> { using type = void; };
+	}
+
+	// Pointer that stores the distance from itself to the pointee, 0 meaning
+	// null. Memory holding offset_ptrs that only point into that same memory
+	// can be mapped at any address, which is what shared, file backed and
+	// snapshotted pools rely on. Copying recomputes the distance, so an
+	// offset_ptr may live on the stack as well.
+	template<typename T>
+	class offset_ptr
+	{
+		template<typename U> friend class offset_ptr;
+
+		std::ptrdiff_t _offset = 0;
+
+		void assign(const volatile void *p) noexcept
+		{
+			_offset = p == nullptr ? 0 :
+				reinterpret_cast<intptr_t>(p) - reinterpret_cast<intptr_t>(this);
+		}
+
+	public:
+		using element_type = T;
+		using pointer = T*;
+		using reference = typename detail::pointee_reference<T>::type;
+		using value_type = typename std::remove_cv<T>::type;
+		using difference_type = std::ptrdiff_t;
+		using iterator_category = std::random_access_iterator_tag;
+
+		template<typename U>
+		using rebind = offset_ptr<U>;
+
+		offset_ptr() noexcept = default;
+		offset_ptr(std::nullptr_t) noexcept {}
+		offset_ptr(T *p) noexcept { assign(p); }
+		offset_ptr(const offset_ptr &other) noexcept { assign(other.get()); }
+
+		template<typename U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+		offset_ptr(const offset_ptr<U> &other) noexcept { assign(static_cast<T*>(other.get())); }
+
+		template<typename U, typename std::enable_if<!std::is_convertible<U*, T*>::value, int>::type = 0>
+		explicit offset_ptr(const offset_ptr<U> &other) noexcept { assign(static_cast<T*>(other.get())); }
+
+		offset_ptr &operator=(const offset_ptr &other) noexcept { assign(other.get()); return *this; }
+		offset_ptr &operator=(T *p) noexcept { assign(p); return *this; }
+		offset_ptr &operator=(std::nullptr_t) noexcept { _offset = 0; return *this; }
+
+		static offset_ptr pointer_to(reference r) noexcept { return offset_ptr(std::addressof(r)); }
+
+		T *get() const noexcept
+		{
+			return _offset == 0 ? nullptr : reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + _offset);
+		}
+
+		reference operator*() const noexcept { return *get(); }
+		T *operator->() const noexcept { return get(); }
+		reference operator[](difference_type i) const noexcept { return get()[i]; }
+		explicit operator bool() const noexcept { return _offset != 0; }
+
+		offset_ptr &operator+=(difference_type n) noexcept { assign(get() + n); return *this; }
+		offset_ptr &operator-=(difference_type n) noexcept { assign(get() - n); return *this; }
+		offset_ptr &operator++() noexcept { return *this += 1; }
+		offset_ptr &operator--() noexcept { return *this -= 1; }
+		offset_ptr operator++(int) noexcept { offset_ptr old(*this); ++*this; return old; }
+		offset_ptr operator--(int) noexcept { offset_ptr old(*this); --*this; return old; }
+
+		friend offset_ptr operator+(const offset_ptr &p, difference_type n) noexcept { return offset_ptr(p.get() + n); }
+		friend offset_ptr operator+(difference_type n, const offset_ptr &p) noexcept { return offset_ptr(p.get() + n); }
+		friend offset_ptr operator-(const offset_ptr &p, difference_type n) noexcept { return offset_ptr(p.get() - n); }
+		friend difference_type operator-(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() - b.get(); }
+
+		friend bool operator==(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() == b.get(); }
+		friend bool operator!=(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() != b.get(); }
+		friend bool operator<(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() < b.get(); }
+		friend bool operator>(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() > b.get(); }
+		friend bool operator<=(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() <= b.get(); }
+		friend bool operator>=(const offset_ptr &a, const offset_ptr &b) noexcept { return a.get() >= b.get(); }
+		friend bool operator==(const offset_ptr &a, std::nullptr_t) noexcept { return !a; }
+		friend bool operator!=(const offset_ptr &a, std::nullptr_t) noexcept { return !!a; }
+		friend bool operator==(std::nullptr_t, const offset_ptr &a) noexcept { return !a; }
+		friend bool operator!=(std::nullptr_t, const offset_ptr &a) noexcept { return !!a; }
+	};
+
+
+	// 32 bit pointer into the singleton pool POOL, stored as the distance from
+	// the pool's buffer start. Offset 0 is always the first block header, so it
+	// doubles as null. Resolving costs one add against POOL::get_instance().
+	template<typename T, typename POOL>
+	class pool_ptr
+	{
+		template<typename U, typename P> friend class pool_ptr;
+
+		uint32_t _offset = 0;
+
+		static uintptr_t base() noexcept
+		{
+			return POOL::get_instance().buffer_start();
+		}
+
+		void assign(const volatile void *p) noexcept
+		{
+			if (p == nullptr)
+			{
+				_offset = 0;
+				return;
+			}
+
+			const uintptr_t offset = reinterpret_cast<uintptr_t>(p) - base();
+			assert(offset > 0 && offset <= std::numeric_limits<uint32_t>::max());
+			_offset = static_cast<uint32_t>(offset);
+		}
+
+	public:
+		using element_type = T;
+		using pointer = T*;
+		using reference = typename detail::pointee_reference<T>::type;
+		using value_type = typename std::remove_cv<T>::type;
+		using difference_type = std::ptrdiff_t;
+		using iterator_category = std::random_access_iterator_tag;
+
+		template<typename U>
+		using rebind = pool_ptr<U, POOL>;
+
+		pool_ptr() noexcept = default;
+		pool_ptr(std::nullptr_t) noexcept {}
+		pool_ptr(T *p) noexcept { assign(p); }
+
+		template<typename U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+		pool_ptr(const pool_ptr<U, POOL> &other) noexcept { assign(static_cast<T*>(other.get())); }
+
+		template<typename U, typename std::enable_if<!std::is_convertible<U*, T*>::value, int>::type = 0>
+		explicit pool_ptr(const pool_ptr<U, POOL> &other) noexcept { assign(static_cast<T*>(other.get())); }
+
+		pool_ptr &operator=(T *p) noexcept { assign(p); return *this; }
+		pool_ptr &operator=(std::nullptr_t) noexcept { _offset = 0; return *this; }
+
+		static pool_ptr pointer_to(reference r) noexcept { return pool_ptr(std::addressof(r)); }
+
+		T *get() const noexcept
+		{
+			return _offset == 0 ? nullptr : reinterpret_cast<T*>(base() + _offset);
+		}
+
+		uint32_t offset() const noexcept { return _offset; }
+
+		reference operator*() const noexcept { return *get(); }
+		T *operator->() const noexcept { return get(); }
+		reference operator[](difference_type i) const noexcept { return get()[i]; }
+		explicit operator bool() const noexcept { return _offset != 0; }
+
+		pool_ptr &operator+=(difference_type n) noexcept { assign(get() + n); return *this; }
+		pool_ptr &operator-=(difference_type n) noexcept { assign(get() - n); return *this; }
+		pool_ptr &operator++() noexcept { return *this += 1; }
+		pool_ptr &operator--() noexcept { return *this -= 1; }
+		pool_ptr operator++(int) noexcept { pool_ptr old(*this); ++*this; return old; }
+		pool_ptr operator--(int) noexcept { pool_ptr old(*this); --*this; return old; }
+
+		friend pool_ptr operator+(const pool_ptr &p, difference_type n) noexcept { return pool_ptr(p.get() + n); }
+		friend pool_ptr operator+(difference_type n, const pool_ptr &p) noexcept { return pool_ptr(p.get() + n); }
+		friend pool_ptr operator-(const pool_ptr &p, difference_type n) noexcept { return pool_ptr(p.get() - n); }
+		friend difference_type operator-(const pool_ptr &a, const pool_ptr &b) noexcept { return a.get() - b.get(); }
+
+		friend bool operator==(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset == b._offset; }
+		friend bool operator!=(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset != b._offset; }
+		friend bool operator<(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset < b._offset; }
+		friend bool operator>(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset > b._offset; }
+		friend bool operator<=(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset <= b._offset; }
+		friend bool operator>=(const pool_ptr &a, const pool_ptr &b) noexcept { return a._offset >= b._offset; }
+		friend bool operator==(const pool_ptr &a, std::nullptr_t) noexcept { return !a; }
+		friend bool operator!=(const pool_ptr &a, std::nullptr_t) noexcept { return !!a; }
+		friend bool operator==(std::nullptr_t, const pool_ptr &a) noexcept { return !a; }
+		friend bool operator!=(std::nullptr_t, const pool_ptr &a) noexcept { return !!a; }
+	};
+
+
+	// Allocator handing out pool_ptrs into the singleton pool POOL, for
+	// containers of pointer heavy data stored in the pool.
+	template<typename T, typename POOL>
+	struct pool_ptr_allocator
+	{
+		using value_type = T;
+		using pointer = pool_ptr<T, POOL>;
+		using const_pointer = pool_ptr<const T, POOL>;
+		using void_pointer = pool_ptr<void, POOL>;
+		using const_void_pointer = pool_ptr<const void, POOL>;
+		using size_type = std::size_t;
+		using difference_type = std::ptrdiff_t;
+
+		template<typename U>
+		struct rebind { using other = pool_ptr_allocator<U, POOL>; };
+
+		pool_ptr_allocator() noexcept = default;
+
+		template<typename U>
+		pool_ptr_allocator(const pool_ptr_allocator<U, POOL>&) noexcept {}
+
+		pointer allocate(size_type n)
+		{
+			if (n > std::numeric_limits<size_type>::max() / sizeof(T))
+				throw std::bad_alloc();
+
+			void *p = POOL::get_instance().allocate(n * sizeof(T), true);
+			if (p == nullptr)
+				throw std::bad_alloc();
+			return pointer(static_cast<T*>(p));
+		}
+
+		void deallocate(pointer p, size_type) noexcept
+		{
+			POOL::get_instance().deallocate(p.get());
+		}
+
+		template<typename U>
+		bool operator==(const pool_ptr_allocator<U, POOL>&) const noexcept { return true; }
+
+		template<typename U>
+		bool operator!=(const pool_ptr_allocator<U, POOL>&) const noexcept { return false; }
+	};
+}
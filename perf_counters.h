@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ss
+{
+	// Values read from perf_counters, scaled up when the kernel had to
+	// multiplex the counters. A counter that could not be opened reads as
+	// not valid rather than 0.
+	struct perf_sample
+	{
+		static constexpr size_t COUNTERS = 6;
+
+		std::array<uint64_t, COUNTERS> values = {};
+		std::array<bool, COUNTERS> valid = {};
+	};
+
+
+	// Hardware counters of this process through perf_event_open, counting
+	// user space only in the calling thread and every thread it starts after
+	// construction. Counters the kernel or container doesn't allow (no PMU,
+	// perf_event_paranoid, seccomp) are left closed and reported as
+	// unavailable, everything else keeps working.
+	class perf_counters
+	{
+	public:
+		enum counter : size_t
+		{
+			cycles,
+			instructions,
+			l1d_misses,
+			llc_misses,
+			dtlb_misses,
+			branch_misses
+		};
+
+		static constexpr size_t COUNTERS = perf_sample::COUNTERS;
+
+		static const char *name(counter c) noexcept
+		{
+			static const char *const names[COUNTERS] = {
+				"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+			};
+			return names[c];
+		}
+
+	private:
+		std::array<int, COUNTERS> _fds;
+
+#if defined(__linux__)
+		static uint64_t cache_event(uint64_t cache, uint64_t result) noexcept
+		{
+			return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+		}
+
+		static int open_counter(counter c) noexcept
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.disabled = 1;
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			switch (c)
+			{
+			case cycles:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case instructions:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case l1d_misses:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS);
+				break;
+			case llc_misses:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				break;
+			case dtlb_misses:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS);
+				break;
+			case branch_misses:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			}
+
+			const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+			return fd < 0 ? -1 : static_cast<int>(fd);
+		}
+#endif
+
+	public:
+		perf_counters() noexcept
+		{
+			for (size_t i = 0; i < COUNTERS; ++i)
+			{
+#if defined(__linux__)
+				_fds[i] = open_counter(static_cast<counter>(i));
+#else
+				_fds[i] = -1;
+#endif
+			}
+		}
+
+		~perf_counters()
+		{
+#if defined(__linux__)
+			for (int fd : _fds)
+				if (fd >= 0)
+					::close(fd);
+#endif
+		}
+
+		perf_counters(const perf_counters&) = delete;
+		perf_counters &operator=(const perf_counters&) = delete;
+
+		bool available(counter c) const noexcept
+		{
+			return _fds[c] >= 0;
+		}
+
+		bool any_available() const noexcept
+		{
+			for (int fd : _fds)
+				if (fd >= 0)
+					return true;
+			return false;
+		}
+
+		// Zeroes and starts every available counter.
+		void start() noexcept
+		{
+#if defined(__linux__)
+			for (int fd : _fds)
+			{
+				if (fd >= 0)
+				{
+					ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+					ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+#endif
+		}
+
+		void stop() noexcept
+		{
+#if defined(__linux__)
+			for (int fd : _fds)
+				if (fd >= 0)
+					ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+		}
+
+		// Counts since start(), threads started since count once they exit.
+		perf_sample read() const noexcept
+		{
+			perf_sample sample;
+#if defined(__linux__)
+			for (size_t i = 0; i < COUNTERS; ++i)
+			{
+				// value, time enabled, time running
+				uint64_t data[3];
+				if (_fds[i] < 0 || ::read(_fds[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+					continue;
+
+				if (data[2] == 0)
+				{
+					// never scheduled on the PMU, nothing to scale
+					sample.valid[i] = data[0] == 0 && data[1] == 0;
+					continue;
+				}
+
+				sample.values[i] = data[2] < data[1] ?
+					static_cast<uint64_t>(double(data[0]) * double(data[1]) / double(data[2])) : data[0];
+				sample.valid[i] = true;
+			}
+#endif
+			return sample;
+		}
+	};
+}
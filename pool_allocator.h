@@ -0,0 +1,186 @@
+#pragma once
+
+#include "static_memory_pool.h"
+#include "static_object_pool.h"
+#include "size_class_pool.h"
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ss
+{
+	// Typed access to the singleton pools. POOL is any pool type with a static
+	// get_instance(): static_memory_pool, growable_memory_pool,
+	// static_object_pool or size_class_pool. Knowing the pool from the type
+	// keeps deleters and allocators stateless, so a pooled_ptr is as small as
+	// a raw pointer.
+	using default_memory_pool = static_memory_pool<(1 << 20)>;
+
+	// make_pooled<T>() without a pool: static_object_pool<T> for types that
+	// declare using pool_tag = ss::object_pool_tag (or derive from
+	// ss::pooled<T>), default_memory_pool for everything else
+	template<typename T, typename = void>
+	struct default_pool
+	{
+		using type = default_memory_pool;
+	};
+
+	template<typename T>
+	struct default_pool<T, typename std::enable_if<std::is_same<typename T::pool_tag, object_pool_tag>::value>::type>
+	{
+		using type = static_object_pool<T>;
+	};
+
+	template<typename T>
+	using default_pool_t = typename default_pool<T>::type;
+
+	namespace detail
+	{
+		// Pools with size classes (size_class_pool) are told the size on
+		// deallocate and resolve a compile time size to its class up front.
+		template<typename POOL, typename = void>
+		struct is_sized_pool : std::false_type {};
+
+		template<typename POOL>
+		struct is_sized_pool<POOL, typename std::enable_if<sizeof(typename POOL::size_classes) != 0>::type> : std::true_type {};
+
+		template<size_t SIZE, typename POOL>
+		void *allocate_fixed(POOL &pool, std::false_type)
+		{
+			return pool.allocate(SIZE);
+		}
+
+		template<size_t SIZE, typename POOL>
+		void *allocate_fixed(POOL &pool, std::true_type)
+		{
+			return pool.template allocate<SIZE>();
+		}
+
+		template<size_t SIZE, typename POOL>
+		void deallocate_fixed(POOL &pool, void *p, std::false_type) noexcept
+		{
+			pool.deallocate(p);
+		}
+
+		template<size_t SIZE, typename POOL>
+		void deallocate_fixed(POOL &pool, void *p, std::true_type) noexcept
+		{
+			pool.template deallocate<SIZE>(p);
+		}
+
+		template<typename POOL>
+		void deallocate_sized(POOL &pool, void *p, size_t, std::false_type) noexcept
+		{
+			pool.deallocate(p);
+		}
+
+		template<typename POOL>
+		void deallocate_sized(POOL &pool, void *p, size_t size, std::true_type) noexcept
+		{
+			pool.deallocate(p, size);
+		}
+	}
+
+
+	// Destroys the object and hands its block back to POOL.
+	template<typename POOL = default_memory_pool>
+	struct pool_deleter
+	{
+		template<typename T>
+		void operator()(T *p) const noexcept
+		{
+			// a sized pool must see the size the object was allocated with
+			static_assert(false == detail::is_sized_pool<POOL>::value || false == std::is_polymorphic<T>::value || std::is_final<T>::value,
+				"a pool with size classes cannot delete through a base class");
+
+			p->~T();
+			detail::deallocate_fixed<sizeof(T)>(POOL::get_instance(), const_cast<void*>(static_cast<const volatile void*>(p)),
+				detail::is_sized_pool<POOL>());
+		}
+	};
+
+	template<typename T, typename POOL = default_memory_pool>
+	using pooled_ptr = std::unique_ptr<T, pool_deleter<POOL>>;
+
+	// make_unique for pool memory: constructs T in a block of POOL, throws
+	// std::bad_alloc when the pool is exhausted and returns the block if the
+	// constructor throws.
+	template<typename T, typename POOL = default_pool_t<T>, typename... ARGS>
+	pooled_ptr<T, POOL> make_pooled(ARGS&&... args)
+	{
+		static_assert(false == std::is_array<T>::value, "make_pooled does not construct arrays");
+		static_assert(alignof(T) <= POOL::ALIGNMENT_MASK + 1, "T is aligned stricter than the pool");
+
+		auto &pool = POOL::get_instance();
+		void *p = detail::allocate_fixed<sizeof(T)>(pool, detail::is_sized_pool<POOL>());
+		if (p == nullptr)
+			throw std::bad_alloc();
+
+		try
+		{
+			return pooled_ptr<T, POOL>(::new (p) T(std::forward<ARGS>(args)...));
+		}
+		catch (...)
+		{
+			detail::deallocate_fixed<sizeof(T)>(pool, p, detail::is_sized_pool<POOL>());
+			throw;
+		}
+	}
+
+
+	// Standard allocator over POOL, for containers and std::allocate_shared.
+	// All instances are interchangeable.
+	template<typename T, typename POOL = default_memory_pool>
+	class pool_allocator
+	{
+	public:
+		using value_type = T;
+		using is_always_equal = std::true_type;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = pool_allocator<U, POOL>;
+		};
+
+		pool_allocator() noexcept = default;
+
+		template<typename U>
+		pool_allocator(const pool_allocator<U, POOL>&) noexcept {}
+
+		T *allocate(size_t n)
+		{
+			static_assert(alignof(T) <= POOL::ALIGNMENT_MASK + 1, "T is aligned stricter than the pool");
+
+			if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+				throw std::bad_alloc();
+
+			void *p = POOL::get_instance().allocate(n * sizeof(T));
+			if (p == nullptr)
+				throw std::bad_alloc();
+			return static_cast<T*>(p);
+		}
+
+		void deallocate(T *p, size_t n) noexcept
+		{
+			detail::deallocate_sized(POOL::get_instance(), p, n * sizeof(T), detail::is_sized_pool<POOL>());
+		}
+
+		template<typename U>
+		bool operator==(const pool_allocator<U, POOL>&) const noexcept { return true; }
+
+		template<typename U>
+		bool operator!=(const pool_allocator<U, POOL>&) const noexcept { return false; }
+	};
+
+	// std::make_shared for pool memory: the object and its reference counts
+	// share a single block of POOL.
+	template<typename T, typename POOL = default_memory_pool, typename... ARGS>
+	std::shared_ptr<T> make_pooled_shared(ARGS&&... args)
+	{
+		return std::allocate_shared<T>(pool_allocator<T, POOL>(), std::forward<ARGS>(args)...);
+	}
+}
@@ -0,0 +1,1070 @@
+#pragma once
+
+#include "chunk_source.h"
+#include "offset_ptr.h"
+#include "pool_stats.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+
+namespace ss
+{
+	// Policies of static_memory_pool and basic_memory_pool besides STATS
+	// (pool_stats.h). Each comes with the default that matches the pool's
+	// original behaviour.
+
+
+	// FIT picks the block an allocation is carved from. find() walks the
+	// block list from first, counting visited blocks in probes, and returns a
+	// free block of at least needed bytes or nullptr. When it finds none the
+	// pool asks overflow_allocate() for memory outside the block list, and
+	// hands pointers outside the pool to overflow_deallocate() before calling
+	// them invalid. A FIT is a private base of the pool and may keep state,
+	// the pool's basic_memory_pool::fit() reaches it.
+	//
+	// A FIT that indexes the free blocks hears about every change to them,
+	// always before the block's size changes: on_use() when a free block gets
+	// allocated, on_absorb() when one merges into a neighbour, on_release()
+	// once a new or merged free block has its final size and links. Its
+	// state must stay valid wherever the pool is mapped, as the links do.
+	//
+	// A FIT may also hold on to freed blocks, see quick_fit: defer() keeps a
+	// block that stays marked allocated and says whether it did, reuse()
+	// returns a kept block of exactly the requested size, and when a search
+	// fails reclaim() hands them back one by one for the pool to coalesce,
+	// or before every search that reuse() could not serve if reclaim_on_miss.
+	// is_deferred() lets the pool report a kept block that is freed again,
+	// for_each_deferred() lists every kept block for heap_map.h.
+
+	struct fit_policy
+	{
+		static constexpr bool reclaim_on_miss = false;
+
+		void reset() noexcept {}
+		template<typename HEADER> void on_use(HEADER *) noexcept {}
+		template<typename HEADER> void on_absorb(HEADER *) noexcept {}
+		template<typename HEADER> void on_release(HEADER *) noexcept {}
+		template<typename HEADER> bool defer(HEADER *) noexcept { return false; }
+		template<typename HEADER> HEADER *reuse(size_t) noexcept { return nullptr; }
+		template<typename HEADER> HEADER *reclaim() noexcept { return nullptr; }
+		template<typename HEADER> bool is_deferred(const HEADER *) const noexcept { return false; }
+		template<typename HEADER, typename FUNCTION> void for_each_deferred(FUNCTION) const {}
+		void *overflow_allocate(size_t, size_t) noexcept { return nullptr; }
+		// the size of a block overflow_allocate() returned, false for others
+		bool overflow_deallocate(void *, size_t &) noexcept { return false; }
+		void collect(pool_stats &) const noexcept {}
+	};
+
+	// first free block that fits, the default
+	struct first_fit : fit_policy
+	{
+		template<typename HEADER>
+		HEADER *find(HEADER *first, size_t needed, size_t &probes) noexcept
+		{
+			for (HEADER *it = first; it != nullptr; it = it->get_next())
+			{
+				++probes;
+				if (false == it->is_allocated() && it->get_size() >= needed)
+					return it;
+			}
+			return nullptr;
+		}
+	};
+
+	// smallest free block that fits, stops early on an exact fit
+	struct best_fit : fit_policy
+	{
+		template<typename HEADER>
+		HEADER *find(HEADER *first, size_t needed, size_t &probes) noexcept
+		{
+			HEADER *best = nullptr;
+			for (HEADER *it = first; it != nullptr; it = it->get_next())
+			{
+				++probes;
+				if (it->is_allocated() || it->get_size() < needed)
+					continue;
+				if (best == nullptr || it->get_size() < best->get_size())
+				{
+					best = it;
+					if (best->get_size() == needed)
+						break;
+				}
+			}
+			return best;
+		}
+	};
+
+	// First fit resuming where the last search succeeded, wrapping around at
+	// the end, so the slivers at the low end are not walked on every call.
+	// A merge that swallows the rover's block moves it to the merged block.
+	class next_fit : public fit_policy
+	{
+		// the blocks' header type is only known to the member templates
+		offset_ptr<uint8_t> _rover;
+
+	public:
+		template<typename HEADER>
+		HEADER *find(HEADER *first, size_t needed, size_t &probes) noexcept
+		{
+			HEADER *start = _rover != nullptr ? reinterpret_cast<HEADER*>(_rover.get()) : first;
+			for (HEADER *it = start; it != nullptr; it = it->get_next())
+			{
+				++probes;
+				if (false == it->is_allocated() && it->get_size() >= needed)
+				{
+					_rover = reinterpret_cast<uint8_t*>(it);
+					return it;
+				}
+			}
+			for (HEADER *it = first; it != start; it = it->get_next())
+			{
+				++probes;
+				if (false == it->is_allocated() && it->get_size() >= needed)
+				{
+					_rover = reinterpret_cast<uint8_t*>(it);
+					return it;
+				}
+			}
+			return nullptr;
+		}
+
+		template<typename HEADER>
+		void on_release(HEADER *block) noexcept
+		{
+			const uintptr_t rover = reinterpret_cast<uintptr_t>(_rover.get());
+			const HEADER *next = block->get_next();
+			if (rover > reinterpret_cast<uintptr_t>(block) && (next == nullptr || rover < reinterpret_cast<uintptr_t>(next)))
+				_rover = reinterpret_cast<uint8_t*>(block);
+		}
+
+		void reset() noexcept
+		{
+			_rover = nullptr;
+		}
+
+		// the block the next search starts at, nullptr for the first one
+		const void *rover() const noexcept { return _rover.get(); }
+	};
+
+	// Best fit, lowest address among blocks of the same size, over a treap of
+	// the free blocks ordered by size and then address: a search walks one
+	// path down the tree instead of the whole block list. The tree links live
+	// in the free blocks' payload, so blocks too small to hold them are left
+	// out; they are also too small for any request plus its header. Node
+	// priorities hash the block's distance from the pool object, which keeps
+	// the tree expected balanced and the same wherever the pool is mapped.
+	class tree_best_fit : public fit_policy
+	{
+		template<typename HEADER>
+		struct node
+		{
+			offset_ptr<HEADER> left;
+			offset_ptr<HEADER> right;
+		};
+
+		offset_ptr<uint8_t> _root;
+		size_t _indexed = 0;
+
+		template<typename HEADER>
+		static node<HEADER> &links(HEADER *block) noexcept
+		{
+			return *reinterpret_cast<node<HEADER>*>(reinterpret_cast<uint8_t*>(block) + sizeof(HEADER));
+		}
+
+		template<typename HEADER>
+		static bool is_indexed(const HEADER *block) noexcept
+		{
+			return block->get_size() >= sizeof(node<HEADER>);
+		}
+
+		template<typename HEADER>
+		static bool less(const HEADER *a, const HEADER *b) noexcept
+		{
+			return a->get_size() < b->get_size() || (a->get_size() == b->get_size() && a < b);
+		}
+
+		uint64_t priority(const void *block) const noexcept
+		{
+			uint64_t x = uint64_t(reinterpret_cast<uintptr_t>(block) - reinterpret_cast<uintptr_t>(this));
+			x *= 0x9e3779b97f4a7c15ull;
+			return x ^ (x >> 29);
+		}
+
+		// splits t into the blocks less than key and the rest
+		template<typename HEADER>
+		void split(HEADER *t, const HEADER *key, HEADER *&lower, HEADER *&upper) noexcept
+		{
+			if (t == nullptr)
+			{
+				lower = upper = nullptr;
+				return;
+			}
+
+			HEADER *l, *u;
+			if (less(t, key))
+			{
+				split(links(t).right.get(), key, l, u);
+				links(t).right = l;
+				lower = t;
+				upper = u;
+			}
+			else
+			{
+				split(links(t).left.get(), key, l, u);
+				links(t).left = u;
+				lower = l;
+				upper = t;
+			}
+		}
+
+		// every block of lower is less than every block of upper
+		template<typename HEADER>
+		HEADER *join(HEADER *lower, HEADER *upper) noexcept
+		{
+			if (lower == nullptr)
+				return upper;
+			if (upper == nullptr)
+				return lower;
+			if (priority(lower) > priority(upper))
+			{
+				links(lower).right = join(links(lower).right.get(), upper);
+				return lower;
+			}
+			links(upper).left = join(lower, links(upper).left.get());
+			return upper;
+		}
+
+		template<typename HEADER>
+		HEADER *insert(HEADER *t, HEADER *block) noexcept
+		{
+			if (t == nullptr || priority(block) > priority(t))
+			{
+				HEADER *l, *u;
+				split(t, block, l, u);
+				links(block).left = l;
+				links(block).right = u;
+				return block;
+			}
+			if (less(block, t))
+				links(t).left = insert(links(t).left.get(), block);
+			else
+				links(t).right = insert(links(t).right.get(), block);
+			return t;
+		}
+
+		template<typename HEADER>
+		HEADER *erase(HEADER *t, const HEADER *block) noexcept
+		{
+			assert(t != nullptr);
+			if (t == block)
+				return join(links(t).left.get(), links(t).right.get());
+			if (less(block, t))
+				links(t).left = erase(links(t).left.get(), block);
+			else
+				links(t).right = erase(links(t).right.get(), block);
+			return t;
+		}
+
+		template<typename HEADER>
+		void remove(HEADER *block) noexcept
+		{
+			if (false == is_indexed(block))
+				return;
+			_root = reinterpret_cast<uint8_t*>(erase(reinterpret_cast<HEADER*>(_root.get()), block));
+			--_indexed;
+		}
+
+	public:
+		template<typename HEADER>
+		HEADER *find(HEADER *, size_t needed, size_t &probes) noexcept
+		{
+			HEADER *best = nullptr;
+			for (HEADER *t = reinterpret_cast<HEADER*>(_root.get()); t != nullptr; )
+			{
+				++probes;
+				if (t->get_size() >= needed)
+				{
+					best = t;
+					t = links(t).left.get();
+				}
+				else
+					t = links(t).right.get();
+			}
+			return best;
+		}
+
+		template<typename HEADER>
+		void on_use(HEADER *block) noexcept
+		{
+			remove(block);
+		}
+
+		template<typename HEADER>
+		void on_absorb(HEADER *block) noexcept
+		{
+			remove(block);
+		}
+
+		template<typename HEADER>
+		void on_release(HEADER *block) noexcept
+		{
+			if (false == is_indexed(block))
+				return;
+			_root = reinterpret_cast<uint8_t*>(insert(reinterpret_cast<HEADER*>(_root.get()), block));
+			++_indexed;
+		}
+
+		void reset() noexcept
+		{
+			_root = nullptr;
+			_indexed = 0;
+		}
+
+		// free blocks in the tree
+		size_t indexed_blocks() const noexcept { return _indexed; }
+	};
+
+	namespace detail
+	{
+		// the list link of a deferred block, right behind its header
+		template<typename HEADER>
+		offset_ptr<uint8_t> &deferred_link(HEADER *block) noexcept
+		{
+			return *reinterpret_cast<offset_ptr<uint8_t>*>(reinterpret_cast<uint8_t*>(block) + sizeof(HEADER));
+		}
+
+		template<typename HEADER>
+		HEADER *deferred_next(HEADER *block) noexcept
+		{
+			return reinterpret_cast<HEADER*>(deferred_link(block).get());
+		}
+
+		template<typename HEADER>
+		const HEADER *deferred_next(const HEADER *block) noexcept
+		{
+			return deferred_next(const_cast<HEADER*>(block));
+		}
+	}
+
+	// dlmalloc's fastbins in front of FIT: a freed block of MIN_SIZE to
+	// MAX_SIZE bytes goes onto a LIFO list for its exact size without
+	// coalescing, and the next request of that size pops it without a
+	// search. The blocks stay marked allocated, so neighbours don't merge
+	// into them, until a failed search makes the pool coalesce them all.
+	// pool_stats counts them as deferred_blocks, not live. Like dlmalloc it
+	// only catches a block freed twice in a row as not allocated.
+	template<size_t MAX_SIZE = 64, typename FIT = first_fit>
+	class quick_fit : public FIT
+	{
+	public:
+		// the list link lives in the block
+		static constexpr size_t MIN_SIZE = sizeof(offset_ptr<uint8_t>);
+		static_assert(MAX_SIZE >= MIN_SIZE, "MAX_SIZE must hold a list link");
+
+	private:
+		std::array<offset_ptr<uint8_t>, MAX_SIZE - MIN_SIZE + 1> _lists;
+		size_t _deferred = 0;
+		size_t _deferred_bytes = 0;
+		// list reclaim() continues from
+		size_t _reclaim_list = 0;
+
+		template<typename HEADER>
+		HEADER *pop(size_t list) noexcept
+		{
+			HEADER *block = reinterpret_cast<HEADER*>(_lists[list].get());
+			if (block == nullptr)
+				return nullptr;
+			_lists[list] = detail::deferred_link(block).get();
+			--_deferred;
+			_deferred_bytes -= block->get_size();
+			return block;
+		}
+
+	public:
+		template<typename HEADER>
+		bool defer(HEADER *block) noexcept
+		{
+			const size_t size = block->get_size();
+			if (size < MIN_SIZE || size > MAX_SIZE)
+				return false;
+
+			offset_ptr<uint8_t> &head = _lists[size - MIN_SIZE];
+			detail::deferred_link(block) = head.get();
+			head = reinterpret_cast<uint8_t*>(block);
+			++_deferred;
+			_deferred_bytes += size;
+			return true;
+		}
+
+		template<typename HEADER>
+		HEADER *reuse(size_t size) noexcept
+		{
+			if (size < MIN_SIZE || size > MAX_SIZE)
+				return nullptr;
+			return pop<HEADER>(size - MIN_SIZE);
+		}
+
+		template<typename HEADER>
+		HEADER *reclaim() noexcept
+		{
+			for (; _reclaim_list < _lists.size(); ++_reclaim_list)
+			{
+				if (HEADER *block = pop<HEADER>(_reclaim_list))
+					return block;
+			}
+			_reclaim_list = 0;
+			return nullptr;
+		}
+
+		// only checks the newest block of the size's list, as dlmalloc does
+		template<typename HEADER>
+		bool is_deferred(const HEADER *block) const noexcept
+		{
+			const size_t size = block->get_size();
+			return size >= MIN_SIZE && size <= MAX_SIZE &&
+				_lists[size - MIN_SIZE].get() == reinterpret_cast<const uint8_t*>(block);
+		}
+
+		template<typename HEADER, typename FUNCTION>
+		void for_each_deferred(FUNCTION f) const
+		{
+			FIT::template for_each_deferred<HEADER>(f);
+			for (const offset_ptr<uint8_t> &head : _lists)
+				for (const HEADER *block = reinterpret_cast<const HEADER*>(head.get()); block != nullptr; block = detail::deferred_next(block))
+					f(block);
+		}
+
+		void reset() noexcept
+		{
+			FIT::reset();
+			for (offset_ptr<uint8_t> &head : _lists)
+				head = nullptr;
+			_deferred = 0;
+			_deferred_bytes = 0;
+			_reclaim_list = 0;
+		}
+
+		void collect(pool_stats &out) const noexcept
+		{
+			FIT::collect(out);
+			out.bytes_in_use -= _deferred_bytes;
+			out.live_blocks -= _deferred;
+			out.deferred_blocks += _deferred;
+		}
+
+		size_t deferred_blocks() const noexcept { return _deferred; }
+	};
+
+	// dlmalloc's unsorted bin in front of FIT: every freed block of at least
+	// MIN_SIZE bytes goes into one bin without coalescing. A request first
+	// takes a block of exactly its size from the bin; on a miss the bin is
+	// sorted by address and coalesced in one pass before FIT searches, as
+	// basic_memory_pool::consolidate() does at any time. Freeing and
+	// reallocating the same sizes then never coalesces, other requests pay
+	// for the whole bin at once. Deferred blocks count as in quick_fit, and
+	// as there only the newest one is caught when freed again: freeing an
+	// older block of the bin twice links it in twice. Scanning the bin
+	// would make a run of frees quadratic.
+	template<typename FIT = first_fit>
+	class unsorted_fit : public FIT
+	{
+	public:
+		static constexpr bool reclaim_on_miss = true;
+		static constexpr size_t MIN_SIZE = sizeof(offset_ptr<uint8_t>);
+
+	private:
+		offset_ptr<uint8_t> _bin;
+		size_t _deferred = 0;
+		size_t _deferred_bytes = 0;
+		bool _sorted = true;
+
+		template<typename HEADER>
+		static HEADER *merge(HEADER *a, HEADER *b) noexcept
+		{
+			HEADER *head = nullptr, *tail = nullptr;
+			while (a != nullptr || b != nullptr)
+			{
+				HEADER *&lower = b == nullptr || (a != nullptr && a < b) ? a : b;
+				HEADER *block = lower;
+				lower = detail::deferred_next(block);
+				if (tail == nullptr)
+					head = block;
+				else
+					detail::deferred_link(tail) = reinterpret_cast<uint8_t*>(block);
+				tail = block;
+			}
+			if (tail != nullptr)
+				detail::deferred_link(tail) = nullptr;
+			return head;
+		}
+
+		// merge sort by address, recursing log2 of the bin size deep
+		template<typename HEADER>
+		static HEADER *sort(HEADER *list, size_t length) noexcept
+		{
+			if (length < 2)
+				return list;
+
+			HEADER *middle = list;
+			for (size_t i = 1; i < length / 2; ++i)
+				middle = detail::deferred_next(middle);
+			HEADER *second = detail::deferred_next(middle);
+			detail::deferred_link(middle) = nullptr;
+			return merge(sort(list, length / 2), sort(second, length - length / 2));
+		}
+
+		template<typename HEADER>
+		void unlink(HEADER *block, HEADER *prev) noexcept
+		{
+			if (prev == nullptr)
+				_bin = detail::deferred_link(block).get();
+			else
+				detail::deferred_link(prev) = detail::deferred_link(block).get();
+			--_deferred;
+			_deferred_bytes -= block->get_size();
+		}
+
+	public:
+		template<typename HEADER>
+		bool defer(HEADER *block) noexcept
+		{
+			if (block->get_size() < MIN_SIZE)
+				return false;
+
+			detail::deferred_link(block) = _bin.get();
+			_bin = reinterpret_cast<uint8_t*>(block);
+			++_deferred;
+			_deferred_bytes += block->get_size();
+			_sorted = _deferred == 1;
+			return true;
+		}
+
+		template<typename HEADER>
+		HEADER *reuse(size_t size) noexcept
+		{
+			HEADER *prev = nullptr;
+			for (HEADER *block = reinterpret_cast<HEADER*>(_bin.get()); block != nullptr; block = detail::deferred_next(block))
+			{
+				if (block->get_size() == size)
+				{
+					unlink(block, prev);
+					return block;
+				}
+				prev = block;
+			}
+			return nullptr;
+		}
+
+		// in address order
+		template<typename HEADER>
+		HEADER *reclaim() noexcept
+		{
+			HEADER *block = reinterpret_cast<HEADER*>(_bin.get());
+			if (block == nullptr)
+				return nullptr;
+			if (false == _sorted)
+			{
+				block = sort(block, _deferred);
+				_sorted = true;
+			}
+			unlink(block, static_cast<HEADER*>(nullptr));
+			return block;
+		}
+
+		// only checks the newest block of the bin, see above
+		template<typename HEADER>
+		bool is_deferred(const HEADER *block) const noexcept
+		{
+			return _bin.get() == reinterpret_cast<const uint8_t*>(block);
+		}
+
+		template<typename HEADER, typename FUNCTION>
+		void for_each_deferred(FUNCTION f) const
+		{
+			FIT::template for_each_deferred<HEADER>(f);
+			for (const HEADER *block = reinterpret_cast<const HEADER*>(_bin.get()); block != nullptr; block = detail::deferred_next(block))
+				f(block);
+		}
+
+		void reset() noexcept
+		{
+			FIT::reset();
+			_bin = nullptr;
+			_deferred = 0;
+			_deferred_bytes = 0;
+			_sorted = true;
+		}
+
+		void collect(pool_stats &out) const noexcept
+		{
+			FIT::collect(out);
+			out.bytes_in_use -= _deferred_bytes;
+			out.live_blocks -= _deferred;
+			out.deferred_blocks += _deferred;
+		}
+
+		size_t deferred_blocks() const noexcept { return _deferred; }
+	};
+
+
+	// Where bounded_fit sends a request its search gave up on. A FALLBACK
+	// prefixes each block with its size so deallocate() can return it;
+	// blocks are aligned to alignof(std::max_align_t).
+
+	// the request fails
+	struct no_fallback
+	{
+		void *allocate(size_t, size_t) noexcept { return nullptr; }
+		bool deallocate(void *, size_t &) noexcept { return false; }
+		void reset() noexcept {}
+	};
+
+	// RESERVE_SIZE bytes set aside inside the pool object, handed out by
+	// bumping a pointer. Freeing the newest block moves it back, the rest
+	// comes back once the reserve is empty or on reset().
+	template<size_t RESERVE_SIZE>
+	class reserve_fallback
+	{
+		static constexpr size_t HEADER = alignof(std::max_align_t);
+
+		alignas(std::max_align_t) uint8_t _reserve[RESERVE_SIZE];
+		size_t _top = 0;
+		size_t _live = 0;
+
+	public:
+		void *allocate(size_t size, size_t alignment) noexcept
+		{
+			const size_t block = HEADER + ((size + HEADER - 1) & ~(HEADER - 1));
+			if (alignment > HEADER || size > RESERVE_SIZE || block > RESERVE_SIZE - _top)
+				return nullptr;
+
+			uint8_t *header = _reserve + _top;
+			*reinterpret_cast<size_t*>(header) = size;
+			_top += block;
+			++_live;
+			return header + HEADER;
+		}
+
+		bool deallocate(void *p, size_t &size) noexcept
+		{
+			uint8_t *header = static_cast<uint8_t*>(p) - HEADER;
+			if (header < _reserve || header >= _reserve + _top)
+				return false;
+
+			size = *reinterpret_cast<size_t*>(header);
+			if (header + HEADER + ((size + HEADER - 1) & ~(HEADER - 1)) == _reserve + _top)
+				_top = static_cast<size_t>(header - _reserve);
+			if (--_live == 0)
+				_top = 0;
+			return true;
+		}
+
+		void reset() noexcept
+		{
+			_top = 0;
+			_live = 0;
+		}
+	};
+
+	namespace detail
+	{
+		// Open addressing set of pointers with linear probing. Its table
+		// comes from std::malloc, so it works behind a global operator new.
+		class pointer_set
+		{
+			static constexpr uintptr_t EMPTY = 0;
+			static constexpr uintptr_t ERASED = 1;
+
+			uintptr_t *_slots = nullptr;
+			size_t _capacity = 0;
+			size_t _size = 0;
+			// live and erased slots, the probe sequences run until an empty one
+			size_t _used = 0;
+
+			size_t slot_of(uintptr_t key) const noexcept
+			{
+				uint64_t h = static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ull;
+				return static_cast<size_t>(h ^ (h >> 32)) & (_capacity - 1);
+			}
+
+			bool grow() noexcept
+			{
+				// doubles, or only drops the erased slots when few are live
+				const size_t capacity = _capacity == 0 ? 16 : _size * 4 >= _capacity ? _capacity * 2 : _capacity;
+				uintptr_t *slots = static_cast<uintptr_t*>(std::calloc(capacity, sizeof(uintptr_t)));
+				if (slots == nullptr)
+					return false;
+
+				uintptr_t *old = _slots;
+				const size_t old_capacity = _capacity;
+				_slots = slots;
+				_capacity = capacity;
+				_used = _size;
+				for (size_t i = 0; i < old_capacity; ++i)
+				{
+					if (old[i] == EMPTY || old[i] == ERASED)
+						continue;
+					size_t slot = slot_of(old[i]);
+					while (_slots[slot] != EMPTY)
+						slot = (slot + 1) & (_capacity - 1);
+					_slots[slot] = old[i];
+				}
+				std::free(old);
+				return true;
+			}
+
+		public:
+			pointer_set() = default;
+			pointer_set(const pointer_set&) = delete;
+			pointer_set &operator=(const pointer_set&) = delete;
+
+			~pointer_set()
+			{
+				std::free(_slots);
+			}
+
+			// false when the table can't grow
+			bool insert(const void *p) noexcept
+			{
+				if ((_used + 1) * 2 > _capacity && false == grow())
+					return false;
+
+				const uintptr_t key = reinterpret_cast<uintptr_t>(p);
+				size_t slot = slot_of(key);
+				while (_slots[slot] != EMPTY && _slots[slot] != ERASED)
+					slot = (slot + 1) & (_capacity - 1);
+				if (_slots[slot] == EMPTY)
+					++_used;
+				_slots[slot] = key;
+				++_size;
+				return true;
+			}
+
+			// false when p is not in the set
+			bool erase(const void *p) noexcept
+			{
+				const uintptr_t key = reinterpret_cast<uintptr_t>(p);
+				if (_size == 0 || key == EMPTY || key == ERASED)
+					return false;
+				for (size_t slot = slot_of(key); _slots[slot] != EMPTY; slot = (slot + 1) & (_capacity - 1))
+				{
+					if (_slots[slot] == key)
+					{
+						_slots[slot] = ERASED;
+						--_size;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			template<typename FUNCTION>
+			void for_each(FUNCTION f) const
+			{
+				for (size_t i = 0; i < _capacity; ++i)
+					if (_slots[i] != EMPTY && _slots[i] != ERASED)
+						f(reinterpret_cast<void*>(_slots[i]));
+			}
+
+			void clear() noexcept
+			{
+				std::free(_slots);
+				_slots = nullptr;
+				_capacity = 0;
+				_size = 0;
+				_used = 0;
+			}
+
+			size_t size() const noexcept { return _size; }
+		};
+	}
+
+	// std::malloc. The blocks handed out are kept in a pointer_set, so a
+	// pointer that isn't one of them, freed twice or from another allocator,
+	// is still reported as invalid. reset() and the destructor free the
+	// blocks still out.
+	class malloc_fallback
+	{
+	public:
+		static constexpr size_t HEADER = alignof(std::max_align_t);
+
+	private:
+		detail::pointer_set _blocks;
+
+	public:
+		malloc_fallback() = default;
+		malloc_fallback(const malloc_fallback&) = delete;
+		malloc_fallback &operator=(const malloc_fallback&) = delete;
+
+		~malloc_fallback()
+		{
+			reset();
+		}
+
+		void *allocate(size_t size, size_t alignment) noexcept
+		{
+			if (alignment > HEADER || size > std::numeric_limits<size_t>::max() - HEADER)
+				return nullptr;
+			uint8_t *header = static_cast<uint8_t*>(std::malloc(size + HEADER));
+			if (header == nullptr)
+				return nullptr;
+			if (false == _blocks.insert(header + HEADER))
+			{
+				std::free(header);
+				return nullptr;
+			}
+			*reinterpret_cast<size_t*>(header) = size;
+			return header + HEADER;
+		}
+
+		bool deallocate(void *p, size_t &size) noexcept
+		{
+			if (false == _blocks.erase(p))
+				return false;
+			uint8_t *header = static_cast<uint8_t*>(p) - HEADER;
+			size = *reinterpret_cast<size_t*>(header);
+			std::free(header);
+			return true;
+		}
+
+		void reset() noexcept
+		{
+			_blocks.for_each([](void *p) { std::free(static_cast<uint8_t*>(p) - HEADER); });
+			_blocks.clear();
+		}
+
+		// blocks handed out and not freed yet
+		size_t live_blocks() const noexcept { return _blocks.size(); }
+	};
+
+	// First fit that inspects at most max_probes() blocks, MAX_PROBES unless
+	// changed with set_max_probes(), so the search has a hard ceiling however
+	// fragmented the pool gets. A request the search gives up on, or that
+	// finds no block at all, goes to FALLBACK. pool_stats counts both.
+	template<size_t MAX_PROBES = 32, typename FALLBACK = no_fallback>
+	class bounded_fit : public fit_policy, private FALLBACK
+	{
+		static_assert(MAX_PROBES > 0, "MAX_PROBES must be positive");
+
+		size_t _max_probes = MAX_PROBES;
+		uint64_t _limit_hits = 0;
+		uint64_t _fallbacks = 0;
+
+	public:
+		template<typename HEADER>
+		HEADER *find(HEADER *first, size_t needed, size_t &probes) noexcept
+		{
+			for (HEADER *it = first; it != nullptr; it = it->get_next())
+			{
+				if (probes == _max_probes)
+				{
+					++_limit_hits;
+					return nullptr;
+				}
+				++probes;
+				if (false == it->is_allocated() && it->get_size() >= needed)
+					return it;
+			}
+			return nullptr;
+		}
+
+		void *overflow_allocate(size_t size, size_t alignment) noexcept
+		{
+			void *p = FALLBACK::allocate(size, alignment);
+			if (p != nullptr)
+				++_fallbacks;
+			return p;
+		}
+
+		bool overflow_deallocate(void *p, size_t &size) noexcept
+		{
+			return FALLBACK::deallocate(p, size);
+		}
+
+		void reset() noexcept
+		{
+			FALLBACK::reset();
+			_limit_hits = 0;
+			_fallbacks = 0;
+		}
+
+		void collect(pool_stats &out) const noexcept
+		{
+			out.probe_limit_hits += _limit_hits;
+			out.fallback_allocations += _fallbacks;
+		}
+
+		const FALLBACK &fallback() const noexcept { return *this; }
+
+		size_t max_probes() const noexcept { return _max_probes; }
+		void set_max_probes(size_t max_probes) noexcept { _max_probes = max_probes > 0 ? max_probes : 1; }
+	};
+
+
+	// LOCK guards every public call of static_memory_pool, any BasicLockable.
+
+	// no locking, the default: one thread per pool
+	struct null_lock
+	{
+		void lock() noexcept {}
+		void unlock() noexcept {}
+	};
+
+	using mutex_lock = std::mutex;
+
+	// for short critical sections under little contention
+	class spin_lock
+	{
+		std::atomic_flag _flag = ATOMIC_FLAG_INIT;
+
+	public:
+		void lock() noexcept
+		{
+			while (_flag.test_and_set(std::memory_order_acquire))
+			{
+#if defined(__x86_64__) || defined(__i386__)
+				__builtin_ia32_pause();
+#endif
+			}
+		}
+
+		void unlock() noexcept
+		{
+			_flag.clear(std::memory_order_release);
+		}
+	};
+
+
+	// ERROR decides what a failed call does. allocate() returns nullptr and
+	// deallocate() returns without freeing unless the policy throws. The hooks
+	// are only reached on failure, the fast paths don't touch <iostream>.
+	// throw_exception is the argument of the failed allocate()/deallocate().
+
+	enum class pool_error
+	{
+		too_large,
+		exhausted,
+		outside_pool,
+		not_allocated,
+		wrong_size
+	};
+
+	inline const char *describe(pool_error error) noexcept
+	{
+		switch (error)
+		{
+		case pool_error::too_large: return "requested size larger than the pool";
+		case pool_error::exhausted: return "pool exhausted";
+		case pool_error::outside_pool: return "Tried to deallocate pointer outside of static buffer range";
+		case pool_error::not_allocated: return "Tried to deallocate unallocated pointer";
+		case pool_error::wrong_size: return "Tried to deallocate with a size other than the allocated one";
+		}
+		return "pool error";
+	}
+
+	// The default: reports to std::cerr, throws only when the caller passed
+	// throw_exception, and a failed allocation never throws. A pool with no
+	// block left for the request returns nullptr quietly, as it always has.
+	struct log_error
+	{
+		static void too_large(size_t requested_size, size_t pool_size, bool)
+		{
+			std::cerr << "requested size " << requested_size << ", larger than POOL_SIZE " << pool_size << "\n";
+		}
+
+		static void exhausted(size_t, bool) noexcept {}
+
+		static void invalid_pointer(pool_error error, const void *, bool throw_exception)
+		{
+			if (throw_exception)
+				throw std::runtime_error(describe(error));
+			std::cerr << describe(error) << std::endl;
+		}
+	};
+
+	// std::bad_alloc for failed allocations, std::invalid_argument for bad pointers
+	struct throw_error
+	{
+		static void too_large(size_t, size_t, bool) { throw std::bad_alloc(); }
+		static void exhausted(size_t, bool) { throw std::bad_alloc(); }
+		static void invalid_pointer(pool_error error, const void *, bool) { throw std::invalid_argument(describe(error)); }
+	};
+
+	// silently nullptr or ignored
+	struct null_error
+	{
+		static void too_large(size_t, size_t, bool) noexcept {}
+		static void exhausted(size_t, bool) noexcept {}
+		static void invalid_pointer(pool_error, const void *, bool) noexcept {}
+	};
+
+	// HANDLER(error, requested size or 0, pointer or nullptr) on every
+	// failure; it may throw or abort, otherwise the call fails quietly
+	template<void (*HANDLER)(pool_error, size_t, const void*)>
+	struct handler_error
+	{
+		static void too_large(size_t requested_size, size_t, bool) { HANDLER(pool_error::too_large, requested_size, nullptr); }
+		static void exhausted(size_t requested_size, bool) { HANDLER(pool_error::exhausted, requested_size, nullptr); }
+		static void invalid_pointer(pool_error error, const void *p, bool) { HANDLER(error, 0, p); }
+	};
+
+
+	// BACKING<POOL_SIZE, ALIGNMENT> owns the memory of a static_memory_pool
+	// and hands it out through memory().
+
+	// an array inside the pool object, in BSS for the singleton; the default
+	template<size_t POOL_SIZE, size_t ALIGNMENT>
+	struct static_backing
+	{
+		alignas(ALIGNMENT)uint8_t _buffer[POOL_SIZE];
+
+		void *memory() noexcept { return _buffer; }
+	};
+
+	// fresh pages mapped on construction, unmapped with the pool
+	template<size_t POOL_SIZE, size_t ALIGNMENT>
+	class mmap_backing
+	{
+		static_assert(ALIGNMENT <= 4096, "mmap only guarantees page alignment");
+
+		void *_memory;
+
+	public:
+		mmap_backing() : _memory(mmap_chunk_source::acquire(POOL_SIZE))
+		{
+			if (_memory == nullptr)
+				throw std::bad_alloc();
+		}
+
+		~mmap_backing()
+		{
+			mmap_chunk_source::release(_memory, POOL_SIZE);
+		}
+
+		mmap_backing(const mmap_backing&) = delete;
+		mmap_backing &operator=(const mmap_backing&) = delete;
+
+		void *memory() noexcept { return _memory; }
+	};
+
+	// POOL_SIZE bytes the caller owns, passed to the pool constructor
+	template<size_t POOL_SIZE, size_t ALIGNMENT>
+	class external_backing
+	{
+		void *_memory;
+
+	public:
+		explicit external_backing(void *buffer) noexcept : _memory(buffer)
+		{
+		}
+
+		void *memory() noexcept { return _memory; }
+	};
+}
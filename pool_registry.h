@@ -0,0 +1,252 @@
+#pragma once
+
+#include "chunk_source.h"
+#include "pool_policies.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace ss
+{
+	// What a registered address range belongs to: the pool object, the name of
+	// its engine for diagnostics and how to free a pointer into it.
+	struct pool_owner
+	{
+		void *pool;
+		const char *engine;
+		void (*deallocate)(void *pool, void *p);
+	};
+
+	template<typename POOL>
+	pool_owner make_pool_owner(POOL &pool, const char *engine) noexcept
+	{
+		return pool_owner{ &pool, engine, [](void *owner, void *p) { static_cast<POOL*>(owner)->deallocate(p); } };
+	}
+
+
+	// Maps any address to the pool owning it in constant time, so a global
+	// operator delete can route a pointer among several pools. A three level
+	// radix tree over the page numbers of ADDRESS_BITS wide addresses holds
+	// one owner per page; interior nodes are mapped on first use and stay
+	// until the registry goes away.
+	//
+	// A page only partly covered by a range, where a small or unaligned pool
+	// may share it with another, points at a marker instead and the lookup
+	// checks the at most MAX_SHARED such ranges. Lookups take no lock and may
+	// run concurrently with add() and remove() of other ranges; the owner
+	// passed to add() must outlive its ranges' registration.
+	//
+	// The get_instance() registry is never destroyed, so an operator delete
+	// running in any static destructor can still look pointers up.
+	template<size_t PAGE_SHIFT = 12, size_t ADDRESS_BITS = 48, size_t MAX_SHARED = 64>
+	class basic_pool_registry
+	{
+		static constexpr size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+		static constexpr size_t PAGE_BITS = ADDRESS_BITS - PAGE_SHIFT;
+		static constexpr size_t LEAF_BITS = PAGE_BITS / 3;
+		static constexpr size_t MID_BITS = PAGE_BITS / 3;
+		static constexpr size_t ROOT_BITS = PAGE_BITS - LEAF_BITS - MID_BITS;
+
+		using leaf = std::array<std::atomic<const pool_owner*>, size_t(1) << LEAF_BITS>;
+		using mid = std::array<std::atomic<leaf*>, size_t(1) << MID_BITS>;
+
+		struct shared_range
+		{
+			uintptr_t begin;
+			uintptr_t end;
+			const pool_owner *owner;
+		};
+
+		std::array<std::atomic<mid*>, size_t(1) << ROOT_BITS> _root = {};
+		std::array<shared_range, MAX_SHARED> _shared = {};
+		size_t _num_shared = 0;
+		// serializes changes, and lookups on shared pages against them
+		mutable spin_lock _lock;
+
+		static const pool_owner *shared_page() noexcept
+		{
+			static const pool_owner marker = { nullptr, "shared page", nullptr };
+			return &marker;
+		}
+
+		template<typename NODE>
+		static NODE *make_node() noexcept
+		{
+			void *memory = mmap_chunk_source::acquire(sizeof(NODE));
+			return memory == nullptr ? nullptr : new (memory) NODE();
+		}
+
+		// the entry of page, nullptr when its nodes don't exist and create is false
+		std::atomic<const pool_owner*> *entry(uintptr_t page, bool create) noexcept
+		{
+			std::atomic<mid*> &root = _root[page >> (MID_BITS + LEAF_BITS)];
+			mid *m = root.load(std::memory_order_acquire);
+			if (m == nullptr)
+			{
+				if (false == create || (m = make_node<mid>()) == nullptr)
+					return nullptr;
+				root.store(m, std::memory_order_release);
+			}
+
+			std::atomic<leaf*> &slot = (*m)[(page >> LEAF_BITS) & ((size_t(1) << MID_BITS) - 1)];
+			leaf *l = slot.load(std::memory_order_acquire);
+			if (l == nullptr)
+			{
+				if (false == create || (l = make_node<leaf>()) == nullptr)
+					return nullptr;
+				slot.store(l, std::memory_order_release);
+			}
+			return &(*l)[page & ((size_t(1) << LEAF_BITS) - 1)];
+		}
+
+		bool touches_shared(uintptr_t page) const noexcept
+		{
+			for (size_t i = 0; i < _num_shared; ++i)
+				if ((_shared[i].begin >> PAGE_SHIFT) <= page && ((_shared[i].end - 1) >> PAGE_SHIFT) >= page)
+					return true;
+			return false;
+		}
+
+		const pool_owner *find_shared(uintptr_t addr) const noexcept
+		{
+			std::lock_guard<spin_lock> lock(_lock);
+			for (size_t i = 0; i < _num_shared; ++i)
+				if (addr >= _shared[i].begin && addr < _shared[i].end)
+					return _shared[i].owner;
+			return nullptr;
+		}
+
+	public:
+		basic_pool_registry() = default;
+		basic_pool_registry(const basic_pool_registry&) = delete;
+		basic_pool_registry &operator=(const basic_pool_registry&) = delete;
+
+		~basic_pool_registry()
+		{
+			for (std::atomic<mid*> &root : _root)
+			{
+				mid *m = root.load(std::memory_order_relaxed);
+				if (m == nullptr)
+					continue;
+				for (std::atomic<leaf*> &slot : *m)
+					if (leaf *l = slot.load(std::memory_order_relaxed))
+						mmap_chunk_source::release(l, sizeof(leaf));
+				mmap_chunk_source::release(m, sizeof(mid));
+			}
+		}
+
+		static basic_pool_registry &get_instance() noexcept
+		{
+			static typename std::aligned_storage<sizeof(basic_pool_registry), alignof(basic_pool_registry)>::type storage;
+			static basic_pool_registry *instance = new (&storage) basic_pool_registry();
+			return *instance;
+		}
+
+		// false when the range is empty or out of reach, its partly covered
+		// pages don't fit into MAX_SHARED or a node can't be mapped
+		bool add(const void *begin, size_t size, const pool_owner *owner) noexcept
+		{
+			const uintptr_t first = reinterpret_cast<uintptr_t>(begin);
+			const uintptr_t last = first + size;
+			if (size == 0 || owner == nullptr || last < first || (last - 1) >> ADDRESS_BITS != 0)
+				return false;
+
+			std::lock_guard<spin_lock> lock(_lock);
+			const uintptr_t full_begin = (first + PAGE_SIZE - 1) >> PAGE_SHIFT;
+			const uintptr_t full_end = last >> PAGE_SHIFT;
+			const bool shared = full_begin >= full_end || (first & (PAGE_SIZE - 1)) != 0 || (last & (PAGE_SIZE - 1)) != 0;
+			if (shared && _num_shared == MAX_SHARED)
+				return false;
+
+			for (uintptr_t page = full_begin; page < full_end; ++page)
+			{
+				std::atomic<const pool_owner*> *e = entry(page, true);
+				if (e == nullptr)
+					return false;
+				e->store(owner, std::memory_order_release);
+			}
+
+			if (shared)
+			{
+				_shared[_num_shared++] = shared_range{ first, last, owner };
+				for (uintptr_t page : { first >> PAGE_SHIFT, (last - 1) >> PAGE_SHIFT })
+				{
+					if (page >= full_begin && page < full_end)
+						continue;
+					std::atomic<const pool_owner*> *e = entry(page, true);
+					if (e == nullptr)
+						return false;
+					e->store(shared_page(), std::memory_order_release);
+				}
+			}
+			return true;
+		}
+
+		// the range exactly as passed to add()
+		void remove(const void *begin, size_t size) noexcept
+		{
+			const uintptr_t first = reinterpret_cast<uintptr_t>(begin);
+			const uintptr_t last = first + size;
+			if (size == 0 || last < first || (last - 1) >> ADDRESS_BITS != 0)
+				return;
+
+			std::lock_guard<spin_lock> lock(_lock);
+			const uintptr_t full_begin = (first + PAGE_SIZE - 1) >> PAGE_SHIFT;
+			const uintptr_t full_end = last >> PAGE_SHIFT;
+			for (uintptr_t page = full_begin; page < full_end; ++page)
+				if (std::atomic<const pool_owner*> *e = entry(page, false))
+					e->store(nullptr, std::memory_order_release);
+
+			for (size_t i = 0; i < _num_shared; ++i)
+			{
+				if (_shared[i].begin != first || _shared[i].end != last)
+					continue;
+				_shared[i] = _shared[--_num_shared];
+				for (uintptr_t page : { first >> PAGE_SHIFT, (last - 1) >> PAGE_SHIFT })
+				{
+					if ((page >= full_begin && page < full_end) || touches_shared(page))
+						continue;
+					if (std::atomic<const pool_owner*> *e = entry(page, false))
+						e->store(nullptr, std::memory_order_release);
+				}
+				break;
+			}
+		}
+
+		// the owner of p, nullptr for unregistered addresses
+		const pool_owner *find(const void *p) const noexcept
+		{
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+			if (addr >> ADDRESS_BITS != 0)
+				return nullptr;
+
+			const uintptr_t page = addr >> PAGE_SHIFT;
+			const mid *m = _root[page >> (MID_BITS + LEAF_BITS)].load(std::memory_order_acquire);
+			if (m == nullptr)
+				return nullptr;
+			const leaf *l = (*m)[(page >> LEAF_BITS) & ((size_t(1) << MID_BITS) - 1)].load(std::memory_order_acquire);
+			if (l == nullptr)
+				return nullptr;
+
+			const pool_owner *owner = (*l)[page & ((size_t(1) << LEAF_BITS) - 1)].load(std::memory_order_acquire);
+			return owner == shared_page() ? find_shared(addr) : owner;
+		}
+
+		// frees p into its owner, false when no pool owns it
+		bool deallocate(void *p)
+		{
+			const pool_owner *owner = find(p);
+			if (owner == nullptr)
+				return false;
+			owner->deallocate(owner->pool, p);
+			return true;
+		}
+	};
+
+	using pool_registry = basic_pool_registry<>;
+}
@@ -0,0 +1,698 @@
+#pragma once
+
+#include "allocation_trace.h"
+#include "basic_memory_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace ss
+{
+	// Metadata only model of a pool: replays a trace against a fit policy and
+	// a pool size without touching payload memory. simulated_heap does the
+	// split and coalesce of basic_memory_pool (a block needs its size plus a
+	// header, every allocation splits off the remainder, neighbours coalesce
+	// on free) and asks FIT which free block to use. simulated_buddy_heap
+	// models a binary buddy allocator instead.
+
+	struct simulation_result
+	{
+		size_t pool_size = 0;
+		uint64_t operations = 0;
+		uint64_t failures = 0;
+		// index into the trace of the first failed allocation, -1 if none
+		int64_t first_failure = -1;
+		uint64_t first_failure_size = 0;
+		size_t peak_live_bytes = 0;
+		// highest address ever handed out, what the pool really needs
+		size_t peak_footprint = 0;
+		double max_fragmentation = 0.0;
+		// 1 - largest free / total free, sampled at even intervals of the trace
+		std::vector<double> fragmentation;
+	};
+
+	struct simulated_block
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t prev;
+		uint32_t next;
+		// free list links for policies that keep lists
+		uint32_t list_prev;
+		uint32_t list_next;
+		bool allocated;
+	};
+
+	static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+
+	// Lowest address free block that fits: a treap keyed by address where every
+	// node knows the largest free block below it, so the search is O(log n)
+	// instead of the block walk basic_memory_pool does, with the same answer.
+	class simulated_first_fit
+	{
+		const std::vector<simulated_block> *_blocks = nullptr;
+		std::vector<uint32_t> _left, _right, _priority;
+		std::vector<uint64_t> _max;
+		uint32_t _root = NO_BLOCK;
+		std::minstd_rand _rng;
+
+		uint64_t key(uint32_t n) const { return (*_blocks)[n].offset; }
+		uint64_t max_of(uint32_t n) const { return n == NO_BLOCK ? 0 : _max[n]; }
+
+		void update(uint32_t n)
+		{
+			_max[n] = std::max((*_blocks)[n].size, std::max(max_of(_left[n]), max_of(_right[n])));
+		}
+
+		// l gets keys below k, r the rest
+		void split(uint32_t t, uint64_t k, uint32_t &l, uint32_t &r)
+		{
+			if (t == NO_BLOCK)
+			{
+				l = r = NO_BLOCK;
+			}
+			else if (key(t) < k)
+			{
+				split(_right[t], k, _right[t], r);
+				l = t;
+				update(t);
+			}
+			else
+			{
+				split(_left[t], k, l, _left[t]);
+				r = t;
+				update(t);
+			}
+		}
+
+		uint32_t merge(uint32_t l, uint32_t r)
+		{
+			if (l == NO_BLOCK)
+				return r;
+			if (r == NO_BLOCK)
+				return l;
+			if (_priority[l] > _priority[r])
+			{
+				_right[l] = merge(_right[l], r);
+				update(l);
+				return l;
+			}
+			_left[r] = merge(l, _left[r]);
+			update(r);
+			return r;
+		}
+
+	public:
+		static const char *name() { return "first-fit"; }
+
+		void attach(const std::vector<simulated_block> *blocks) { _blocks = blocks; }
+
+		void insert(uint32_t id)
+		{
+			if (id >= _left.size())
+			{
+				const size_t n = std::max<size_t>(id + 1, _left.size() * 2);
+				_left.resize(n);
+				_right.resize(n);
+				_priority.resize(n);
+				_max.resize(n);
+			}
+
+			_left[id] = _right[id] = NO_BLOCK;
+			_priority[id] = static_cast<uint32_t>(_rng());
+			_max[id] = (*_blocks)[id].size;
+
+			uint32_t l, r;
+			split(_root, key(id), l, r);
+			_root = merge(merge(l, id), r);
+		}
+
+		void remove(uint32_t id)
+		{
+			uint32_t l, m, r;
+			split(_root, key(id), l, r);
+			split(r, key(id) + 1, m, r);
+			_root = merge(l, r);
+		}
+
+		uint32_t find(uint64_t need) const
+		{
+			uint32_t t = _root;
+			if (max_of(t) < need)
+				return NO_BLOCK;
+
+			while (true)
+			{
+				if (max_of(_left[t]) >= need)
+					t = _left[t];
+				else if ((*_blocks)[t].size >= need)
+					return t;
+				else
+					t = _right[t];
+			}
+		}
+
+		uint64_t largest() const { return max_of(_root); }
+	};
+
+
+	// Smallest free block that fits, lowest address among equal sizes.
+	class simulated_best_fit
+	{
+		const std::vector<simulated_block> *_blocks = nullptr;
+		std::set<std::tuple<uint64_t, uint64_t, uint32_t>> _free;
+
+		std::tuple<uint64_t, uint64_t, uint32_t> entry(uint32_t id) const
+		{
+			return std::make_tuple((*_blocks)[id].size, (*_blocks)[id].offset, id);
+		}
+
+	public:
+		static const char *name() { return "best-fit"; }
+
+		void attach(const std::vector<simulated_block> *blocks) { _blocks = blocks; }
+		void insert(uint32_t id) { _free.insert(entry(id)); }
+		void remove(uint32_t id) { _free.erase(entry(id)); }
+
+		uint32_t find(uint64_t need) const
+		{
+			auto it = _free.lower_bound(std::make_tuple(need, uint64_t(0), uint32_t(0)));
+			return it == _free.end() ? NO_BLOCK : std::get<2>(*it);
+		}
+
+		uint64_t largest() const { return _free.empty() ? 0 : std::get<0>(*_free.rbegin()); }
+	};
+
+
+	// Power of two size classes, best fit inside the request's own class and
+	// the smallest block of the next non empty class above it.
+	class simulated_segregated_fit
+	{
+		static constexpr size_t CLASSES = 64;
+
+		const std::vector<simulated_block> *_blocks = nullptr;
+		std::set<std::tuple<uint64_t, uint64_t, uint32_t>> _classes[CLASSES];
+		uint64_t _non_empty = 0;
+
+		static size_t class_of(uint64_t size) { return size == 0 ? 0 : 63 - static_cast<size_t>(__builtin_clzll(size)); }
+
+		std::tuple<uint64_t, uint64_t, uint32_t> entry(uint32_t id) const
+		{
+			return std::make_tuple((*_blocks)[id].size, (*_blocks)[id].offset, id);
+		}
+
+	public:
+		static const char *name() { return "segregated"; }
+
+		void attach(const std::vector<simulated_block> *blocks) { _blocks = blocks; }
+
+		void insert(uint32_t id)
+		{
+			const size_t c = class_of((*_blocks)[id].size);
+			_classes[c].insert(entry(id));
+			_non_empty |= uint64_t(1) << c;
+		}
+
+		void remove(uint32_t id)
+		{
+			const size_t c = class_of((*_blocks)[id].size);
+			_classes[c].erase(entry(id));
+			if (_classes[c].empty())
+				_non_empty &= ~(uint64_t(1) << c);
+		}
+
+		uint32_t find(uint64_t need) const
+		{
+			const size_t c = class_of(need);
+			auto it = _classes[c].lower_bound(std::make_tuple(need, uint64_t(0), uint32_t(0)));
+			if (it != _classes[c].end())
+				return std::get<2>(*it);
+
+			const uint64_t above = c + 1 < CLASSES ? _non_empty & (~uint64_t(0) << (c + 1)) : 0;
+			if (above == 0)
+				return NO_BLOCK;
+			return std::get<2>(*_classes[__builtin_ctzll(above)].begin());
+		}
+
+		uint64_t largest() const
+		{
+			if (_non_empty == 0)
+				return 0;
+			return std::get<0>(*_classes[63 - __builtin_clzll(_non_empty)].rbegin());
+		}
+	};
+
+
+	// Two level segregated fit: log2 first level, 16 linear second level
+	// classes, LIFO lists and bitmaps. The request is rounded up to the next
+	// class so whatever list head is found fits, an O(1) good fit.
+	class simulated_tlsf
+	{
+		static constexpr unsigned SL_LOG2 = 4;
+		static constexpr unsigned SL_COUNT = 1u << SL_LOG2;
+		static constexpr unsigned FL_COUNT = 64;
+
+		std::vector<simulated_block> *_blocks = nullptr;
+		uint32_t _heads[FL_COUNT][SL_COUNT];
+		uint64_t _fl_bitmap = 0;
+		uint32_t _sl_bitmap[FL_COUNT] = {};
+
+		static unsigned log2_of(uint64_t v) { return 63 - static_cast<unsigned>(__builtin_clzll(v)); }
+
+		static void mapping(uint64_t size, unsigned &fl, unsigned &sl)
+		{
+			if (size < SL_COUNT)
+			{
+				fl = 0;
+				sl = static_cast<unsigned>(size);
+			}
+			else
+			{
+				const unsigned l = log2_of(size);
+				sl = static_cast<unsigned>(size >> (l - SL_LOG2)) ^ SL_COUNT;
+				fl = l - SL_LOG2 + 1;
+			}
+		}
+
+	public:
+		simulated_tlsf()
+		{
+			for (auto &fl : _heads)
+				for (auto &head : fl)
+					head = NO_BLOCK;
+		}
+
+		static const char *name() { return "tlsf"; }
+
+		// TLSF links its free lists through the blocks
+		void attach(std::vector<simulated_block> *blocks) { _blocks = blocks; }
+
+		void insert(uint32_t id)
+		{
+			unsigned fl, sl;
+			mapping((*_blocks)[id].size, fl, sl);
+			simulated_block &b = (*_blocks)[id];
+			b.list_prev = NO_BLOCK;
+			b.list_next = _heads[fl][sl];
+			if (b.list_next != NO_BLOCK)
+				(*_blocks)[b.list_next].list_prev = id;
+			_heads[fl][sl] = id;
+			_fl_bitmap |= uint64_t(1) << fl;
+			_sl_bitmap[fl] |= 1u << sl;
+		}
+
+		void remove(uint32_t id)
+		{
+			unsigned fl, sl;
+			mapping((*_blocks)[id].size, fl, sl);
+			simulated_block &b = (*_blocks)[id];
+			if (b.list_prev != NO_BLOCK)
+				(*_blocks)[b.list_prev].list_next = b.list_next;
+			else
+				_heads[fl][sl] = b.list_next;
+			if (b.list_next != NO_BLOCK)
+				(*_blocks)[b.list_next].list_prev = b.list_prev;
+
+			if (_heads[fl][sl] == NO_BLOCK)
+			{
+				_sl_bitmap[fl] &= ~(1u << sl);
+				if (_sl_bitmap[fl] == 0)
+					_fl_bitmap &= ~(uint64_t(1) << fl);
+			}
+		}
+
+		uint32_t find(uint64_t need) const
+		{
+			if (need >= SL_COUNT)
+			{
+				const uint64_t round = (uint64_t(1) << (log2_of(need) - SL_LOG2)) - 1;
+				if (need + round < need)
+					return NO_BLOCK;
+				need += round;
+			}
+
+			unsigned fl, sl;
+			mapping(need, fl, sl);
+			if (fl >= FL_COUNT)
+				return NO_BLOCK;
+
+			uint32_t sl_map = _sl_bitmap[fl] & (~0u << sl);
+			if (sl_map == 0)
+			{
+				const uint64_t fl_map = fl + 1 < FL_COUNT ? _fl_bitmap & (~uint64_t(0) << (fl + 1)) : 0;
+				if (fl_map == 0)
+					return NO_BLOCK;
+				fl = static_cast<unsigned>(__builtin_ctzll(fl_map));
+				sl_map = _sl_bitmap[fl];
+			}
+
+			return _heads[fl][__builtin_ctz(sl_map)];
+		}
+
+		uint64_t largest() const
+		{
+			if (_fl_bitmap == 0)
+				return 0;
+			const unsigned fl = log2_of(_fl_bitmap);
+			uint64_t result = 0;
+			for (uint32_t id = _heads[fl][log2_of(_sl_bitmap[fl])]; id != NO_BLOCK; id = (*_blocks)[id].list_next)
+				result = std::max(result, (*_blocks)[id].size);
+			return result;
+		}
+	};
+
+
+	template<typename FIT>
+	class simulated_heap
+	{
+	public:
+		static constexpr uint64_t HEADER = basic_memory_pool<>::ALIGNED_HEADER_SIZE;
+		static constexpr uint64_t ALIGNMENT_MASK = basic_memory_pool<>::ALIGNMENT_MASK;
+
+	private:
+		std::vector<simulated_block> _blocks;
+		std::vector<uint32_t> _recycled;
+		FIT _fit;
+		uint64_t _free_bytes = 0;
+
+		uint32_t new_block()
+		{
+			if (false == _recycled.empty())
+			{
+				const uint32_t id = _recycled.back();
+				_recycled.pop_back();
+				return id;
+			}
+			_blocks.push_back(simulated_block());
+			// the policies hold a pointer to the vector, not to its elements
+			return static_cast<uint32_t>(_blocks.size() - 1);
+		}
+
+	public:
+		using handle = uint32_t;
+		static constexpr handle NONE = NO_BLOCK;
+
+		explicit simulated_heap(size_t pool_size)
+		{
+			_blocks.reserve(1024);
+			_fit.attach(&_blocks);
+			const uint32_t id = new_block();
+			_blocks[id] = { 0, pool_size - HEADER, NO_BLOCK, NO_BLOCK, NO_BLOCK, NO_BLOCK, false };
+			_free_bytes = pool_size - HEADER;
+			_fit.insert(id);
+		}
+
+		static const char *name() { return FIT::name(); }
+
+		handle allocate(uint64_t size, uint64_t &end)
+		{
+			size = (size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+			const uint32_t id = _fit.find(size + HEADER);
+			if (id == NO_BLOCK)
+				return NONE;
+
+			_fit.remove(id);
+			const uint64_t remaining = _blocks[id].size - size - HEADER;
+
+			const uint32_t rest = new_block();
+			simulated_block &b = _blocks[id];
+			_blocks[rest] = { b.offset + HEADER + size, remaining, id, b.next, NO_BLOCK, NO_BLOCK, false };
+			if (b.next != NO_BLOCK)
+				_blocks[b.next].prev = rest;
+			b.next = rest;
+			b.size = size;
+			b.allocated = true;
+			_fit.insert(rest);
+
+			_free_bytes -= size + HEADER;
+			end = b.offset + HEADER + size;
+			return id;
+		}
+
+		void deallocate(handle id)
+		{
+			simulated_block *b = &_blocks[id];
+			b->allocated = false;
+			_free_bytes += b->size;
+
+			const uint32_t next = b->next;
+			if (next != NO_BLOCK && false == _blocks[next].allocated)
+			{
+				_fit.remove(next);
+				b->size += _blocks[next].size + HEADER;
+				b->next = _blocks[next].next;
+				if (b->next != NO_BLOCK)
+					_blocks[b->next].prev = id;
+				_recycled.push_back(next);
+				_free_bytes += HEADER;
+			}
+
+			const uint32_t prev = b->prev;
+			if (prev != NO_BLOCK && false == _blocks[prev].allocated)
+			{
+				_fit.remove(prev);
+				simulated_block &p = _blocks[prev];
+				p.size += b->size + HEADER;
+				p.next = b->next;
+				if (p.next != NO_BLOCK)
+					_blocks[p.next].prev = prev;
+				_recycled.push_back(id);
+				_free_bytes += HEADER;
+				id = prev;
+			}
+
+			_fit.insert(id);
+		}
+
+		uint64_t largest_free() const { return _fit.largest(); }
+		uint64_t free_bytes() const { return _free_bytes; }
+	};
+
+
+	// Binary buddy allocator over the largest power of two that fits the pool,
+	// blocks carry the same header as basic_memory_pool.
+	class simulated_buddy_heap
+	{
+		static constexpr unsigned MIN_ORDER = 5;
+
+		unsigned _max_order;
+		std::vector<std::set<uint64_t>> _free;
+		std::vector<uint8_t> _orders;
+		std::vector<uint64_t> _offsets;
+		std::vector<uint32_t> _recycled;
+		uint64_t _free_bytes;
+
+		static unsigned order_for(uint64_t size)
+		{
+			const unsigned order = size <= 1 ? 0 : 64 - static_cast<unsigned>(__builtin_clzll(size - 1));
+			return order < MIN_ORDER ? MIN_ORDER : order;
+		}
+
+	public:
+		static constexpr uint64_t HEADER = basic_memory_pool<>::ALIGNED_HEADER_SIZE;
+		using handle = uint32_t;
+		static constexpr handle NONE = NO_BLOCK;
+
+		explicit simulated_buddy_heap(size_t pool_size)
+			: _max_order(63 - static_cast<unsigned>(__builtin_clzll(pool_size))),
+			_free(_max_order + 1),
+			_free_bytes(uint64_t(1) << _max_order)
+		{
+			_free[_max_order].insert(0);
+		}
+
+		static const char *name() { return "buddy"; }
+
+		handle allocate(uint64_t size, uint64_t &end)
+		{
+			const unsigned order = order_for(size + HEADER);
+			unsigned k = order;
+			while (k <= _max_order && _free[k].empty())
+				++k;
+			if (k > _max_order)
+				return NONE;
+
+			const uint64_t offset = *_free[k].begin();
+			_free[k].erase(_free[k].begin());
+			while (k > order)
+			{
+				--k;
+				_free[k].insert(offset + (uint64_t(1) << k));
+			}
+
+			uint32_t id;
+			if (_recycled.empty())
+			{
+				id = static_cast<uint32_t>(_offsets.size());
+				_offsets.push_back(offset);
+				_orders.push_back(static_cast<uint8_t>(order));
+			}
+			else
+			{
+				id = _recycled.back();
+				_recycled.pop_back();
+				_offsets[id] = offset;
+				_orders[id] = static_cast<uint8_t>(order);
+			}
+
+			_free_bytes -= uint64_t(1) << order;
+			end = offset + HEADER + size;
+			return id;
+		}
+
+		void deallocate(handle id)
+		{
+			uint64_t offset = _offsets[id];
+			unsigned order = _orders[id];
+			_recycled.push_back(id);
+			_free_bytes += uint64_t(1) << order;
+
+			while (order < _max_order)
+			{
+				const uint64_t buddy = offset ^ (uint64_t(1) << order);
+				auto it = _free[order].find(buddy);
+				if (it == _free[order].end())
+					break;
+				_free[order].erase(it);
+				offset = std::min(offset, buddy);
+				++order;
+			}
+			_free[order].insert(offset);
+		}
+
+		uint64_t largest_free() const
+		{
+			for (unsigned k = _max_order + 1; k-- > 0; )
+			{
+				if (false == _free[k].empty())
+					return uint64_t(1) << k;
+			}
+			return 0;
+		}
+
+		uint64_t free_bytes() const { return _free_bytes; }
+	};
+
+
+	// Dense ids for the blocks of a trace: each allocate gets the lowest free
+	// slot, its deallocate refers to the same slot and NO_BLOCK marks a
+	// deallocate of something the trace never allocated. Computed once, it
+	// saves every simulation from hashing recorded pointers.
+	struct trace_slots
+	{
+		std::vector<uint32_t> slot;
+		uint32_t count = 0;
+
+		trace_slots(const trace_record *records, size_t n)
+			: slot(n, NO_BLOCK)
+		{
+			std::unordered_map<uint64_t, uint32_t> live;
+			std::vector<uint32_t> recycled;
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (records[i].op == trace_op::allocate)
+				{
+					uint32_t s;
+					if (recycled.empty())
+						s = count++;
+					else
+					{
+						s = recycled.back();
+						recycled.pop_back();
+					}
+					live[records[i].pointer] = s;
+					slot[i] = s;
+				}
+				else
+				{
+					auto it = live.find(records[i].pointer);
+					if (it != live.end())
+					{
+						slot[i] = it->second;
+						recycled.push_back(it->second);
+						live.erase(it);
+					}
+				}
+			}
+		}
+	};
+
+
+	// Runs records (in timestamp order) through a HEAP of pool_size bytes.
+	template<typename HEAP>
+	simulation_result simulate(const trace_record *records, const trace_slots &slots, size_t count, size_t pool_size, size_t samples = 32)
+	{
+		HEAP heap(pool_size);
+		simulation_result result;
+		result.pool_size = pool_size;
+
+		struct live_block
+		{
+			typename HEAP::handle handle = HEAP::NONE;
+			uint64_t size = 0;
+		};
+		std::vector<live_block> live(slots.count);
+		size_t live_bytes = 0;
+
+		const size_t interval = std::max<size_t>(1, count / std::max<size_t>(1, samples));
+		result.fragmentation.reserve(samples + 1);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const trace_record &rec = records[i];
+			const uint32_t slot = slots.slot[i];
+
+			if (rec.op == trace_op::allocate)
+			{
+				uint64_t end = 0;
+				const typename HEAP::handle h = rec.size + HEAP::HEADER <= pool_size ? heap.allocate(rec.size, end) : HEAP::NONE;
+				live[slot].handle = h;
+				if (h == HEAP::NONE)
+				{
+					if (result.first_failure < 0)
+					{
+						result.first_failure = static_cast<int64_t>(i);
+						result.first_failure_size = rec.size;
+					}
+					++result.failures;
+				}
+				else
+				{
+					live[slot].size = rec.size;
+					live_bytes += rec.size;
+					result.peak_live_bytes = std::max(result.peak_live_bytes, live_bytes);
+					result.peak_footprint = std::max<size_t>(result.peak_footprint, end);
+				}
+			}
+			else if (slot != NO_BLOCK && live[slot].handle != HEAP::NONE)
+			{
+				heap.deallocate(live[slot].handle);
+				live_bytes -= live[slot].size;
+				live[slot].handle = HEAP::NONE;
+			}
+			++result.operations;
+
+			if ((i + 1) % interval == 0)
+			{
+				const uint64_t free_bytes = heap.free_bytes();
+				const double fragmentation = free_bytes == 0 ? 0.0 : 1.0 - double(heap.largest_free()) / double(free_bytes);
+				result.fragmentation.push_back(fragmentation);
+				result.max_fragmentation = std::max(result.max_fragmentation, fragmentation);
+			}
+		}
+
+		return result;
+	}
+
+	template<typename HEAP>
+	simulation_result simulate(const trace_record *records, size_t count, size_t pool_size, size_t samples = 32)
+	{
+		return simulate<HEAP>(records, trace_slots(records, count), count, pool_size, samples);
+	}
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ss
+{
+	// Snapshot returned by basic_memory_pool::stats(). The block walk fields are
+	// always filled in, the counters and histograms only with a stats policy
+	// that records them.
+	struct pool_stats
+	{
+		// histogram bucket i counts values in (2^(i-1), 2^i], bucket 0 counts 0 and 1
+		static constexpr size_t SIZE_BUCKETS = 48;
+		static constexpr size_t SEARCH_BUCKETS = 32;
+
+		// from walking the block list
+		size_t bytes_in_use = 0;
+		size_t live_blocks = 0;
+		size_t free_bytes = 0;
+		size_t free_blocks = 0;
+		size_t largest_free_block = 0;
+		// 1 - largest_free_block / free_bytes, 0 when all free memory is one block
+		double fragmentation = 0.0;
+
+		// from the stats policy
+		size_t peak_bytes_in_use = 0;
+		uint64_t allocations = 0;
+		uint64_t deallocations = 0;
+		uint64_t failed_allocations = 0;
+		// blocks inspected by all searches, / (allocations + failed_allocations) for the mean
+		uint64_t probes = 0;
+
+		// from the FIT policy, see bounded_fit and quick_fit
+		uint64_t probe_limit_hits = 0;
+		uint64_t fallback_allocations = 0;
+		// freed blocks held back from the list, not counted as live
+		size_t deferred_blocks = 0;
+		std::array<uint64_t, SIZE_BUCKETS> request_sizes = {};
+		std::array<uint64_t, SEARCH_BUCKETS> search_lengths = {};
+
+		static size_t bucket_of(uint64_t value) noexcept
+		{
+			if (value <= 1)
+				return 0;
+#if defined(__GNUC__)
+			const size_t bucket = 64 - static_cast<size_t>(__builtin_clzll(value - 1));
+#else
+			size_t bucket = 0;
+			while ((uint64_t(1) << bucket) < value)
+				++bucket;
+#endif
+			return bucket < SIZE_BUCKETS ? bucket : SIZE_BUCKETS - 1;
+		}
+	};
+
+
+	// Default stats policy, records nothing and compiles away. on_allocate()
+	// gets the size the caller asked for and the size of the block that holds
+	// it, on_deallocate() only the block size.
+	struct null_stats
+	{
+		static constexpr bool enabled = false;
+
+		void on_allocate(const void *, size_t, size_t, size_t) noexcept {}
+		void on_failed_allocate(size_t, size_t) noexcept {}
+		void on_deallocate(const void *, size_t) noexcept {}
+		void collect(pool_stats &) const noexcept {}
+		void reset() noexcept {}
+	};
+
+
+	// Stats policy with counters striped over SLOTS cache line sized slots, a
+	// thread always updates the same slot so threads only share one when there
+	// are more than SLOTS of them. Counters are relaxed atomics, collect() can
+	// run while other threads allocate and sees each counter at some recent value.
+	template<size_t SLOTS = 16>
+	class per_thread_stats
+	{
+		struct alignas(64) slot
+		{
+			std::atomic<uint64_t> allocations{ 0 };
+			std::atomic<uint64_t> deallocations{ 0 };
+			std::atomic<uint64_t> failed_allocations{ 0 };
+			std::atomic<uint64_t> probes{ 0 };
+			std::array<std::atomic<uint64_t>, pool_stats::SIZE_BUCKETS> request_sizes{};
+			std::array<std::atomic<uint64_t>, pool_stats::SEARCH_BUCKETS> search_lengths{};
+		};
+
+		std::array<slot, SLOTS> _slots;
+
+		// bytes in use and its peak need one global view
+		alignas(64) std::atomic<size_t> _in_use{ 0 };
+		std::atomic<size_t> _peak{ 0 };
+
+		static slot &local(std::array<slot, SLOTS> &slots) noexcept
+		{
+			static std::atomic<size_t> next_slot{ 0 };
+			thread_local const size_t index = next_slot.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+			return slots[index];
+		}
+
+		static void bump(std::atomic<uint64_t> &counter) noexcept
+		{
+			counter.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		static size_t search_bucket(size_t probes) noexcept
+		{
+			const size_t bucket = pool_stats::bucket_of(probes);
+			return bucket < pool_stats::SEARCH_BUCKETS ? bucket : pool_stats::SEARCH_BUCKETS - 1;
+		}
+
+	public:
+		static constexpr bool enabled = true;
+
+		void on_allocate(const void *, size_t size, size_t block_size, size_t probes) noexcept
+		{
+			slot &s = local(_slots);
+			bump(s.allocations);
+			bump(s.request_sizes[pool_stats::bucket_of(size)]);
+			bump(s.search_lengths[search_bucket(probes)]);
+			s.probes.fetch_add(probes, std::memory_order_relaxed);
+
+			// in block sizes, as on_deallocate() takes them back
+			const size_t in_use = _in_use.fetch_add(block_size, std::memory_order_relaxed) + block_size;
+			size_t peak = _peak.load(std::memory_order_relaxed);
+			while (in_use > peak && false == _peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		void on_failed_allocate(size_t size, size_t probes) noexcept
+		{
+			slot &s = local(_slots);
+			bump(s.failed_allocations);
+			bump(s.request_sizes[pool_stats::bucket_of(size)]);
+			bump(s.search_lengths[search_bucket(probes)]);
+			s.probes.fetch_add(probes, std::memory_order_relaxed);
+		}
+
+		void on_deallocate(const void *, size_t size) noexcept
+		{
+			bump(local(_slots).deallocations);
+			_in_use.fetch_sub(size, std::memory_order_relaxed);
+		}
+
+		void collect(pool_stats &out) const noexcept
+		{
+			for (const slot &s : _slots)
+			{
+				out.allocations += s.allocations.load(std::memory_order_relaxed);
+				out.deallocations += s.deallocations.load(std::memory_order_relaxed);
+				out.failed_allocations += s.failed_allocations.load(std::memory_order_relaxed);
+				out.probes += s.probes.load(std::memory_order_relaxed);
+				for (size_t i = 0; i < pool_stats::SIZE_BUCKETS; ++i)
+					out.request_sizes[i] += s.request_sizes[i].load(std::memory_order_relaxed);
+				for (size_t i = 0; i < pool_stats::SEARCH_BUCKETS; ++i)
+					out.search_lengths[i] += s.search_lengths[i].load(std::memory_order_relaxed);
+			}
+			out.peak_bytes_in_use = _peak.load(std::memory_order_relaxed);
+		}
+
+		void reset() noexcept
+		{
+			for (slot &s : _slots)
+			{
+				s.allocations.store(0, std::memory_order_relaxed);
+				s.deallocations.store(0, std::memory_order_relaxed);
+				s.failed_allocations.store(0, std::memory_order_relaxed);
+				s.probes.store(0, std::memory_order_relaxed);
+				for (auto &c : s.request_sizes)
+					c.store(0, std::memory_order_relaxed);
+				for (auto &c : s.search_lengths)
+					c.store(0, std::memory_order_relaxed);
+			}
+			_in_use.store(0, std::memory_order_relaxed);
+			_peak.store(0, std::memory_order_relaxed);
+		}
+	};
+}
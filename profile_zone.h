@@ -0,0 +1,288 @@
+#pragma once
+
+#include "timer.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// SS_PROFILE_ZONE("name") records the enclosing scope as a zone when the
+// build defines SS_PROFILE_ZONES (cmake -DSS_PROFILE_ZONES=ON) and expands to
+// nothing otherwise. name must outlive the export, a string literal.
+#if defined(SS_PROFILE_ZONES)
+#define SS_PROFILE_CONCAT_INNER(a, b) a##b
+#define SS_PROFILE_CONCAT(a, b) SS_PROFILE_CONCAT_INNER(a, b)
+#define SS_PROFILE_ZONE(name) ::ss::profile_zone SS_PROFILE_CONCAT(ss_profile_zone_, __LINE__)(name)
+#else
+#define SS_PROFILE_ZONE(name) static_cast<void>(0)
+#endif
+
+namespace ss
+{
+	// Process wide store of zone begin and end events. Every thread appends to
+	// its own buffer of fixed size chunks and publishes each event with a
+	// release store of its count, so recording takes no lock and an export can
+	// read the buffers while threads keep recording. A thread that has used up
+	// MAX_EVENTS drops further events and counts them.
+	class zone_profiler
+	{
+	public:
+		static constexpr size_t CHUNK_EVENTS = 1 << 14;
+		static constexpr size_t MAX_CHUNKS = 256;
+		static constexpr size_t MAX_EVENTS = CHUNK_EVENTS * MAX_CHUNKS;
+
+	private:
+		struct event
+		{
+			uint64_t ticks;
+			const char *name;
+			char phase;
+		};
+
+		struct thread_buffer
+		{
+			std::array<std::atomic<event*>, MAX_CHUNKS> chunks{};
+			std::atomic<size_t> count{ 0 };
+			std::atomic<uint64_t> dropped{ 0 };
+			std::atomic<const char*> name{ nullptr };
+			uint32_t thread = 0;
+
+			~thread_buffer()
+			{
+				for (auto &chunk : chunks)
+					delete[] chunk.load(std::memory_order_relaxed);
+			}
+		};
+
+		std::mutex _mutex;
+		std::vector<std::unique_ptr<thread_buffer>> _buffers;
+		const uint64_t _base_ticks = tsc_clock::now();
+
+		struct thread_state
+		{
+			thread_buffer *buffer = nullptr;
+			// set while the profiler allocates, a pool behind the global operator
+			// new with zones of its own must not record into a half made buffer
+			bool reentered = false;
+		};
+
+		static thread_state &local() noexcept
+		{
+			thread_local thread_state state;
+			return state;
+		}
+
+		thread_buffer *local_buffer(thread_state &state) noexcept
+		{
+			if (state.buffer == nullptr)
+			{
+				state.reentered = true;
+				try
+				{
+					std::unique_ptr<thread_buffer> b(new thread_buffer());
+					std::lock_guard<std::mutex> lock(_mutex);
+					b->thread = static_cast<uint32_t>(_buffers.size());
+					state.buffer = b.get();
+					_buffers.push_back(std::move(b));
+				}
+				catch (...)
+				{
+				}
+				state.reentered = false;
+			}
+			return state.buffer;
+		}
+
+		static void write_escaped(std::ostream &out, const char *s)
+		{
+			for (; *s != '\0'; ++s)
+			{
+				if (*s == '"' || *s == '\\')
+					out << '\\' << *s;
+				else if (static_cast<unsigned char>(*s) < 0x20)
+					out << ' ';
+				else
+					out << *s;
+			}
+		}
+
+	public:
+		static zone_profiler &get_instance() noexcept
+		{
+			static zone_profiler instance;
+			return instance;
+		}
+
+		// Any program recording zones leaves its trace in $SS_PROFILE_OUTPUT
+		// when that is set, the test and benchmark drivers included.
+		~zone_profiler()
+		{
+			const char *path = std::getenv("SS_PROFILE_OUTPUT");
+			if (path == nullptr || _buffers.empty())
+				return;
+			try
+			{
+				write_chrome_trace(std::string(path));
+			}
+			catch (...)
+			{
+			}
+		}
+
+		// phase is 'B' or 'E' as in the Chrome trace event format
+		void record(const char *name, char phase) noexcept
+		{
+			thread_state &state = local();
+			if (state.reentered)
+				return;
+
+			thread_buffer *b = local_buffer(state);
+			if (b == nullptr)
+				return;
+
+			const size_t n = b->count.load(std::memory_order_relaxed);
+			const size_t chunk = n / CHUNK_EVENTS;
+			if (chunk >= MAX_CHUNKS)
+			{
+				b->dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			event *events = b->chunks[chunk].load(std::memory_order_relaxed);
+			if (events == nullptr)
+			{
+				state.reentered = true;
+				events = new (std::nothrow) event[CHUNK_EVENTS];
+				state.reentered = false;
+				if (events == nullptr)
+				{
+					b->dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				b->chunks[chunk].store(events, std::memory_order_release);
+			}
+
+			events[n % CHUNK_EVENTS] = { tsc_clock::now(), name, phase };
+			b->count.store(n + 1, std::memory_order_release);
+		}
+
+		// Names the calling thread in the export, name must outlive it.
+		void set_thread_name(const char *name) noexcept
+		{
+			thread_buffer *b = local_buffer(local());
+			if (b != nullptr)
+				b->name.store(name, std::memory_order_relaxed);
+		}
+
+		size_t events() noexcept
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			size_t n = 0;
+			for (auto &b : _buffers)
+				n += b->count.load(std::memory_order_acquire);
+			return n;
+		}
+
+		uint64_t dropped() noexcept
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			uint64_t n = 0;
+			for (auto &b : _buffers)
+				n += b->dropped.load(std::memory_order_relaxed);
+			return n;
+		}
+
+		// Forgets recorded events, keeping the buffers. Only while no thread
+		// records.
+		void clear() noexcept
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (auto &b : _buffers)
+			{
+				b->count.store(0, std::memory_order_relaxed);
+				b->dropped.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		// Writes every event recorded so far in the Chrome trace event format,
+		// which chrome://tracing, Perfetto and speedscope open.
+		void write_chrome_trace(std::ostream &out)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			local().reentered = true;
+
+			const double ticks_per_us = tsc_clock::ticks_per_ns() * 1000.0;
+			out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+			bool first = true;
+			char ts[32];
+			for (auto &b : _buffers)
+			{
+				const char *name = b->name.load(std::memory_order_relaxed);
+				if (name != nullptr)
+				{
+					out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->thread
+						<< ",\"args\":{\"name\":\"";
+					write_escaped(out, name);
+					out << "\"}}";
+					first = false;
+				}
+
+				const size_t count = b->count.load(std::memory_order_acquire);
+				for (size_t i = 0; i < count; ++i)
+				{
+					const event &e = b->chunks[i / CHUNK_EVENTS].load(std::memory_order_acquire)[i % CHUNK_EVENTS];
+					const uint64_t ticks = e.ticks > _base_ticks ? e.ticks - _base_ticks : 0;
+					std::snprintf(ts, sizeof(ts), "%.3f", double(ticks) / ticks_per_us);
+
+					out << (first ? "" : ",") << "\n{\"name\":\"";
+					write_escaped(out, e.name);
+					out << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << b->thread << "}";
+					first = false;
+				}
+			}
+			out << "]}\n";
+
+			local().reentered = false;
+		}
+
+		void write_chrome_trace(const std::string &path)
+		{
+			std::ofstream out(path, std::ios::binary);
+			if (false == out.good())
+				throw std::runtime_error("cannot open profile file " + path);
+			write_chrome_trace(out);
+		}
+	};
+
+
+	// Records a begin event now and the matching end event when it goes out
+	// of scope. Use through SS_PROFILE_ZONE so the switch can remove it.
+	class profile_zone
+	{
+		const char *_name;
+
+	public:
+		explicit profile_zone(const char *name) noexcept : _name(name)
+		{
+			zone_profiler::get_instance().record(_name, 'B');
+		}
+
+		~profile_zone()
+		{
+			zone_profiler::get_instance().record(_name, 'E');
+		}
+
+		profile_zone(const profile_zone&) = delete;
+		profile_zone &operator=(const profile_zone&) = delete;
+	};
+}
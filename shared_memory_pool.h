@@ -0,0 +1,517 @@
+#pragma once
+
+#include "basic_memory_pool.h"
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ss
+{
+	// Pool living in a shm_open, memfd_create or file mapping that several
+	// processes can map at the same time, each at its own address. The segment
+	// starts with a control block holding a process shared robust mutex, the
+	// offset of a user root object and the basic_memory_pool, whose links are
+	// all relative, followed by the pool buffer. Blocks are handed between
+	// processes as offsets into the segment, see offset_of() and from_offset().
+	//
+	// A file backed segment outlives the process: a restarted process maps it
+	// with open_file() and finds the block list and root() as they were at the
+	// last sync().
+	//
+	// A create_private() segment can be snapshotted, see snapshot().
+	//
+	// A process dying while it holds the lock may leave the block list half
+	// relinked. The next locker takes the pool over only if validate() finds
+	// the list intact, counted by recoveries(); otherwise the pool is
+	// poisoned() and allocate() and deallocate() fail from then on.
+	template<size_t ALIGNMENT = std::alignment_of<uintptr_t>()>
+	class shared_memory_pool
+	{
+	public:
+		using pool_t = basic_memory_pool<ALIGNMENT>;
+		using offset_t = uint64_t;
+
+		static constexpr offset_t null_offset = 0;
+
+	private:
+		// "shmpool2", the last byte is the segment layout version
+		static constexpr uint64_t MAGIC = 0x326c6f6f706d6873ull;
+		static constexpr size_t ALIGNMENT_MASK = pool_t::ALIGNMENT_MASK;
+
+		struct segment_header
+		{
+			std::atomic<uint64_t> magic;
+			uint64_t size;
+			offset_t root;
+			pthread_mutex_t mutex;
+			// the lock was taken over from a dead owner with the block list broken
+			uint32_t poisoned;
+			// or intact
+			uint32_t recoveries;
+			// create_private(), attach() refuses it
+			uint32_t process_private;
+			pool_t pool;
+		};
+
+		static constexpr size_t SEGMENT_HEADER_SIZE = (sizeof(segment_header) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+		int _fd = -1;
+		segment_header *_segment = nullptr;
+		size_t _size = 0;
+
+		// create_private() pools, only those can be snapshotted
+		bool _private = false;
+		// set once snapshot() has remapped this view MAP_PRIVATE
+		bool _private_view = false;
+		// snapshots of the pool still mapped, shared with the snapshots themselves
+		std::shared_ptr<std::atomic<int>> _snapshots;
+		bool _is_snapshot = false;
+
+		class scoped_lock
+		{
+			pthread_mutex_t *_mutex;
+
+		public:
+			explicit scoped_lock(segment_header *segment) : _mutex(&segment->mutex)
+			{
+				// a process died holding the lock, possibly halfway through an
+				// allocate() or deallocate(): only an intact block list is adopted
+				if (pthread_mutex_lock(_mutex) == EOWNERDEAD)
+				{
+					if (segment->pool.validate())
+						++segment->recoveries;
+					else
+						segment->poisoned = 1;
+					pthread_mutex_consistent(_mutex);
+				}
+			}
+
+			~scoped_lock()
+			{
+				pthread_mutex_unlock(_mutex);
+			}
+		};
+
+		[[noreturn]] static void fail(const char *what)
+		{
+			throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+		}
+
+		static void poisoned_error(bool throw_exception)
+		{
+			static const char *what = "shared memory pool left broken by a process that died holding its lock";
+			if (throw_exception)
+				throw std::runtime_error(what);
+			std::cerr << what << std::endl;
+		}
+
+		shared_memory_pool(int fd, size_t size, bool initialize, int map_flags = MAP_SHARED)
+			: _fd(fd), _size(size)
+		{
+			void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, map_flags, fd, 0);
+			if (p == MAP_FAILED)
+			{
+				::close(fd);
+				fail("mmap");
+			}
+			_segment = static_cast<segment_header*>(p);
+
+			if (initialize)
+			{
+				_segment->size = size;
+				_segment->root = null_offset;
+				_segment->poisoned = 0;
+				_segment->recoveries = 0;
+				_segment->process_private = 0;
+
+				init_mutex(&_segment->mutex);
+
+				new (&_segment->pool) pool_t();
+				_segment->pool.init(reinterpret_cast<uint8_t*>(_segment) + SEGMENT_HEADER_SIZE, size - SEGMENT_HEADER_SIZE);
+
+				// published last, openers check it before touching anything else
+				_segment->magic.store(MAGIC, std::memory_order_release);
+			}
+			else if (_segment->magic.load(std::memory_order_acquire) != MAGIC || _segment->size != size)
+			{
+				close();
+				throw std::runtime_error("shared memory segment does not hold an initialized pool");
+			}
+		}
+
+		static void init_mutex(pthread_mutex_t *mutex)
+		{
+			pthread_mutexattr_t attr;
+			pthread_mutexattr_init(&attr);
+			pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+			pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+			pthread_mutex_init(mutex, &attr);
+			pthread_mutexattr_destroy(&attr);
+		}
+
+		// Copies the pages this private view has written since it was mapped
+		// back into the segment. /proc/self/pagemap tells them apart, they are
+		// anonymous while untouched ones are still file pages. Without pagemap
+		// the whole view is written back.
+		void write_back_private_pages()
+		{
+			const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			const size_t num_pages = (_size + page - 1) / page;
+			uint8_t *base = reinterpret_cast<uint8_t*>(_segment);
+
+			static constexpr uint64_t PAGE_PRESENT = 1ull << 63;
+			static constexpr uint64_t PAGE_SWAPPED = 1ull << 62;
+			static constexpr uint64_t PAGE_FILE = 1ull << 61;
+			static constexpr size_t BATCH = 512;
+
+			const int pagemap = ::open("/proc/self/pagemap", O_RDONLY);
+			std::vector<uint64_t> entries(BATCH);
+
+			for (size_t first = 0; first < num_pages; first += BATCH)
+			{
+				const size_t count = std::min(BATCH, num_pages - first);
+				const off_t entry_offset = static_cast<off_t>((reinterpret_cast<uintptr_t>(base) / page + first) * sizeof(uint64_t));
+				const bool have_entries = pagemap >= 0 &&
+					pread(pagemap, entries.data(), count * sizeof(uint64_t), entry_offset) == static_cast<ssize_t>(count * sizeof(uint64_t));
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					const uint64_t e = entries[i];
+					const bool dirty = false == have_entries ||
+						(e & PAGE_SWAPPED) != 0 || ((e & PAGE_PRESENT) != 0 && (e & PAGE_FILE) == 0);
+					if (false == dirty)
+						continue;
+
+					const size_t offset = (first + i) * page;
+					const size_t length = std::min(page, _size - offset);
+					if (pwrite(_fd, base + offset, length, static_cast<off_t>(offset)) != static_cast<ssize_t>(length))
+					{
+						if (pagemap >= 0)
+							::close(pagemap);
+						fail("pwrite");
+					}
+				}
+			}
+
+			if (pagemap >= 0)
+				::close(pagemap);
+		}
+
+		static size_t segment_size(int fd)
+		{
+			struct stat st;
+			if (fstat(fd, &st) != 0)
+			{
+				::close(fd);
+				fail("fstat");
+			}
+			return static_cast<size_t>(st.st_size);
+		}
+
+		static void resize(int fd, size_t size)
+		{
+			if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+			{
+				::close(fd);
+				fail("ftruncate");
+			}
+		}
+
+		void close() noexcept
+		{
+			if (_segment != nullptr)
+				munmap(_segment, _size);
+			if (_fd >= 0)
+				::close(_fd);
+			if (_is_snapshot)
+				_snapshots->fetch_sub(1, std::memory_order_release);
+			_snapshots.reset();
+			_is_snapshot = false;
+			_segment = nullptr;
+			_fd = -1;
+			_size = 0;
+		}
+
+	public:
+
+		// Creates the named segment, fails if it already exists.
+		static shared_memory_pool create(const std::string &name, size_t size)
+		{
+			assert(size > SEGMENT_HEADER_SIZE + pool_t::ALIGNED_HEADER_SIZE);
+			const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd < 0)
+				fail("shm_open");
+			resize(fd, size);
+			return shared_memory_pool(fd, size, true);
+		}
+
+		// Maps a segment created by another process with create().
+		static shared_memory_pool open(const std::string &name)
+		{
+			const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+			if (fd < 0)
+				fail("shm_open");
+			return shared_memory_pool(fd, segment_size(fd), false);
+		}
+
+		static void unlink(const std::string &name) noexcept
+		{
+			shm_unlink(name.c_str());
+		}
+
+		// Creates a file backed segment, fails if the file already exists.
+		static shared_memory_pool create_file(const std::string &path, size_t size)
+		{
+			assert(size > SEGMENT_HEADER_SIZE + pool_t::ALIGNED_HEADER_SIZE);
+			const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (fd < 0)
+				fail("open");
+			resize(fd, size);
+			return shared_memory_pool(fd, size, true);
+		}
+
+		// Maps a segment file written by create_file(), in this or an earlier process.
+		static shared_memory_pool open_file(const std::string &path)
+		{
+			const int fd = ::open(path.c_str(), O_RDWR);
+			if (fd < 0)
+				fail("open");
+			return shared_memory_pool(fd, segment_size(fd), false);
+		}
+
+		// Warm restart entry point, a fresh pool has no root().
+		static shared_memory_pool open_or_create_file(const std::string &path, size_t size)
+		{
+			if (::access(path.c_str(), F_OK) == 0)
+				return open_file(path);
+			return create_file(path, size);
+		}
+
+		// Creates an unnamed segment, share it by fork() or by passing fd()
+		// over a unix socket and calling attach() on the other side.
+		static shared_memory_pool create_anonymous(size_t size)
+		{
+			assert(size > SEGMENT_HEADER_SIZE + pool_t::ALIGNED_HEADER_SIZE);
+			const int fd = memfd_create("ss::shared_memory_pool", 0);
+			if (fd < 0)
+				fail("memfd_create");
+			resize(fd, size);
+			return shared_memory_pool(fd, size, true);
+		}
+
+		// Creates an unnamed segment for this process alone, the only kind
+		// snapshot() accepts. attach() refuses it and it must not be used
+		// across fork(): snapshots remap this view MAP_PRIVATE, after which
+		// no other mapping would see its writes.
+		static shared_memory_pool create_private(size_t size)
+		{
+			shared_memory_pool pool = create_anonymous(size);
+			pool._segment->process_private = 1;
+			pool._private = true;
+			return pool;
+		}
+
+		// Maps the segment behind fd, the descriptor is duplicated.
+		static shared_memory_pool attach(int fd)
+		{
+			const int own_fd = dup(fd);
+			if (own_fd < 0)
+				fail("dup");
+			shared_memory_pool pool(own_fd, segment_size(own_fd), false);
+			if (pool._segment->process_private)
+				throw std::runtime_error("a create_private() pool can't be attached");
+			return pool;
+		}
+
+		shared_memory_pool(shared_memory_pool &&other) noexcept
+			: _fd(other._fd), _segment(other._segment), _size(other._size),
+			_private(other._private), _private_view(other._private_view),
+			_snapshots(std::move(other._snapshots)), _is_snapshot(other._is_snapshot)
+		{
+			other._fd = -1;
+			other._segment = nullptr;
+			other._size = 0;
+			other._is_snapshot = false;
+		}
+
+		shared_memory_pool &operator=(shared_memory_pool &&other) noexcept
+		{
+			if (this != &other)
+			{
+				close();
+				std::swap(_fd, other._fd);
+				std::swap(_segment, other._segment);
+				std::swap(_size, other._size);
+				std::swap(_private, other._private);
+				std::swap(_private_view, other._private_view);
+				std::swap(_snapshots, other._snapshots);
+				std::swap(_is_snapshot, other._is_snapshot);
+			}
+			return *this;
+		}
+
+		shared_memory_pool(const shared_memory_pool&) = delete;
+		shared_memory_pool &operator=(const shared_memory_pool&) = delete;
+
+		~shared_memory_pool()
+		{
+			close();
+		}
+
+		void *allocate(size_t requested_size, bool throw_exception = false)
+		{
+			scoped_lock lock(_segment);
+			if (_segment->poisoned)
+			{
+				poisoned_error(throw_exception);
+				return nullptr;
+			}
+			return _segment->pool.allocate(requested_size, throw_exception);
+		}
+
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			scoped_lock lock(_segment);
+			if (_segment->poisoned)
+			{
+				poisoned_error(throw_exception);
+				return;
+			}
+			_segment->pool.deallocate(p, throw_exception);
+		}
+
+		// Point in time copy-on-write view of a create_private() pool, block
+		// list and root included. The snapshot is a pool of its own: it can be
+		// read from another thread while this pool keeps changing, or written to
+		// speculatively, without either side seeing the other's writes.
+		//
+		// Both views end up as MAP_PRIVATE mappings of the same memfd, which is
+		// left untouched from then on, so taking a snapshot costs page table work
+		// plus writing back the pages dirtied since the previous snapshot, never
+		// a copy of the whole pool. In exchange this view becomes private to the
+		// process, which is why pools other processes may map are refused. The
+		// previous snapshot must be gone before the next one is taken. Writers
+		// must not touch pool memory while snapshot() runs.
+		shared_memory_pool snapshot()
+		{
+			SS_PROFILE_ZONE("ss::snapshot");
+
+			if (false == _private || _is_snapshot)
+				throw std::runtime_error("snapshot() needs a pool created with create_private()");
+
+			if (_snapshots == nullptr)
+				_snapshots = std::make_shared<std::atomic<int>>(0);
+			else if (_snapshots->load(std::memory_order_acquire) != 0)
+				throw std::runtime_error("the previous snapshot is still mapped");
+
+			const int fd = dup(_fd);
+			if (fd < 0)
+				fail("dup");
+
+			{
+				scoped_lock lock(_segment);
+
+				if (_private_view)
+					write_back_private_pages();
+
+				// drop the private pages, this view now reads the frozen memfd
+				if (mmap(_segment, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, _fd, 0) == MAP_FAILED)
+				{
+					::close(fd);
+					fail("mmap");
+				}
+				_private_view = true;
+			}
+
+			shared_memory_pool view(fd, _size, false, MAP_PRIVATE);
+			// the memfd holds the mutex as locked by us, the snapshot gets a fresh one
+			init_mutex(&view._segment->mutex);
+			view._is_snapshot = true;
+			view._snapshots = _snapshots;
+			_snapshots->fetch_add(1, std::memory_order_acq_rel);
+			return view;
+		}
+
+		// Writes the segment back to its file, the checkpoint a restart sees.
+		void sync(bool asynchronous = false)
+		{
+			if (msync(_segment, _size, asynchronous ? MS_ASYNC : MS_SYNC) != 0)
+				fail("msync");
+		}
+
+		void set_root(void *p)
+		{
+			scoped_lock lock(_segment);
+			_segment->root = offset_of(p);
+		}
+
+		void *root() const noexcept
+		{
+			return from_offset(_segment->root);
+		}
+
+		offset_t offset_of(const void *p) const noexcept
+		{
+			return p == nullptr ? null_offset :
+				static_cast<offset_t>(static_cast<const uint8_t*>(p) - reinterpret_cast<const uint8_t*>(_segment));
+		}
+
+		void *from_offset(offset_t offset) const noexcept
+		{
+			return offset == null_offset ? nullptr : reinterpret_cast<uint8_t*>(_segment) + offset;
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept
+		{
+			return _segment->pool.is_inside_pool(addr);
+		}
+
+		// Calls f(const pool_t&) with the segment locked, for block walks such as
+		// stats() or write_heap_json() that must not race with other processes.
+		template<typename FUNCTION>
+		void inspect(FUNCTION f) const
+		{
+			scoped_lock lock(_segment);
+			f(static_cast<const pool_t&>(_segment->pool));
+		}
+
+		int fd() const noexcept { return _fd; }
+		size_t size() const noexcept { return _size; }
+		void *base() const noexcept { return _segment; }
+
+		// true once a dead process left the block list broken, see the class comment
+		bool poisoned() const
+		{
+			scoped_lock lock(_segment);
+			return _segment->poisoned != 0;
+		}
+
+		// times the lock was taken over from a dead process with the pool intact
+		uint32_t recoveries() const
+		{
+			scoped_lock lock(_segment);
+			return _segment->recoveries;
+		}
+
+		const size_t allocated() const
+		{
+			scoped_lock lock(_segment);
+			return _segment->pool.allocated();
+		}
+
+		const size_t deallocated() const
+		{
+			scoped_lock lock(_segment);
+			return _segment->pool.deallocated();
+		}
+	};
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "chunk_source.h"
+#include "pool_policies.h"
+#include "size_classes.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace ss
+{
+	// Segregated storage over SIZE_CLASSES: every class has its own slabs,
+	// carved in address order and recycled through an intrusive free list,
+	// so a block never needs a header. The caller passes the size back on
+	// deallocate, as with sized delete or std::allocator; a pointer outside
+	// the slabs or a size of another class is reported to ON_ERROR.
+	//
+	// allocate<SIZE>() and deallocate<SIZE>(p) resolve the class at compile
+	// time and come down to a list pop or push; allocate(size) pays for one
+	// size_class_table::lookup(). Like static_memory_pool it takes no lock.
+	// ON_ERROR handles failed calls, see pool_policies.h.
+	template<typename SIZE_CLASSES = size_class_table<>, size_t SLAB_SIZE = (1 << 16), typename CHUNK_SOURCE = mmap_chunk_source,
+		typename ON_ERROR = log_error>
+	class size_class_pool
+	{
+	public:
+		using size_classes = SIZE_CLASSES;
+		static constexpr size_t CLASSES = SIZE_CLASSES::CLASSES;
+		static constexpr size_t MAX_SIZE = SIZE_CLASSES::MAX_SIZE;
+		static constexpr size_t ALIGNMENT = SIZE_CLASSES::QUANTUM;
+		static constexpr size_t ALIGNMENT_MASK = ALIGNMENT - 1;
+		// slabs of the large classes grow to hold at least this many blocks
+		static constexpr size_t MIN_BLOCKS_PER_SLAB = 8;
+
+		static_assert(ALIGNMENT >= sizeof(void*), "QUANTUM must hold a free list link");
+
+	private:
+		struct free_block
+		{
+			free_block *next;
+		};
+
+		// at the start of every slab
+		struct slab
+		{
+			slab *next;
+			size_t size;
+			size_t size_class;
+		};
+
+		static constexpr size_t SLAB_HEADER_SIZE = (sizeof(slab) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+		struct bin
+		{
+			free_block *free = nullptr;
+			// the untouched rest of the class's newest slab
+			uint8_t *bump = nullptr;
+			uint8_t *bump_end = nullptr;
+		};
+
+		std::array<bin, CLASSES> _bins;
+		slab *_slabs = nullptr;
+		size_t _num_slabs = 0;
+		size_t _capacity = 0;
+
+		size_t _allocated = 0;
+		size_t _deallocated = 0;
+
+		static size_t slab_size(size_t c) noexcept
+		{
+			const size_t page = CHUNK_SOURCE::page_size();
+			const size_t needed = SLAB_HEADER_SIZE + MIN_BLOCKS_PER_SLAB * SIZE_CLASSES::size_of(c);
+			return std::max(SLAB_SIZE, (needed + page - 1) / page * page);
+		}
+
+		bool add_slab(size_t c) noexcept
+		{
+			const size_t size = slab_size(c);
+			void *memory = CHUNK_SOURCE::acquire(size);
+			if (memory == nullptr)
+				return false;
+
+			slab *s = static_cast<slab*>(memory);
+			s->next = _slabs;
+			s->size = size;
+			s->size_class = c;
+			_slabs = s;
+			++_num_slabs;
+			_capacity += size;
+
+			const size_t block = SIZE_CLASSES::size_of(c);
+			bin &b = _bins[c];
+			b.bump = static_cast<uint8_t*>(memory) + SLAB_HEADER_SIZE;
+			b.bump_end = b.bump + (size - SLAB_HEADER_SIZE) / block * block;
+			return true;
+		}
+
+		void *allocate_class(size_t c, bool throw_exception)
+		{
+			bin &b = _bins[c];
+			const size_t block = SIZE_CLASSES::size_of(c);
+			void *result;
+			if (b.free != nullptr)
+			{
+				result = b.free;
+				b.free = b.free->next;
+			}
+			else if (b.bump != b.bump_end || add_slab(c))
+			{
+				result = b.bump;
+				b.bump += block;
+			}
+			else
+			{
+				ON_ERROR::exhausted(block, throw_exception);
+				return nullptr;
+			}
+
+			_allocated += block;
+			return result;
+		}
+
+		// the slab holding addr, nullptr outside the pool
+		const slab *find_slab(uintptr_t addr) const noexcept
+		{
+			for (const slab *s = _slabs; s != nullptr; s = s->next)
+			{
+				const uintptr_t start = reinterpret_cast<uintptr_t>(s);
+				if (addr >= start + SLAB_HEADER_SIZE && addr < start + s->size)
+					return s;
+			}
+			return nullptr;
+		}
+
+		// c is CLASSES for a size no class holds, no slab matches it
+		void deallocate_class(size_t c, void *p, bool throw_exception)
+		{
+			if (p == nullptr)
+				return;
+
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+			const slab *s = find_slab(addr);
+			if (s == nullptr)
+			{
+				ON_ERROR::invalid_pointer(pool_error::outside_pool, p, throw_exception);
+				return;
+			}
+
+			if (s->size_class != c)
+			{
+				ON_ERROR::invalid_pointer(pool_error::wrong_size, p, throw_exception);
+				return;
+			}
+
+			// not the start of a block, or past the part of the slab handed out so far
+			const bin &b = _bins[c];
+			const uintptr_t offset = addr - reinterpret_cast<uintptr_t>(s) - SLAB_HEADER_SIZE;
+			if (offset % SIZE_CLASSES::size_of(c) != 0 ||
+				(addr >= reinterpret_cast<uintptr_t>(b.bump) && addr < reinterpret_cast<uintptr_t>(b.bump_end)))
+			{
+				ON_ERROR::invalid_pointer(pool_error::not_allocated, p, throw_exception);
+				return;
+			}
+
+			free_block *f = static_cast<free_block*>(p);
+			f->next = _bins[c].free;
+			_bins[c].free = f;
+			_deallocated += SIZE_CLASSES::size_of(c);
+		}
+
+	public:
+		size_class_pool() = default;
+		size_class_pool(const size_class_pool&) = delete;
+		size_class_pool &operator=(const size_class_pool&) = delete;
+
+		~size_class_pool()
+		{
+			release();
+		}
+
+		static size_class_pool &get_instance() noexcept
+		{
+			static size_class_pool instance;
+			return instance;
+		}
+
+		// returns every slab upstream, outstanding pointers become invalid
+		void release() noexcept
+		{
+			while (_slabs != nullptr)
+			{
+				slab *next = _slabs->next;
+				CHUNK_SOURCE::release(_slabs, _slabs->size);
+				_slabs = next;
+			}
+			_bins = {};
+			_num_slabs = 0;
+			_capacity = 0;
+			_allocated = 0;
+			_deallocated = 0;
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept
+		{
+			return find_slab(addr) != nullptr;
+		}
+
+		template<size_t SIZE>
+		void *allocate(bool throw_exception = false)
+		{
+			static_assert(SIZE > 0 && SIZE <= MAX_SIZE, "SIZE has no size class");
+			return allocate_class(std::integral_constant<size_t, SIZE_CLASSES::class_of(SIZE)>::value, throw_exception);
+		}
+
+		template<size_t SIZE>
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			static_assert(SIZE > 0 && SIZE <= MAX_SIZE, "SIZE has no size class");
+			deallocate_class(std::integral_constant<size_t, SIZE_CLASSES::class_of(SIZE)>::value, p, throw_exception);
+		}
+
+		void *allocate(size_t requested_size, bool throw_exception = false)
+		{
+			if (requested_size == 0)
+				return nullptr;
+
+			const size_t c = SIZE_CLASSES::lookup(requested_size);
+			if (c == CLASSES)
+			{
+				ON_ERROR::too_large(requested_size, MAX_SIZE, throw_exception);
+				return nullptr;
+			}
+			return allocate_class(c, throw_exception);
+		}
+
+		// size as passed to allocate()
+		void deallocate(void *p, size_t size, bool throw_exception = false)
+		{
+			deallocate_class(SIZE_CLASSES::lookup(size), p, throw_exception);
+		}
+
+		// in whole class sizes
+		const size_t allocated() const noexcept { return _allocated; }
+		const size_t deallocated() const noexcept { return _deallocated; }
+		const size_t num_slabs() const noexcept { return _num_slabs; }
+		const size_t capacity() const noexcept { return _capacity; }
+	};
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ss
+{
+	namespace detail
+	{
+		constexpr bool is_power_of_two(size_t x)
+		{
+			return x != 0 && (x & (x - 1)) == 0;
+		}
+
+		constexpr size_t log2(size_t x)
+		{
+			size_t n = 0;
+			while (x > 1)
+			{
+				x >>= 1;
+				++n;
+			}
+			return n;
+		}
+
+		template<size_t QUANTUM, size_t LINEAR_LIMIT, size_t STEPS_PER_DOUBLING, size_t MAX_SIZE, size_t CLASSES, size_t LOOKUP_ENTRIES>
+		struct size_class_tables
+		{
+			size_t sizes[CLASSES];
+			// class of sizes in ((i - 1) * QUANTUM, i * QUANTUM]
+			uint8_t lookup[LOOKUP_ENTRIES];
+
+			constexpr size_class_tables() : sizes(), lookup()
+			{
+				size_t c = 0;
+				for (size_t size = QUANTUM; size <= LINEAR_LIMIT; size += QUANTUM)
+					sizes[c++] = size;
+				for (size_t base = LINEAR_LIMIT; base < MAX_SIZE; base *= 2)
+					for (size_t step = 1; step <= STEPS_PER_DOUBLING; ++step)
+						sizes[c++] = base + step * (base / STEPS_PER_DOUBLING);
+
+				c = 0;
+				for (size_t i = 0; i < LOOKUP_ENTRIES; ++i)
+				{
+					while (sizes[c] < i * QUANTUM)
+						++c;
+					lookup[i] = static_cast<uint8_t>(c);
+				}
+			}
+		};
+	}
+
+
+	// Size classes generated at compile time: QUANTUM steps up to
+	// LINEAR_LIMIT, then STEPS_PER_DOUBLING classes between consecutive powers
+	// of two up to MAX_SIZE. The defaults give 16, 32, .. 128, 160, 192, 224,
+	// 256, 320, .. 64 KiB, at most 25% rounding waste above 128 bytes.
+	//
+	// class_of() is constexpr for sizes known at compile time, lookup() is
+	// the runtime version: a table load for small sizes and leading zero
+	// arithmetic above, both computed and one picked without a branch.
+	template<size_t QUANTUM_ = 16, size_t LINEAR_LIMIT = 128, size_t STEPS_PER_DOUBLING = 4, size_t MAX_SIZE_ = (1 << 16)>
+	class size_class_table
+	{
+		static_assert(detail::is_power_of_two(QUANTUM_), "QUANTUM must be a power of two");
+		static_assert(detail::is_power_of_two(LINEAR_LIMIT) && LINEAR_LIMIT >= QUANTUM_, "LINEAR_LIMIT must be a power of two of at least QUANTUM");
+		static_assert(detail::is_power_of_two(STEPS_PER_DOUBLING) && LINEAR_LIMIT / STEPS_PER_DOUBLING >= QUANTUM_,
+			"STEPS_PER_DOUBLING must be a power of two with steps of at least QUANTUM");
+		static_assert(detail::is_power_of_two(MAX_SIZE_) && MAX_SIZE_ >= LINEAR_LIMIT, "MAX_SIZE must be a power of two of at least LINEAR_LIMIT");
+
+	public:
+		static constexpr size_t QUANTUM = QUANTUM_;
+		static constexpr size_t MAX_SIZE = MAX_SIZE_;
+		static constexpr size_t LINEAR_CLASSES = LINEAR_LIMIT / QUANTUM;
+		static constexpr size_t CLASSES = LINEAR_CLASSES + (detail::log2(MAX_SIZE) - detail::log2(LINEAR_LIMIT)) * STEPS_PER_DOUBLING;
+		// sizes up to here are looked up in the table
+		static constexpr size_t LOOKUP_LIMIT = MAX_SIZE < 4096 ? MAX_SIZE : 4096;
+		static constexpr size_t LOOKUP_ENTRIES = LOOKUP_LIMIT / QUANTUM + 1;
+
+		static_assert(CLASSES < 256, "class indices are stored as uint8_t");
+
+		using tables = detail::size_class_tables<QUANTUM_, LINEAR_LIMIT, STEPS_PER_DOUBLING, MAX_SIZE_, CLASSES, LOOKUP_ENTRIES>;
+
+		static constexpr tables TABLES = tables();
+
+		static constexpr size_t size_of(size_t c)
+		{
+			return TABLES.sizes[c];
+		}
+
+		// CLASSES for sizes above MAX_SIZE
+		static constexpr size_t class_of(size_t size)
+		{
+			for (size_t c = 0; c < CLASSES; ++c)
+				if (TABLES.sizes[c] >= size)
+					return c;
+			return CLASSES;
+		}
+
+		// class_of() at runtime
+		static size_t lookup(size_t size) noexcept
+		{
+			// all ones for table sizes, the select below is masking, not a jump
+			const size_t small = size_t(0) - static_cast<size_t>(size <= LOOKUP_LIMIT);
+			const size_t table_class = TABLES.lookup[((size & small) + QUANTUM - 1) / QUANTUM];
+
+			// x in [2^lg, 2^(lg + 1)) falls in step (x >> (lg - log2(STEPS))) - STEPS of
+			// that doubling; or-ing LINEAR_LIMIT keeps the shift positive for small sizes
+			const uint64_t x = (uint64_t(size) - 1) | LINEAR_LIMIT;
+			const size_t lg = 63 - static_cast<size_t>(__builtin_clzll(x));
+			const size_t step = static_cast<size_t>(x >> (lg - detail::log2(STEPS_PER_DOUBLING))) & (STEPS_PER_DOUBLING - 1);
+			const size_t log_class = LINEAR_CLASSES + (lg - detail::log2(LINEAR_LIMIT)) * STEPS_PER_DOUBLING + step;
+
+			const size_t c = (table_class & small) | (log_class & ~small);
+			return c < CLASSES ? c : CLASSES;
+		}
+	};
+
+	template<size_t QUANTUM_, size_t LINEAR_LIMIT, size_t STEPS_PER_DOUBLING, size_t MAX_SIZE_>
+	constexpr typename size_class_table<QUANTUM_, LINEAR_LIMIT, STEPS_PER_DOUBLING, MAX_SIZE_>::tables
+		size_class_table<QUANTUM_, LINEAR_LIMIT, STEPS_PER_DOUBLING, MAX_SIZE_>::TABLES;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "static_memory_pool.h"
+#include "size_classes.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace ss
+{
+	// Small objects without headers on top of a static_memory_pool. Spans of
+	// SPAN_SIZE bytes are carved from the pool, each holding objects of one
+	// of SIZE_CLASSES, and a flat page map indexed by
+	// (addr - buffer_start()) >> PAGE_SHIFT leads from any object to its
+	// span, so deallocate() needs no size and finds the span in O(1).
+	// Requests above SIZE_CLASSES::MAX_SIZE go to the pool itself, pages
+	// without a span mark their blocks.
+	//
+	// The pool's blocks only have its own alignment, so a span asks for a
+	// page more and starts on the first page boundary inside; only its
+	// whole pages are mapped. A span that becomes empty goes back to the
+	// pool unless it is its class's last one, so a workload oscillating
+	// around one span doesn't carve and return it on every call. Like
+	// static_memory_pool it takes no lock.
+	//
+	// An object freed twice in a row is reported to ON_ERROR, as are frees
+	// into a span with no live objects; like quick_fit it cannot tell an
+	// older free object from a live one.
+	template<size_t POOL_SIZE, typename SIZE_CLASSES = size_class_table<16, 128, 4, 1024>, size_t SPAN_SIZE = (1 << 16),
+		size_t PAGE_SHIFT = 12, typename POOL = static_memory_pool<POOL_SIZE, SIZE_CLASSES::QUANTUM>, typename ON_ERROR = log_error>
+	class span_pool
+	{
+	public:
+		using pool_t = POOL;
+		using size_classes = SIZE_CLASSES;
+		static constexpr size_t CLASSES = SIZE_CLASSES::CLASSES;
+		static constexpr size_t MAX_SIZE = SIZE_CLASSES::MAX_SIZE;
+		static constexpr size_t ALIGNMENT = SIZE_CLASSES::QUANTUM;
+		static constexpr size_t ALIGNMENT_MASK = ALIGNMENT - 1;
+		static constexpr size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
+		static constexpr size_t PAGES = (POOL_SIZE + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+		static_assert(SPAN_SIZE % PAGE_SIZE == 0, "SPAN_SIZE must be whole pages");
+		static_assert(ALIGNMENT >= sizeof(void*), "QUANTUM must hold a free list link");
+
+	private:
+		struct free_object
+		{
+			free_object *next;
+		};
+
+		// at the start of every span
+		struct span
+		{
+			// in its class's list of spans with room
+			span *next;
+			span *prev;
+			// what the pool handed out
+			void *block;
+			free_object *free;
+			uint8_t *bump;
+			uint8_t *bump_end;
+			size_t size_class;
+			size_t live;
+		};
+
+		static constexpr size_t SPAN_HEADER_SIZE = (sizeof(span) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+	public:
+		static_assert(SPAN_SIZE >= SPAN_HEADER_SIZE + MAX_SIZE, "SPAN_SIZE holds no object of the largest class");
+
+	private:
+		struct bin
+		{
+			span *partial = nullptr;
+			size_t spans = 0;
+		};
+
+		POOL _pool;
+		std::array<span*, PAGES> _page_map = {};
+		std::array<bin, CLASSES> _bins;
+		size_t _num_spans = 0;
+
+		size_t page_of(const void *p) const noexcept
+		{
+			return (reinterpret_cast<uintptr_t>(p) - _pool.buffer_start()) >> PAGE_SHIFT;
+		}
+
+		void map(span *s, span *value) noexcept
+		{
+			const size_t first = page_of(s);
+			for (size_t page = first; page < first + SPAN_SIZE / PAGE_SIZE; ++page)
+				_page_map[page] = value;
+		}
+
+		void push_partial(span *s) noexcept
+		{
+			bin &b = _bins[s->size_class];
+			s->prev = nullptr;
+			s->next = b.partial;
+			if (b.partial != nullptr)
+				b.partial->prev = s;
+			b.partial = s;
+		}
+
+		void remove_partial(span *s) noexcept
+		{
+			if (s->prev != nullptr)
+				s->prev->next = s->next;
+			else
+				_bins[s->size_class].partial = s->next;
+			if (s->next != nullptr)
+				s->next->prev = s->prev;
+		}
+
+		span *add_span(size_t c, bool throw_exception)
+		{
+			void *block = _pool.allocate(SPAN_SIZE + PAGE_SIZE, throw_exception);
+			if (block == nullptr)
+				return nullptr;
+
+			const uintptr_t start = _pool.buffer_start();
+			const uintptr_t aligned = start + ((reinterpret_cast<uintptr_t>(block) - start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+			span *s = reinterpret_cast<span*>(aligned);
+			s->block = block;
+			s->free = nullptr;
+			s->bump = reinterpret_cast<uint8_t*>(aligned) + SPAN_HEADER_SIZE;
+			s->bump_end = s->bump + (SPAN_SIZE - SPAN_HEADER_SIZE) / SIZE_CLASSES::size_of(c) * SIZE_CLASSES::size_of(c);
+			s->size_class = c;
+			s->live = 0;
+
+			map(s, s);
+			push_partial(s);
+			++_bins[c].spans;
+			++_num_spans;
+			return s;
+		}
+
+		void remove_span(span *s)
+		{
+			remove_partial(s);
+			map(s, nullptr);
+			--_bins[s->size_class].spans;
+			--_num_spans;
+			_pool.deallocate(s->block);
+		}
+
+		void *allocate_class(size_t c, bool throw_exception)
+		{
+			span *s = _bins[c].partial;
+			if (s == nullptr && (s = add_span(c, throw_exception)) == nullptr)
+				return nullptr;
+
+			void *result;
+			if (s->free != nullptr)
+			{
+				result = s->free;
+				s->free = s->free->next;
+			}
+			else
+			{
+				result = s->bump;
+				s->bump += SIZE_CLASSES::size_of(c);
+			}
+
+			++s->live;
+			if (s->free == nullptr && s->bump == s->bump_end)
+				remove_partial(s);
+			return result;
+		}
+
+	public:
+		span_pool() = default;
+		span_pool(const span_pool&) = delete;
+		span_pool &operator=(const span_pool&) = delete;
+
+		static span_pool &get_instance() noexcept
+		{
+			static span_pool instance;
+			return instance;
+		}
+
+		void *allocate(size_t requested_size, bool throw_exception = false)
+		{
+			if (requested_size == 0)
+				return nullptr;
+
+			const size_t c = SIZE_CLASSES::lookup(requested_size);
+			if (c == CLASSES)
+				return _pool.allocate((requested_size + ALIGNMENT_MASK) & ~ALIGNMENT_MASK, throw_exception);
+			return allocate_class(c, throw_exception);
+		}
+
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			span *s = p != nullptr && _pool.is_inside_pool(reinterpret_cast<uintptr_t>(p)) ? _page_map[page_of(p)] : nullptr;
+			if (s == nullptr)
+			{
+				_pool.deallocate(p, throw_exception);
+				return;
+			}
+
+			free_object *object = static_cast<free_object*>(p);
+			if (s->live == 0 || s->free == object)
+			{
+				ON_ERROR::invalid_pointer(pool_error::not_allocated, p, throw_exception);
+				return;
+			}
+
+			const bool was_full = s->free == nullptr && s->bump == s->bump_end;
+			object->next = s->free;
+			s->free = object;
+
+			if (was_full)
+				push_partial(s);
+			if (--s->live == 0 && _bins[s->size_class].spans > 1)
+				remove_span(s);
+		}
+
+		// returns every empty span to the pool
+		void trim()
+		{
+			for (bin &b : _bins)
+			{
+				span *s = b.partial;
+				while (s != nullptr)
+				{
+					span *next = s->next;
+					if (s->live == 0)
+						remove_span(s);
+					s = next;
+				}
+			}
+		}
+
+		// bytes usable at p for small objects, its class size; 0 for others
+		size_t usable_size(const void *p) const noexcept
+		{
+			const span *s = p != nullptr && _pool.is_inside_pool(reinterpret_cast<uintptr_t>(p)) ? _page_map[page_of(p)] : nullptr;
+			return s != nullptr ? SIZE_CLASSES::size_of(s->size_class) : 0;
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept { return _pool.is_inside_pool(addr); }
+
+		// the pool under the spans, large objects come from it
+		POOL &pool() noexcept { return _pool; }
+		const POOL &pool() const noexcept { return _pool; }
+
+		const size_t num_spans() const noexcept { return _num_spans; }
+	};
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include "chunk_source.h"
+#include "pool_policies.h"
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace ss
+{
+	// Fixed size slots for objects of type T, one singleton per type. Slots
+	// are carved from SLAB_SIZE slabs of CHUNK_SOURCE in address order and
+	// recycled through an intrusive free list, so allocate() and deallocate()
+	// are a pointer pop or push and objects of one type sit densely next to
+	// each other. LOCK guards every call, since pooled<T> sends each plain
+	// new T here; ON_ERROR handles failures, see pool_policies.h.
+	//
+	// Slabs stay until release(). The singleton is never destroyed, so
+	// objects freed by other static destructors at exit still find it.
+	template<typename T, size_t SLAB_SIZE = (1 << 16), typename CHUNK_SOURCE = mmap_chunk_source,
+		typename LOCK = spin_lock, typename ON_ERROR = log_error>
+	class static_object_pool
+	{
+	public:
+		static constexpr size_t ALIGNMENT = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+		static constexpr size_t ALIGNMENT_MASK = ALIGNMENT - 1;
+		static constexpr size_t SLOT_SIZE = ((sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+	private:
+		struct free_slot
+		{
+			free_slot *next;
+		};
+
+		// at the start of every slab
+		struct slab
+		{
+			slab *next;
+		};
+
+		static constexpr size_t SLAB_HEADER_SIZE = (sizeof(slab) + ALIGNMENT_MASK) & ~ALIGNMENT_MASK;
+
+	public:
+		static constexpr size_t SLOTS_PER_SLAB = (SLAB_SIZE - SLAB_HEADER_SIZE) / SLOT_SIZE;
+		static_assert(SLAB_SIZE > SLAB_HEADER_SIZE && SLOTS_PER_SLAB > 0, "SLAB_SIZE holds no object");
+
+	private:
+		free_slot *_free = nullptr;
+		// the untouched rest of the newest slab
+		uint8_t *_bump = nullptr;
+		uint8_t *_bump_end = nullptr;
+		slab *_slabs = nullptr;
+		size_t _num_slabs = 0;
+
+		size_t _allocated = 0;
+		size_t _deallocated = 0;
+
+		mutable LOCK _lock;
+
+		static_object_pool() = default;
+
+		bool add_slab() noexcept
+		{
+			void *memory = CHUNK_SOURCE::acquire(SLAB_SIZE);
+			if (memory == nullptr)
+				return false;
+			assert((reinterpret_cast<uintptr_t>(memory) & ALIGNMENT_MASK) == 0);
+
+			slab *s = static_cast<slab*>(memory);
+			s->next = _slabs;
+			_slabs = s;
+			++_num_slabs;
+
+			_bump = static_cast<uint8_t*>(memory) + SLAB_HEADER_SIZE;
+			_bump_end = _bump + SLOTS_PER_SLAB * SLOT_SIZE;
+			return true;
+		}
+
+		// the slab holding addr, nullptr outside the pool; the caller holds the lock
+		const slab *find_slab(uintptr_t addr) const noexcept
+		{
+			for (const slab *s = _slabs; s != nullptr; s = s->next)
+			{
+				const uintptr_t start = reinterpret_cast<uintptr_t>(s) + SLAB_HEADER_SIZE;
+				if (addr >= start && addr < start + SLOTS_PER_SLAB * SLOT_SIZE)
+					return s;
+			}
+			return nullptr;
+		}
+
+	public:
+		static_object_pool(const static_object_pool&) = delete;
+		static_object_pool &operator=(const static_object_pool&) = delete;
+
+		static static_object_pool &get_instance() noexcept
+		{
+			static typename std::aligned_storage<sizeof(static_object_pool), alignof(static_object_pool)>::type storage;
+			static static_object_pool *instance = new (&storage) static_object_pool();
+			return *instance;
+		}
+
+		// returns every slab upstream, outstanding pointers become invalid
+		void release() noexcept
+		{
+			std::lock_guard<LOCK> lock(_lock);
+			while (_slabs != nullptr)
+			{
+				slab *next = _slabs->next;
+				CHUNK_SOURCE::release(_slabs, SLAB_SIZE);
+				_slabs = next;
+			}
+			_num_slabs = 0;
+			_free = nullptr;
+			_bump = nullptr;
+			_bump_end = nullptr;
+			_allocated = 0;
+			_deallocated = 0;
+		}
+
+		bool is_inside_pool(uintptr_t addr) const noexcept
+		{
+			std::lock_guard<LOCK> lock(_lock);
+			return find_slab(addr) != nullptr;
+		}
+
+		// requested_size is only checked, every slot holds one T
+		void *allocate(size_t requested_size = sizeof(T), bool throw_exception = false)
+		{
+			if (requested_size == 0)
+				return nullptr;
+
+			if (requested_size > SLOT_SIZE)
+			{
+				ON_ERROR::too_large(requested_size, SLOT_SIZE, throw_exception);
+				return nullptr;
+			}
+
+			std::lock_guard<LOCK> lock(_lock);
+			void *result;
+			if (_free != nullptr)
+			{
+				result = _free;
+				_free = _free->next;
+			}
+			else if (_bump != _bump_end || add_slab())
+			{
+				result = _bump;
+				_bump += SLOT_SIZE;
+			}
+			else
+			{
+				ON_ERROR::exhausted(requested_size, throw_exception);
+				return nullptr;
+			}
+
+			_allocated += SLOT_SIZE;
+			return result;
+		}
+
+		void deallocate(void *p, bool throw_exception = false)
+		{
+			if (p == nullptr)
+				return;
+
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+			std::lock_guard<LOCK> lock(_lock);
+			const slab *s = find_slab(addr);
+			if (s == nullptr)
+			{
+				ON_ERROR::invalid_pointer(pool_error::outside_pool, p, throw_exception);
+				return;
+			}
+
+			// not the start of a slot, or past the slots handed out so far
+			if ((addr - reinterpret_cast<uintptr_t>(s) - SLAB_HEADER_SIZE) % SLOT_SIZE != 0 ||
+				(addr >= reinterpret_cast<uintptr_t>(_bump) && addr < reinterpret_cast<uintptr_t>(_bump_end)))
+			{
+				ON_ERROR::invalid_pointer(pool_error::not_allocated, p, throw_exception);
+				return;
+			}
+
+			free_slot *slot = static_cast<free_slot*>(p);
+			slot->next = _free;
+			_free = slot;
+			_deallocated += SLOT_SIZE;
+		}
+
+		// in whole slots
+		const size_t allocated() const noexcept { return _allocated; }
+		const size_t deallocated() const noexcept { return _deallocated; }
+		const size_t live_objects() const noexcept { return (_allocated - _deallocated) / SLOT_SIZE; }
+		const size_t num_slabs() const noexcept { return _num_slabs; }
+		const size_t capacity() const noexcept { return _num_slabs * SLAB_SIZE; }
+	};
+
+
+	// pool_tag of types whose make_pooled() default is their own
+	// static_object_pool, see pool_allocator.h
+	struct object_pool_tag {};
+
+	// Base that puts every new T into static_object_pool<T>:
+	//
+	//     struct particle : ss::pooled<particle> { ... };
+	//
+	// A derived class of a different size falls back to the global heap, its
+	// delete must then go through a virtual destructor for the size to match.
+	template<typename T>
+	class pooled
+	{
+	public:
+		using pool_tag = object_pool_tag;
+
+		static void *operator new(size_t size)
+		{
+			if (size != sizeof(T))
+				return ::operator new(size);
+			// ON_ERROR may return nullptr, operator new must not
+			void *p = static_object_pool<T>::get_instance().allocate(size, true);
+			if (p == nullptr)
+				throw std::bad_alloc();
+			return p;
+		}
+
+		static void operator delete(void *p, size_t size) noexcept
+		{
+			if (size != sizeof(T))
+				::operator delete(p);
+			else
+				static_object_pool<T>::get_instance().deallocate(p);
+		}
+
+	protected:
+		pooled() = default;
+		~pooled() = default;
+	};
+}
@@ -1,15 +1,60 @@
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "catch.hpp"
 
 #include "static_memory_pool.h"
+#include "pool_allocator.h"
+#include "size_class_pool.h"
+#include "span_pool.h"
+#include "pool_registry.h"
+#include "growable_memory_pool.h"
+#include "shared_memory_pool.h"
+#include "offset_ptr.h"
+#include "pool_stats.h"
+#include "allocation_trace.h"
+#include "pool_simulator.h"
+#include "heap_map.h"
+#include "heap_profiler.h"
+#include "timer.h"
+#include "profile_zone.h"
+#include "perf_counters.h"
+#include "bench_statistics.h"
 #include <memory>
 #include <cstdint>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <sys/wait.h>
+#include <thread>
 
 constexpr size_t POOL_SIZE = 1<<10;
 using namespace ss;
 
 using static_memory_pool_t = static_memory_pool<POOL_SIZE>;
 
+// pools with per_thread_stats are over-aligned, which plain new only honours from C++17 on
+template<typename T>
+struct aligned_deleter
+{
+	void operator()(T *p) const noexcept
+	{
+		p->~T();
+		std::free(p);
+	}
+};
+
+template<typename T>
+using aligned_ptr = std::unique_ptr<T, aligned_deleter<T>>;
+
+template<typename T>
+aligned_ptr<T> make_aligned()
+{
+	void *memory = nullptr;
+	if (posix_memalign(&memory, alignof(T), sizeof(T)) != 0)
+		throw std::bad_alloc();
+	return aligned_ptr<T>(new (memory) T());
+}
+
 
 struct something
 {
@@ -27,13 +72,16 @@ TEST_CASE("allocate 4 bytes", "[allocate]")
 	*x = 999;
 	const auto it = instance.free_list();
 
+	// blocks are whole ALIGNMENT units
+	const size_t block_size = alignof(uintptr_t);
 	REQUIRE(*x == 999);
-	REQUIRE(instance.allocated() == sizeof(int32_t));
+	REQUIRE(instance.allocated() == block_size);
 	REQUIRE(it->is_allocated() == true);
-	REQUIRE(it->get_size() == sizeof(int32_t));
+	REQUIRE(it->get_size() == block_size);
+	REQUIRE(reinterpret_cast<uintptr_t>(it->get_next()) % alignof(uintptr_t) == 0);
 
 	instance.deallocate((void*)x);
-	REQUIRE(instance.deallocated() == sizeof(int32_t));
+	REQUIRE(instance.deallocated() == block_size);
 	instance.reset();
 }
 
@@ -42,7 +90,7 @@ TEST_CASE("allocate struct", "[allocate]")
 {
 	auto &instance = static_memory_pool_t::get_instance();
 
-	something *st = (something *)instance.allocate(sizeof(something));
+	pooled_ptr<something, static_memory_pool_t> st = make_pooled<something, static_memory_pool_t>();
 	st->x = 3.0f;
 	st->y = 42.1f;
 	st->z = 918;
@@ -62,7 +110,7 @@ TEST_CASE("allocate struct", "[allocate]")
 	REQUIRE(st->v == std::vector<int>({ 1,2,3,4,5,6 }));
 
 
-	instance.deallocate((void*)st);
+	st.reset();
 	REQUIRE(instance.deallocated() == sizeof(something));
 	instance.reset();
 }
@@ -78,7 +126,7 @@ TEST_CASE("allocate multiple structs, deallocate in reverse order", "[allocate]"
 	std::vector<something*> somethings;
 	for (unsigned i = 0; i < N; ++i)
 	{
-		something *st = (something *)instance.allocate(sizeof(something));
+		something *st = new (instance.allocate(sizeof(something))) something;
 
 		st->x = 3.0f;
 		st->y = 42.1f;
@@ -110,6 +158,7 @@ TEST_CASE("allocate multiple structs, deallocate in reverse order", "[allocate]"
 	for (auto rit = somethings.rbegin(); rit != somethings.rend(); ++rit)
 	{
 		something *st = *rit;
+		st->~something();
 		instance.deallocate((void*)st);
 	}
 
@@ -135,7 +184,7 @@ TEST_CASE("allocate multiple structs, deallocate in original order", "[allocate]
 	std::vector<something*> somethings;
 	for (unsigned i = 0; i < N; ++i)
 	{
-		something *st = (something *)instance.allocate(sizeof(something));
+		something *st = new (instance.allocate(sizeof(something))) something;
 
 		st->x = 3.0f;
 		st->y = 42.1f;
@@ -167,6 +216,7 @@ TEST_CASE("allocate multiple structs, deallocate in original order", "[allocate]
 	for (auto it = somethings.begin(); it != somethings.end(); ++it)
 	{
 		something *st = *it;
+		st->~something();
 		instance.deallocate(st);
 	}
 
@@ -191,7 +241,7 @@ TEST_CASE("allocate multiple structs, deallocate half", "[allocate]")
     std::vector<something*> somethings;
     for (unsigned i = 0; i < N; ++i)
     {
-        something *st = (something *)instance.allocate(sizeof(something));
+        something *st = new (instance.allocate(sizeof(something))) something;
 
         st->x = 3.0f;
         st->y = 42.1f;
@@ -224,6 +274,7 @@ TEST_CASE("allocate multiple structs, deallocate half", "[allocate]")
     for (int i = 0; i < N/2; ++i)
     {
         something *st = somethings[i];
+        st->~something();
         instance.deallocate(st);
     }
 
@@ -233,7 +284,1836 @@ TEST_CASE("allocate multiple structs, deallocate half", "[allocate]")
     it = instance.free_list();
     REQUIRE(it->get_size() == 3*static_memory_pool_t::ALIGNED_HEADER_SIZE + 4*sizeof(something));
     REQUIRE(it->get_prev() == nullptr);
+
+    // reset() reuses the memory, the other half has to be destroyed first
+    for (size_t i = N/2; i < N; ++i)
+        somethings[i]->~something();
     instance.reset();
 }
 
 
+
+
+
+TEST_CASE("deallocate between free and allocated neighbours", "[allocate]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+
+	void *a = instance.allocate(64);
+	void *b = instance.allocate(64);
+	void *c = instance.allocate(64);
+	void *d = instance.allocate(64);
+
+	instance.deallocate(b);
+	instance.deallocate(c);
+
+	// b and c coalesce into one free block between a and d
+	auto *hdr_a = instance.free_list();
+	auto *hdr_b = hdr_a->get_next();
+	REQUIRE(hdr_b->is_allocated() == false);
+	REQUIRE(hdr_b->get_size() == 2*64 + static_memory_pool_t::ALIGNED_HEADER_SIZE);
+	REQUIRE(hdr_b->get_next()->is_allocated() == true);
+	REQUIRE(hdr_b->get_next()->get_prev() == hdr_b);
+
+	REQUIRE(instance.allocate(64 + 32) == b);
+
+	instance.deallocate(a);
+	instance.deallocate(d);
+	instance.reset();
+}
+
+
+using growable_memory_pool_t = growable_memory_pool<4096>;
+
+TEST_CASE("growable pool chains chunks", "[growable]")
+{
+	growable_memory_pool_t pool;
+
+	std::vector<void*> blocks;
+	for (unsigned i = 0; i < 64; ++i)
+	{
+		void *p = pool.allocate(256);
+		REQUIRE(p != nullptr);
+		std::memset(p, int(i), 256);
+		blocks.push_back(p);
+	}
+
+	REQUIRE(pool.num_chunks() > 1);
+	REQUIRE(pool.allocated() == 64 * 256);
+
+	for (unsigned i = 0; i < blocks.size(); ++i)
+	{
+		REQUIRE(pool.is_inside_pool(reinterpret_cast<uintptr_t>(blocks[i])));
+		REQUIRE(static_cast<uint8_t*>(blocks[i])[255] == uint8_t(i));
+	}
+
+	for (void *p : blocks)
+		pool.deallocate(p);
+
+	REQUIRE(pool.deallocated() == 64 * 256);
+	// all but one spare chunk are returned upstream
+	REQUIRE(pool.num_chunks() == 1);
+}
+
+
+TEST_CASE("growable pool serves requests larger than a chunk", "[growable]")
+{
+	growable_memory_pool_t pool;
+
+	void *small = pool.allocate(16);
+	void *large = pool.allocate(64 * 1024);
+	REQUIRE(small != nullptr);
+	REQUIRE(large != nullptr);
+	REQUIRE(pool.capacity() >= 64 * 1024);
+
+	pool.deallocate(large);
+	pool.deallocate(small);
+	REQUIRE(pool.num_chunks() == 1);
+}
+
+
+TEST_CASE("growable pool balances odd sized requests", "[growable]")
+{
+	growable_memory_pool_t pool;
+
+	void *a = pool.allocate(13);
+	void *b = pool.allocate(1);
+	REQUIRE(a != nullptr);
+	REQUIRE(b != nullptr);
+	REQUIRE(pool.allocated() >= 13 + 1);
+
+	pool.deallocate(a);
+	pool.deallocate(b);
+	REQUIRE(pool.allocated() == pool.deallocated());
+}
+
+
+using shared_memory_pool_t = shared_memory_pool<>;
+
+TEST_CASE("shared memory pool mapped at two addresses", "[shared]")
+{
+	auto writer = shared_memory_pool_t::create_anonymous(1 << 16);
+	auto reader = shared_memory_pool_t::attach(writer.fd());
+	REQUIRE(writer.base() != reader.base());
+
+	char *msg = static_cast<char*>(writer.allocate(64));
+	REQUIRE(msg != nullptr);
+	std::strcpy(msg, "zero copy");
+
+	const auto offset = writer.offset_of(msg);
+	char *seen = static_cast<char*>(reader.from_offset(offset));
+	REQUIRE(seen != msg);
+	REQUIRE(std::string(seen) == "zero copy");
+
+	// block list written through one mapping is walked through the other
+	void *second = reader.allocate(128);
+	REQUIRE(writer.offset_of(writer.from_offset(reader.offset_of(second))) == reader.offset_of(second));
+	reader.deallocate(seen);
+	writer.deallocate(writer.from_offset(reader.offset_of(second)));
+
+	REQUIRE(reader.allocated() == 64 + 128);
+	REQUIRE(writer.deallocated() == 64 + 128);
+}
+
+
+TEST_CASE("shared memory pool hands a block to another process", "[shared]")
+{
+	auto pool = shared_memory_pool_t::create_anonymous(1 << 16);
+	int *slot = static_cast<int*>(pool.allocate(sizeof(int)));
+	*slot = 0;
+	const auto slot_offset = pool.offset_of(slot);
+
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		auto child = shared_memory_pool_t::attach(pool.fd());
+		char *msg = static_cast<char*>(child.allocate(32));
+		std::strcpy(msg, "from child");
+		*static_cast<int*>(child.from_offset(slot_offset)) = static_cast<int>(child.offset_of(msg));
+		_exit(0);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	REQUIRE(WIFEXITED(status));
+	REQUIRE(*slot != 0);
+	REQUIRE(std::string(static_cast<char*>(pool.from_offset(*slot))) == "from child");
+	pool.deallocate(pool.from_offset(*slot));
+	pool.deallocate(slot);
+	REQUIRE(pool.allocated() == pool.deallocated());
+}
+
+
+TEST_CASE("shared memory pool checks the block list after its lock owner died", "[shared]")
+{
+	auto pool = shared_memory_pool_t::create_anonymous(1 << 16);
+	void *kept = pool.allocate(64);
+
+	// a child dies holding the lock with the pool intact
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		auto child = shared_memory_pool_t::attach(pool.fd());
+		child.inspect([](const shared_memory_pool_t::pool_t &) { _exit(0); });
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	REQUIRE(WIFEXITED(status));
+
+	void *after = pool.allocate(32);
+	REQUIRE(after != nullptr);
+	REQUIRE(pool.recoveries() == 1);
+	REQUIRE(false == pool.poisoned());
+	pool.deallocate(after);
+
+	// and one dies halfway through relinking a block
+	pid = fork();
+	if (pid == 0)
+	{
+		auto child = shared_memory_pool_t::attach(pool.fd());
+		child.inspect([](const shared_memory_pool_t::pool_t &p) { p.free_list()->set_size(8, true); _exit(0); });
+	}
+	waitpid(pid, &status, 0);
+	REQUIRE(WIFEXITED(status));
+
+	REQUIRE_THROWS_AS(pool.allocate(32, true), const std::runtime_error&);
+	REQUIRE(pool.poisoned());
+	REQUIRE(pool.recoveries() == 1);
+	REQUIRE_THROWS_AS(pool.deallocate(kept, true), const std::runtime_error&);
+}
+
+
+struct graph_node
+{
+	int value;
+	offset_ptr<graph_node> next;
+};
+
+TEST_CASE("offset_ptr survives relocation", "[offset_ptr]")
+{
+	alignas(graph_node) uint8_t original[2 * sizeof(graph_node)];
+	alignas(graph_node) uint8_t moved[2 * sizeof(graph_node)];
+
+	graph_node *nodes = reinterpret_cast<graph_node*>(original);
+	new (&nodes[0]) graph_node{ 1, nullptr };
+	new (&nodes[1]) graph_node{ 2, nullptr };
+	nodes[0].next = &nodes[1];
+
+	// a raw byte copy keeps the relative links intact
+	std::memcpy(moved, original, sizeof(original));
+	graph_node *copies = reinterpret_cast<graph_node*>(moved);
+	REQUIRE(copies[0].next.get() == &copies[1]);
+	REQUIRE(copies[0].next->value == 2);
+	REQUIRE(copies[1].next == nullptr);
+
+	// a copy constructed elsewhere still points at the same node
+	offset_ptr<graph_node> local = nodes[0].next;
+	REQUIRE(local.get() == &nodes[1]);
+	REQUIRE(local - offset_ptr<graph_node>(&nodes[0]) == 1);
+}
+
+
+TEST_CASE("pool_ptr is 32 bit and resolves against the pool", "[offset_ptr]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+
+	using node_ptr = pool_ptr<int, static_memory_pool_t>;
+	static_assert(sizeof(node_ptr) == sizeof(uint32_t), "pool_ptr should be 32 bit");
+
+	int *raw = static_cast<int*>(instance.allocate(sizeof(int)));
+	*raw = 7;
+	node_ptr p = raw;
+	REQUIRE(p.get() == raw);
+	REQUIRE(*p == 7);
+	REQUIRE(p.offset() == reinterpret_cast<uintptr_t>(raw) - instance.buffer_start());
+	REQUIRE(node_ptr() == nullptr);
+
+	instance.deallocate(raw);
+	instance.reset();
+}
+
+
+TEST_CASE("pool_ptr_allocator backs a vector", "[offset_ptr]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+
+	{
+		std::vector<int, pool_ptr_allocator<int, static_memory_pool_t>> v;
+		for (int i = 0; i < 16; ++i)
+			v.push_back(i);
+
+		REQUIRE(instance.is_inside_pool(reinterpret_cast<uintptr_t>(&v[0])));
+		REQUIRE(v[15] == 15);
+
+		// odd sized arrays leave every block header aligned
+		std::vector<char, pool_ptr_allocator<char, static_memory_pool_t>> text(3, 'x');
+		for (auto *it = instance.free_list(); it != nullptr; it = it->get_next())
+			REQUIRE(reinterpret_cast<uintptr_t>(it) % alignof(uintptr_t) == 0);
+
+		// n * sizeof(T) would wrap to a 4 byte block
+		pool_ptr_allocator<int, static_memory_pool_t> alloc;
+		REQUIRE_THROWS_AS(alloc.allocate(std::numeric_limits<size_t>::max() / sizeof(int) + 2), const std::bad_alloc&);
+	}
+
+	REQUIRE(instance.allocated() == instance.deallocated());
+	instance.reset();
+}
+
+
+TEST_CASE("file backed pool keeps its contents across a remap", "[shared]")
+{
+	char path[] = "/tmp/ss_pool_test_XXXXXX";
+	const int tmp = mkstemp(path);
+	REQUIRE(tmp >= 0);
+	close(tmp);
+	unlink(path);
+
+	size_t allocated = 0;
+	{
+		auto pool = shared_memory_pool_t::create_file(path, 1 << 16);
+		REQUIRE(pool.root() == nullptr);
+
+		graph_node *head = nullptr;
+		for (int i = 0; i < 8; ++i)
+		{
+			graph_node *node = new (pool.allocate(sizeof(graph_node))) graph_node{ i, head };
+			head = node;
+		}
+		pool.set_root(head);
+		pool.sync();
+		allocated = pool.allocated();
+	}
+
+	auto pool = shared_memory_pool_t::open_or_create_file(path, 1 << 16);
+	REQUIRE(pool.allocated() == allocated);
+
+	int expected = 7;
+	for (graph_node *node = static_cast<graph_node*>(pool.root()); node != nullptr; node = node->next.get())
+	{
+		REQUIRE(node->value == expected);
+		--expected;
+	}
+	REQUIRE(expected == -1);
+
+	// the restored block list keeps working
+	void *p = pool.allocate(64);
+	REQUIRE(p != nullptr);
+	pool.deallocate(p);
+	unlink(path);
+}
+
+
+TEST_CASE("snapshot is a copy-on-write view of the pool", "[shared]")
+{
+	// a pool other processes may map stays shared, a private one can't be attached
+	auto shared = shared_memory_pool_t::create_anonymous(1 << 16);
+	REQUIRE_THROWS_AS(shared.snapshot(), const std::runtime_error&);
+	auto pool = shared_memory_pool_t::create_private(1 << 20);
+	REQUIRE_THROWS_AS(shared_memory_pool_t::attach(pool.fd()), const std::runtime_error&);
+
+	int *value = static_cast<int*>(pool.allocate(sizeof(int)));
+	*value = 1;
+	pool.set_root(value);
+	const size_t allocated = pool.allocated();
+
+	{
+		auto snapshot = pool.snapshot();
+		REQUIRE_THROWS(pool.snapshot());
+
+		*value = 2;
+		void *later = pool.allocate(4096);
+		REQUIRE(later != nullptr);
+
+		int *seen = static_cast<int*>(snapshot.root());
+		REQUIRE(*seen == 1);
+		REQUIRE(snapshot.allocated() == allocated);
+
+		// speculative writes stay in the snapshot
+		*seen = 3;
+		REQUIRE(snapshot.allocate(128) != nullptr);
+		REQUIRE(*value == 2);
+		REQUIRE(pool.allocated() == allocated + 4096);
+		pool.deallocate(later);
+	}
+
+	*value = 4;
+	auto second = pool.snapshot();
+	*value = 5;
+	REQUIRE(*static_cast<int*>(second.root()) == 4);
+	REQUIRE(second.allocated() == allocated + 4096);
+	REQUIRE(second.deallocated() == 4096);
+}
+
+
+using stats_memory_pool_t = static_memory_pool<POOL_SIZE, alignof(uintptr_t), per_thread_stats<>>;
+
+TEST_CASE("stats policy records usage and fragmentation", "[stats]")
+{
+	auto &instance = stats_memory_pool_t::get_instance();
+	instance.reset();
+
+	void *a = instance.allocate(64);
+	void *b = instance.allocate(64);
+	void *c = instance.allocate(200);
+	REQUIRE(instance.allocate(POOL_SIZE - 100) == nullptr);
+
+	pool_stats stats = instance.stats();
+	REQUIRE(stats.allocations == 3);
+	REQUIRE(stats.failed_allocations == 1);
+	REQUIRE(stats.live_blocks == 3);
+	REQUIRE(stats.bytes_in_use == 64 + 64 + 200);
+	REQUIRE(stats.peak_bytes_in_use == 64 + 64 + 200);
+	REQUIRE(stats.request_sizes[pool_stats::bucket_of(64)] == 2);
+	REQUIRE(stats.request_sizes[pool_stats::bucket_of(200)] == 1);
+	REQUIRE(stats.fragmentation == 0.0);
+
+	// the hole left by b makes the free memory non contiguous
+	instance.deallocate(b);
+	stats = instance.stats();
+	REQUIRE(stats.deallocations == 1);
+	REQUIRE(stats.bytes_in_use == 64 + 200);
+	REQUIRE(stats.peak_bytes_in_use == 64 + 64 + 200);
+	REQUIRE(stats.free_blocks == 2);
+	REQUIRE(stats.largest_free_block < stats.free_bytes);
+	REQUIRE(stats.fragmentation > 0.0);
+
+	// the 4th allocation had to step over the three earlier blocks
+	REQUIRE(stats.search_lengths[pool_stats::bucket_of(4)] == 2);
+
+	instance.deallocate(a);
+	instance.deallocate(c);
+	REQUIRE(instance.stats().live_blocks == 0);
+
+	// the histogram counts what the caller asked for, bytes in use whole blocks
+	void *odd = instance.allocate(13);
+	stats = instance.stats();
+	REQUIRE(stats.request_sizes[pool_stats::bucket_of(13)] == 1);
+	REQUIRE(stats.bytes_in_use == 16);
+	instance.deallocate(odd);
+	REQUIRE(instance.allocated() == instance.deallocated());
+	instance.reset();
+}
+
+
+TEST_CASE("null stats policy adds no state", "[stats]")
+{
+	REQUIRE(sizeof(basic_memory_pool<>) == sizeof(basic_memory_pool<alignof(uintptr_t), null_stats>));
+	REQUIRE(sizeof(basic_memory_pool<>) == sizeof(std::ptrdiff_t) + 3 * sizeof(size_t));
+}
+
+
+using traced_memory_pool_t = static_memory_pool<POOL_SIZE, alignof(uintptr_t), traced_stats<per_thread_stats<>>>;
+
+TEST_CASE("allocation trace records allocate and deallocate", "[trace]")
+{
+	auto &instance = traced_memory_pool_t::get_instance();
+	instance.reset();
+
+	char path[] = "/tmp/ss_trace_test_XXXXXX";
+	const int tmp = mkstemp(path);
+	REQUIRE(tmp >= 0);
+	close(tmp);
+
+	auto &trace = allocation_trace::get_instance();
+	trace.start(path);
+	void *a = instance.allocate(40);
+	void *b = nullptr;
+	std::thread other([&]() { b = instance.allocate(100); });
+	other.join();
+	instance.deallocate(a);
+	instance.deallocate(b);
+	trace.stop();
+
+	// the policy underneath still sees everything
+	REQUIRE(instance.stats().allocations == 2);
+
+	const std::vector<trace_record> records = read_trace(path);
+	REQUIRE(records.size() == 4);
+	REQUIRE(trace.dropped() == 0);
+
+	size_t allocates = 0;
+	for (const trace_record &rec : records)
+	{
+		if (rec.op == trace_op::allocate)
+		{
+			++allocates;
+			REQUIRE((rec.size == 40 || rec.size == 100));
+		}
+		else
+		{
+			REQUIRE(rec.op == trace_op::deallocate);
+			REQUIRE((rec.pointer == reinterpret_cast<uintptr_t>(a) || rec.pointer == reinterpret_cast<uintptr_t>(b)));
+		}
+	}
+	REQUIRE(allocates == 2);
+
+	unlink(path);
+	instance.reset();
+}
+
+
+TEST_CASE("simulated first fit places blocks like the pool", "[simulator]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+	simulated_heap<simulated_first_fit> heap(POOL_SIZE);
+
+	const size_t sizes[] = { 40, 8, 100, 16, 64, 24, 200, 32 };
+	std::vector<void*> blocks;
+	std::vector<uint32_t> handles;
+
+	auto check_allocate = [&](size_t size)
+	{
+		uint64_t end = 0;
+		void *p = instance.allocate(size);
+		const uint32_t h = heap.allocate(size, end);
+		REQUIRE((p == nullptr) == (h == heap.NONE));
+		if (p != nullptr)
+			REQUIRE(reinterpret_cast<uintptr_t>(p) - instance.buffer_start() == end - ((size + alignof(uintptr_t) - 1) & ~(alignof(uintptr_t) - 1)));
+		blocks.push_back(p);
+		handles.push_back(h);
+	};
+
+	for (size_t size : sizes)
+		check_allocate(size);
+
+	// punch holes, then refill them with requests of different sizes
+	for (size_t i = 0; i < blocks.size(); i += 2)
+	{
+		instance.deallocate(blocks[i]);
+		heap.deallocate(handles[i]);
+	}
+	for (size_t size : { 30, 90, 8, 150, 500 })
+		check_allocate(size);
+
+	REQUIRE(heap.free_bytes() == instance.stats().free_bytes);
+	REQUIRE(heap.largest_free() == instance.stats().largest_free_block);
+	instance.reset();
+}
+
+
+TEST_CASE("simulator runs every policy over a trace", "[simulator]")
+{
+	std::vector<trace_record> records;
+	std::minstd_rand rng(7);
+	std::vector<uint64_t> live;
+	uint64_t next_id = 1;
+	for (uint64_t t = 0; t < 4000; ++t)
+	{
+		trace_record rec = {};
+		rec.timestamp = t;
+		if (live.size() < 50 || rng() % 2)
+		{
+			rec.op = trace_op::allocate;
+			rec.pointer = next_id;
+			rec.size = 8 + rng() % 300;
+			live.push_back(next_id++);
+		}
+		else
+		{
+			const size_t k = rng() % live.size();
+			rec.op = trace_op::deallocate;
+			rec.pointer = live[k];
+			live[k] = live.back();
+			live.pop_back();
+		}
+		records.push_back(rec);
+	}
+
+	const size_t big = 1 << 22;
+	const simulation_result results[] = {
+		simulate<simulated_heap<simulated_first_fit>>(records.data(), records.size(), big),
+		simulate<simulated_heap<simulated_best_fit>>(records.data(), records.size(), big),
+		simulate<simulated_heap<simulated_segregated_fit>>(records.data(), records.size(), big),
+		simulate<simulated_heap<simulated_tlsf>>(records.data(), records.size(), big),
+		simulate<simulated_buddy_heap>(records.data(), records.size(), big),
+	};
+
+	for (const simulation_result &r : results)
+	{
+		REQUIRE(r.failures == 0);
+		REQUIRE(r.operations == records.size());
+		REQUIRE(r.peak_footprint >= r.peak_live_bytes);
+		REQUIRE(r.fragmentation.size() == 32);
+	}
+
+	// a pool smaller than the live set has to fail somewhere
+	const simulation_result tight = simulate<simulated_heap<simulated_first_fit>>(records.data(), records.size(), 4096);
+	REQUIRE(tight.failures > 0);
+	REQUIRE(tight.first_failure >= 0);
+}
+
+TEST_CASE("heap map lists every block", "[heap_map]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+	const size_t header = static_memory_pool_t::ALIGNED_HEADER_SIZE;
+
+	void *a = instance.allocate(16);
+	void *b = instance.allocate(32);
+	void *c = instance.allocate(16);
+	instance.deallocate(b);
+
+	std::vector<heap_block> blocks;
+	for_each_block(instance, [&](const heap_block &block) { blocks.push_back(block); });
+	REQUIRE(blocks.size() == 4);
+	REQUIRE(blocks[0].offset == 0);
+	REQUIRE(blocks[0].allocated);
+	REQUIRE(blocks[1].offset == header + 16);
+	REQUIRE(blocks[1].size == 32);
+	REQUIRE(false == blocks[1].allocated);
+	REQUIRE(blocks[2].offset == 2 * header + 48);
+
+	std::ostringstream json;
+	write_heap_json(json, instance);
+	REQUIRE(json.str().find("\"capacity\":1024") != std::string::npos);
+	REQUIRE(json.str().find("{\"offset\":40,\"size\":32,\"state\":\"free\"}") != std::string::npos);
+
+	std::ostringstream svg;
+	write_heap_svg(svg, instance, 64, 16);
+	size_t rects = 0;
+	for (size_t pos = 0; (pos = svg.str().find("<rect", pos)) != std::string::npos; ++pos)
+		++rects;
+	REQUIRE(rects == 64);
+
+	instance.deallocate(a);
+	instance.deallocate(c);
+	instance.reset();
+}
+
+
+TEST_CASE("heap map runs fold small holes", "[heap_map]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+	const size_t header = static_memory_pool_t::ALIGNED_HEADER_SIZE;
+
+	void *p[8];
+	for (void *&q : p)
+		q = instance.allocate(16);
+	for (size_t i = 1; i < 8; i += 2)
+		instance.deallocate(p[i]);
+
+	std::vector<heap_run> exact, folded;
+	heap_run_builder exact_builder(header), folded_builder(header, 64);
+	for_each_block(instance, [&](const heap_block &block)
+	{
+		exact_builder.add(block, [&](const heap_run &run) { exact.push_back(run); });
+		folded_builder.add(block, [&](const heap_run &run) { folded.push_back(run); });
+	});
+	exact_builder.finish([&](const heap_run &run) { exact.push_back(run); });
+	folded_builder.finish([&](const heap_run &run) { folded.push_back(run); });
+
+	// used and free alternate up to the large free tail
+	REQUIRE(exact.size() == 8);
+
+	// the 16 byte holes stay inside one used run, the tail is its own run
+	REQUIRE(folded.size() == 2);
+	REQUIRE(folded[0].allocated);
+	REQUIRE(folded[0].used_blocks == 4);
+	REQUIRE(folded[0].free_blocks == 3);
+	REQUIRE(folded[0].free_bytes == 3 * 16);
+	REQUIRE(folded[0].bytes == 7 * (16 + header));
+	REQUIRE(false == folded[1].allocated);
+	REQUIRE(folded[0].bytes + folded[1].bytes == POOL_SIZE);
+
+	std::ostringstream json;
+	write_heap_runs_json(json, instance, 64);
+	REQUIRE(json.str().find("\"runs\":[") != std::string::npos);
+
+	// a shared pool is walked under its lock
+	shared_memory_pool_t shared = shared_memory_pool_t::create_anonymous(1 << 16);
+	shared.deallocate(shared.allocate(100));
+	std::ostringstream shared_json;
+	shared.inspect([&](const shared_memory_pool_t::pool_t &pool) { write_heap_runs_json(shared_json, pool); });
+	REQUIRE(shared_json.str().find("\"live_blocks\":0") != std::string::npos);
+
+	for (size_t i = 0; i < 8; i += 2)
+		instance.deallocate(p[i]);
+	instance.reset();
+}
+
+
+using profiled_memory_pool_t = static_memory_pool<POOL_SIZE, alignof(uintptr_t), profiled_stats<>>;
+
+TEST_CASE("heap map takes any fit policy and shows deferred blocks", "[heap_map]")
+{
+	using best_pool = static_memory_pool<4096, 8, null_stats, best_fit>;
+	using quick_pool = static_memory_pool<4096, 8, null_stats, quick_fit<64, best_fit>>;
+	std::unique_ptr<best_pool> best(new best_pool());
+	std::unique_ptr<quick_pool> quick(new quick_pool());
+
+	void *a = best->allocate(32);
+	std::ostringstream best_json;
+	write_heap_json(best_json, *best);
+	REQUIRE(best_json.str().find("{\"offset\":0,\"size\":32,\"state\":\"used\"}") != std::string::npos);
+	best->deallocate(a);
+
+	// the block quick_fit keeps stays marked allocated but isn't in use
+	void *kept = quick->allocate(32);
+	void *used = quick->allocate(48);
+	quick->deallocate(kept);
+
+	std::vector<heap_block> blocks;
+	for_each_block(*quick, [&](const heap_block &block) { blocks.push_back(block); });
+	REQUIRE(blocks.size() == 3);
+	REQUIRE(blocks[0].deferred);
+	REQUIRE(false == blocks[0].allocated);
+	REQUIRE(blocks[1].allocated);
+	REQUIRE(false == blocks[1].deferred);
+
+	std::ostringstream json, runs, svg;
+	write_heap_json(json, *quick);
+	write_heap_runs_json(runs, *quick);
+	write_heap_svg(svg, *quick, 16, 4);
+	REQUIRE(json.str().find("{\"offset\":0,\"size\":32,\"state\":\"deferred\"}") != std::string::npos);
+	REQUIRE(runs.str().find("\"deferred_blocks\":1") != std::string::npos);
+	REQUIRE(heap_cells(*quick, 16)[0].deferred_bytes == 32);
+	REQUIRE(svg.str().find("32 deferred") != std::string::npos);
+
+	quick->deallocate(used);
+}
+
+
+TEST_CASE("heap profiler keeps sampled blocks until freed", "[profiler]")
+{
+	auto &instance = profiled_memory_pool_t::get_instance();
+	instance.reset();
+	heap_profiler &profiler = heap_profiler::get_instance();
+	profiler.clear();
+
+	// a 1 byte interval samples practically every allocation
+	profiler.start(1);
+	void *p[10];
+	for (void *&q : p)
+		q = instance.allocate(48);
+	profiler.stop();
+	REQUIRE(profiler.live_samples() == 10);
+
+	for (size_t i = 0; i < 10; i += 2)
+		instance.deallocate(p[i]);
+	REQUIRE(profiler.live_samples() == 5);
+
+	uint64_t live_bytes = 0, total_count = 0;
+	for (const heap_profile_entry &e : profiler.profile())
+	{
+		REQUIRE(false == e.stack.empty());
+		live_bytes += e.live_bytes;
+		total_count += e.total_count;
+	}
+	REQUIRE(live_bytes == 5 * 48);
+	REQUIRE(total_count == 10);
+
+	std::ostringstream out;
+	profiler.write_pprof(out);
+	REQUIRE(out.str().compare(0, 35, "heap profile: 5: 240 [10: 480] @ he") == 0);
+	REQUIRE(out.str().find("MAPPED_LIBRARIES:") != std::string::npos);
+
+	for (size_t i = 1; i < 10; i += 2)
+		instance.deallocate(p[i]);
+	REQUIRE(profiler.live_samples() == 0);
+	profiler.clear();
+	instance.reset();
+}
+
+
+TEST_CASE("heap profiler samples by allocated bytes", "[profiler]")
+{
+	auto &instance = profiled_memory_pool_t::get_instance();
+	instance.reset();
+	heap_profiler &profiler = heap_profiler::get_instance();
+	profiler.clear();
+
+	// 2000 * 64 bytes at one sample per 1024 bytes, 125 samples expected
+	profiler.start(1024);
+	for (size_t i = 0; i < 2000; ++i)
+		instance.deallocate(instance.allocate(64));
+	profiler.stop();
+
+	uint64_t samples = 0;
+	for (const heap_profile_entry &e : profiler.profile())
+		samples += e.total_count;
+	REQUIRE(samples > 60);
+	REQUIRE(samples < 250);
+	REQUIRE(profiler.live_samples() == 0);
+
+	profiler.clear();
+	instance.reset();
+}
+
+
+TEST_CASE("latency histogram buckets and percentiles", "[timer]")
+{
+	using histogram_t = latency_histogram<5>;
+
+	// exact below 64, 32 buckets per power of two above
+	REQUIRE(histogram_t::bucket_of(0) == 0);
+	REQUIRE(histogram_t::bucket_of(63) == 63);
+	REQUIRE(histogram_t::bucket_of(64) == histogram_t::bucket_of(65));
+	REQUIRE(histogram_t::bucket_of(66) == histogram_t::bucket_of(65) + 1);
+	REQUIRE(histogram_t::bucket_of(UINT64_MAX) == histogram_t::BUCKETS - 1);
+	for (uint64_t v : { uint64_t(1), uint64_t(100), uint64_t(12345), uint64_t(1) << 40, UINT64_MAX })
+	{
+		const size_t b = histogram_t::bucket_of(v);
+		REQUIRE(histogram_t::lowest_of(b) <= v);
+		REQUIRE(histogram_t::highest_of(b) >= v);
+		REQUIRE(histogram_t::highest_of(b) - histogram_t::lowest_of(b) <= v / 32);
+	}
+
+	histogram_t a, b;
+	for (uint64_t v = 1; v <= 1000; ++v)
+		a.record(v);
+	b.record(100000);
+	REQUIRE(a.count() == 1000);
+	REQUIRE(a.min() == 1);
+	REQUIRE(a.max() == 1000);
+	REQUIRE(a.mean() == Approx(500.5));
+	REQUIRE(a.percentile(0.5) >= 500);
+	REQUIRE(a.percentile(0.5) <= 500 + 500 / 32);
+	REQUIRE(a.percentile(0.99) >= 990);
+	REQUIRE(a.percentile(0.99) <= 990 + 990 / 32);
+	REQUIRE(a.percentile(1.0) == 1000);
+
+	a.merge(b);
+	REQUIRE(a.count() == 1001);
+	REQUIRE(a.max() == 100000);
+	REQUIRE(a.percentile(1.0) == 100000);
+	REQUIRE(a.percentile(0.5) <= 500 + 500 / 32);
+
+	a.reset();
+	REQUIRE(a.count() == 0);
+	REQUIRE(a.percentile(0.5) == 0);
+}
+
+
+TEST_CASE("tsc timer measures elapsed time", "[timer]")
+{
+	REQUIRE(tsc_clock::ticks_per_ns() > 0.0);
+
+	tsc_timer t;
+	t.tick();
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	t.tock();
+	REQUIRE(t.ticks() > 0);
+	REQUIRE(t.duration<std::chrono::microseconds>() >= 4000);
+	REQUIRE(t.duration<std::chrono::microseconds>() < 1000000);
+}
+
+
+TEST_CASE("profile zones export as chrome trace", "[profile]")
+{
+	zone_profiler &profiler = zone_profiler::get_instance();
+	profiler.clear();
+
+	std::thread worker([]()
+	{
+		zone_profiler::get_instance().set_thread_name("worker");
+		profile_zone outer("outer");
+		profile_zone inner("inner \"quoted\"");
+	});
+	worker.join();
+
+	SS_PROFILE_ZONE("macro");
+#if defined(SS_PROFILE_ZONES)
+	// the pool allocate and deallocate zones are compiled in as well
+	REQUIRE(profiler.events() >= 5);
+#else
+	REQUIRE(profiler.events() == 4);
+#endif
+
+	std::ostringstream out;
+	profiler.write_chrome_trace(out);
+	const std::string json = out.str();
+	REQUIRE(json.compare(0, 14, "{\"displayTimeU") == 0);
+	REQUIRE(json.find("{\"name\":\"thread_name\",\"ph\":\"M\"") != std::string::npos);
+	REQUIRE(json.find("\"name\":\"inner \\\"quoted\\\"\",\"ph\":\"B\"") != std::string::npos);
+	REQUIRE(json.find("\"name\":\"outer\",\"ph\":\"E\"") != std::string::npos);
+	REQUIRE(profiler.dropped() == 0);
+
+	profiler.clear();
+	REQUIRE(profiler.events() == 0);
+}
+
+
+TEST_CASE("perf counters degrade to unavailable", "[perf]")
+{
+	perf_counters counters;
+	counters.start();
+	volatile uint64_t sum = 0;
+	for (uint64_t i = 0; i < 100000; ++i)
+		sum = sum + i;
+	counters.stop();
+	const perf_sample sample = counters.read();
+
+	// containers often have no PMU, whatever is missing must read as invalid
+	for (size_t c = 0; c < perf_counters::COUNTERS; ++c)
+	{
+		const perf_counters::counter counter = static_cast<perf_counters::counter>(c);
+		REQUIRE(std::strlen(perf_counters::name(counter)) > 0);
+		if (false == counters.available(counter))
+			REQUIRE(false == sample.valid[c]);
+	}
+
+	if (counters.available(perf_counters::instructions) && sample.valid[perf_counters::instructions])
+		REQUIRE(sample.values[perf_counters::instructions] >= 100000);
+}
+
+
+TEST_CASE("bench statistics tell real changes from noise", "[statistics]")
+{
+	// fully separated samples of 5, exact two sided p = 2 / C(10, 5)
+	const mann_whitney_result separated = mann_whitney_u({ 1, 2, 3, 4, 5 }, { 6, 7, 8, 9, 10 });
+	REQUIRE(separated.exact);
+	REQUIRE(separated.u == 0);
+	REQUIRE(separated.p_value == Approx(2.0 / 252.0));
+
+	const mann_whitney_result interleaved = mann_whitney_u({ 1, 3, 5, 7, 9 }, { 2, 4, 6, 8, 10 });
+	REQUIRE(interleaved.u == 10);
+	REQUIRE(interleaved.p_value > 0.5);
+
+	// ties fall back to the normal approximation
+	const mann_whitney_result tied = mann_whitney_u({ 1, 1, 2, 2, 3, 3 }, { 1, 1, 2, 2, 3, 3 });
+	REQUIRE(false == tied.exact);
+	REQUIRE(tied.p_value == Approx(1.0));
+
+	const confidence_interval faster = bootstrap_relative_change({ 100, 101, 99, 100, 102 }, { 110, 111, 109, 112, 110 });
+	REQUIRE(faster.estimate == Approx(0.10));
+	REQUIRE(faster.low > 0.05);
+	REQUIRE(faster.high < 0.15);
+
+	const confidence_interval same = bootstrap_relative_change({ 100, 90, 110, 95, 105 }, { 104, 92, 108, 97, 101 });
+	REQUIRE(same.low < 0);
+	REQUIRE(same.high > 0);
+
+	REQUIRE(median({ 3, 1, 2 }) == 2);
+	REQUIRE(median({ 4, 1, 2, 3 }) == 2.5);
+	REQUIRE(coefficient_of_variation({ 5, 5, 5 }) == 0);
+	REQUIRE(coefficient_of_variation({ 90, 110 }) > 0.1);
+}
+
+
+struct throws_on_construction
+{
+	char payload[48];
+
+	explicit throws_on_construction(bool fail)
+	{
+		if (fail)
+			throw std::runtime_error("constructor failed");
+	}
+};
+
+TEST_CASE("make_pooled owns the object and its block", "[pooled]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+
+	static_assert(sizeof(pooled_ptr<something, static_memory_pool_t>) == sizeof(something*), "deleter must be stateless");
+
+	{
+		auto value = make_pooled<std::string, static_memory_pool_t>(5, 'x');
+		REQUIRE(*value == "xxxxx");
+		REQUIRE(instance.stats().live_blocks == 1);
+	}
+	REQUIRE(instance.stats().live_blocks == 0);
+
+	// a throwing constructor hands the block back
+	REQUIRE_THROWS_AS((make_pooled<throws_on_construction, static_memory_pool_t>(true)), const std::runtime_error&);
+	REQUIRE(instance.stats().live_blocks == 0);
+	REQUIRE((make_pooled<throws_on_construction, static_memory_pool_t>(false) != nullptr));
+
+	// odd sizes are rounded so the next block stays aligned
+	auto odd = make_pooled<std::array<char, 5>, static_memory_pool_t>();
+	auto next = make_pooled<double, static_memory_pool_t>(1.5);
+	REQUIRE(reinterpret_cast<uintptr_t>(next.get()) % alignof(double) == 0);
+	REQUIRE(*next == 1.5);
+
+	std::vector<pooled_ptr<std::array<char, 256>, static_memory_pool_t>> blocks;
+	REQUIRE_THROWS_AS(([&]() { for (;;) blocks.push_back(make_pooled<std::array<char, 256>, static_memory_pool_t>()); }()), const std::bad_alloc&);
+	blocks.clear();
+	odd.reset();
+	next.reset();
+	REQUIRE(instance.stats().live_blocks == 0);
+	instance.reset();
+}
+
+TEST_CASE("make_pooled_shared keeps object and counts in one block", "[pooled]")
+{
+	auto &instance = static_memory_pool_t::get_instance();
+	instance.reset();
+
+	std::weak_ptr<something> weak;
+	{
+		std::shared_ptr<something> a = make_pooled_shared<something, static_memory_pool_t>();
+		a->s = "shared";
+		std::shared_ptr<something> b = a;
+		weak = a;
+
+		REQUIRE(instance.stats().live_blocks == 1);
+		REQUIRE(instance.is_inside_pool(reinterpret_cast<uintptr_t>(a.get())));
+		REQUIRE(b.use_count() == 2);
+	}
+	// the block lives on with the weak count
+	REQUIRE(weak.expired());
+	REQUIRE(instance.stats().live_blocks == 1);
+	weak.reset();
+	REQUIRE(instance.stats().live_blocks == 0);
+
+	using int_allocator = pool_allocator<int, static_memory_pool_t>;
+	std::vector<int, int_allocator> values = { 1, 2, 3 };
+	values.push_back(4);
+	REQUIRE(instance.is_inside_pool(reinterpret_cast<uintptr_t>(values.data())));
+	REQUIRE((values == std::vector<int, int_allocator>({ 1, 2, 3, 4 })));
+	REQUIRE((int_allocator() == pool_allocator<double, static_memory_pool_t>()));
+	values = {};
+	values.shrink_to_fit();
+	REQUIRE(instance.stats().live_blocks == 0);
+	instance.reset();
+}
+
+
+struct particle : pooled<particle>
+{
+	double x, y, z;
+	int id;
+
+	particle(int i) : x(0), y(0), z(0), id(i) {}
+	virtual ~particle() = default;
+};
+
+struct charged_particle : particle
+{
+	double charge = 1.0;
+
+	charged_particle() : particle(-1) {}
+};
+
+struct tagged_value
+{
+	using pool_tag = object_pool_tag;
+	int value;
+
+	tagged_value(int v) : value(v) {}
+};
+
+TEST_CASE("pooled types get their own object pool", "[pooled]")
+{
+	using particle_pool = static_object_pool<particle>;
+	auto &pool = particle_pool::get_instance();
+	const size_t live = pool.live_objects();
+
+	particle *a = new particle(1);
+	particle *b = new particle(2);
+	REQUIRE(pool.live_objects() == live + 2);
+	REQUIRE(pool.is_inside_pool(reinterpret_cast<uintptr_t>(a)));
+	REQUIRE(reinterpret_cast<uintptr_t>(a) % alignof(particle) == 0);
+	if (live == 0)
+		REQUIRE(reinterpret_cast<uint8_t*>(b) - reinterpret_cast<uint8_t*>(a) == ptrdiff_t(particle_pool::SLOT_SIZE));
+
+	// freed slots are handed out again first
+	delete a;
+	particle *c = new particle(3);
+	REQUIRE(c == a);
+
+	// a larger derived class is not pooled
+	particle *d = new charged_particle();
+	REQUIRE(false == pool.is_inside_pool(reinterpret_cast<uintptr_t>(d)));
+	delete d;
+
+	delete b;
+	delete c;
+	REQUIRE(pool.live_objects() == live);
+
+	// the tag alone selects the pool for make_pooled
+	static_assert(std::is_same<default_pool_t<tagged_value>, static_object_pool<tagged_value>>::value, "tag dispatch");
+	static_assert(std::is_same<default_pool_t<something>, default_memory_pool>::value, "tag dispatch");
+	{
+		auto v = make_pooled<tagged_value>(7);
+		REQUIRE(v->value == 7);
+		REQUIRE(static_object_pool<tagged_value>::get_instance().live_objects() == 1);
+	}
+	REQUIRE(static_object_pool<tagged_value>::get_instance().live_objects() == 0);
+}
+
+TEST_CASE("pooled types can be created from several threads", "[pooled]")
+{
+	auto &pool = static_object_pool<particle>::get_instance();
+	const size_t live = pool.live_objects();
+
+	std::atomic<bool> intact{ true };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&intact]()
+		{
+			std::vector<particle*> mine;
+			for (int round = 0; round < 100; ++round)
+			{
+				for (int i = 0; i < 64; ++i)
+					mine.push_back(new particle(i));
+				for (int i = 0; i < 64; ++i)
+				{
+					if (mine[i]->id != i)
+						intact = false;
+					delete mine[i];
+				}
+				mine.clear();
+			}
+		});
+	}
+	for (std::thread &t : threads)
+		t.join();
+
+	REQUIRE(intact);
+	REQUIRE(pool.live_objects() == live);
+}
+
+struct exit_particle : pooled<exit_particle>
+{
+	int id = 0;
+};
+
+static exit_particle *particle_freed_at_exit = nullptr;
+
+TEST_CASE("pooled objects can be freed during static destruction", "[pooled]")
+{
+	// the handler is registered before the pool exists, so it runs after
+	// any destructor the pool registers
+	std::fflush(nullptr);
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		std::atexit([]() { delete particle_freed_at_exit; });
+		particle_freed_at_exit = new exit_particle();
+		std::exit(0);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	REQUIRE(WIFEXITED(status));
+	REQUIRE(WEXITSTATUS(status) == 0);
+}
+
+TEST_CASE("static object pool adds slabs as it fills", "[pooled]")
+{
+	using small_pool = static_object_pool<uint64_t, 4096, malloc_chunk_source, null_lock, null_error>;
+	auto &pool = small_pool::get_instance();
+	pool.release();
+
+	std::vector<void*> slots;
+	for (size_t i = 0; i < small_pool::SLOTS_PER_SLAB + 1; ++i)
+		slots.push_back(pool.allocate());
+	REQUIRE(pool.num_slabs() == 2);
+	REQUIRE(pool.live_objects() == small_pool::SLOTS_PER_SLAB + 1);
+	REQUIRE(pool.allocate(small_pool::SLOT_SIZE + 1) == nullptr);
+
+	for (void *p : slots)
+		pool.deallocate(p);
+	REQUIRE(pool.live_objects() == 0);
+	REQUIRE(pool.allocate() == slots.back());
+	pool.release();
+	REQUIRE(pool.num_slabs() == 0);
+}
+
+TEST_CASE("static object pool rejects pointers it did not hand out", "[pooled]")
+{
+	using checked_pool = static_object_pool<uint64_t, 4096, malloc_chunk_source, null_lock, throw_error>;
+	auto &pool = checked_pool::get_instance();
+	pool.release();
+
+	void *a = pool.allocate();
+	uint64_t on_stack = 0;
+	REQUIRE_THROWS_AS(pool.deallocate(&on_stack), const std::invalid_argument&);
+	REQUIRE_THROWS_AS(pool.deallocate(static_cast<uint8_t*>(a) + 1), const std::invalid_argument&);
+	// the next slot was never handed out
+	REQUIRE_THROWS_AS(pool.deallocate(static_cast<uint8_t*>(a) + checked_pool::SLOT_SIZE), const std::invalid_argument&);
+	REQUIRE(pool.live_objects() == 1);
+
+	pool.deallocate(a);
+	REQUIRE(pool.live_objects() == 0);
+	pool.release();
+}
+
+
+TEST_CASE("size class table agrees at compile time and run time", "[size_class]")
+{
+	using classes = size_class_table<>;
+	static_assert(classes::size_of(0) == 16 && classes::size_of(7) == 128, "linear classes");
+	static_assert(classes::size_of(8) == 160 && classes::size_of(11) == 256 && classes::size_of(12) == 320, "four per doubling");
+	static_assert(classes::size_of(classes::CLASSES - 1) == classes::MAX_SIZE, "last class");
+	static_assert(classes::class_of(100) == 6 && classes::class_of(4097) == classes::class_of(5120), "class_of");
+
+	for (size_t size = 1; size <= classes::MAX_SIZE + 64; ++size)
+	{
+		const size_t c = classes::lookup(size);
+		if (c != classes::class_of(size))
+			FAIL("lookup(" << size << ") = " << c << ", class_of = " << classes::class_of(size));
+	}
+	REQUIRE(classes::lookup(size_t(1) << 40) == size_t(classes::CLASSES));
+
+	// rounding stays within one step above the linear range
+	for (size_t c = classes::LINEAR_CLASSES; c < classes::CLASSES; ++c)
+		REQUIRE(classes::size_of(c) <= classes::size_of(c - 1) + classes::size_of(c - 1) / 4 + 32);
+
+	using fine = size_class_table<8, 64, 8, 1024>;
+	for (size_t size = 1; size <= fine::MAX_SIZE; ++size)
+		REQUIRE(fine::size_of(fine::lookup(size)) >= size);
+}
+
+TEST_CASE("size class pool serves fixed and run time sizes", "[size_class]")
+{
+	using pool_t = size_class_pool<size_class_table<>, (1 << 16), malloc_chunk_source>;
+	pool_t pool;
+
+	void *a = pool.allocate<24>();
+	void *b = pool.allocate(24);
+	REQUIRE(static_cast<uint8_t*>(b) - static_cast<uint8_t*>(a) == 32);
+	REQUIRE(pool.allocated() == 64);
+
+	pool.deallocate<24>(a);
+	REQUIRE(pool.allocate(17) == a);
+	pool.deallocate(a, 17);
+	pool.deallocate(b, 24);
+
+	void *large = pool.allocate(40000);
+	REQUIRE(pool.is_inside_pool(reinterpret_cast<uintptr_t>(large)));
+	REQUIRE(pool.allocate(pool_t::MAX_SIZE + 1) == nullptr);
+	pool.deallocate(large, 40000);
+	REQUIRE(pool.allocated() == pool.deallocated());
+
+	// the typed paths pick the compile time class
+	using global_pool = size_class_pool<>;
+	{
+		auto value = make_pooled<something, global_pool>();
+		value->s = "sized";
+		auto shared = make_pooled_shared<std::string, global_pool>("shared");
+		std::vector<int, pool_allocator<int, global_pool>> values(100, 1);
+		REQUIRE(global_pool::get_instance().is_inside_pool(reinterpret_cast<uintptr_t>(value.get())));
+		REQUIRE(global_pool::get_instance().is_inside_pool(reinterpret_cast<uintptr_t>(values.data())));
+	}
+	REQUIRE(global_pool::get_instance().allocated() == global_pool::get_instance().deallocated());
+}
+
+TEST_CASE("size class pool rejects foreign and mis-sized pointers", "[size_class]")
+{
+	using pool_t = size_class_pool<size_class_table<>, (1 << 16), malloc_chunk_source, throw_error>;
+	pool_t pool;
+
+	void *a = pool.allocate(24);
+	void *b = pool.allocate(24);
+	int on_stack = 0;
+	REQUIRE_THROWS_AS(pool.deallocate(&on_stack, 24), const std::invalid_argument&);
+	REQUIRE_THROWS_AS(pool.deallocate(a, 100), const std::invalid_argument&);
+	REQUIRE_THROWS_AS(pool.deallocate(a, pool_t::MAX_SIZE + 1), const std::invalid_argument&);
+	REQUIRE_THROWS_AS(pool.deallocate(static_cast<uint8_t*>(a) + 8, 24), const std::invalid_argument&);
+	// the next block of the slab was never handed out
+	REQUIRE_THROWS_AS(pool.deallocate(static_cast<uint8_t*>(b) + 32, 24), const std::invalid_argument&);
+	REQUIRE(pool.deallocated() == 0);
+
+	pool.deallocate(a, 24);
+	pool.deallocate<24>(b);
+	REQUIRE(pool.allocated() == pool.deallocated());
+	REQUIRE(pool.allocate(24) == b);
+}
+
+
+namespace
+{
+	pool_error last_pool_error = pool_error::too_large;
+	size_t pool_errors = 0;
+
+	void count_pool_error(pool_error error, size_t, const void *)
+	{
+		last_pool_error = error;
+		++pool_errors;
+	}
+}
+
+TEST_CASE("policy based static memory pool", "[policies]")
+{
+	// best fit takes the smaller of two holes, first fit the first
+	using best_fit_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, best_fit>;
+	best_fit_pool best;
+	static_memory_pool_t &first = static_memory_pool_t::get_instance();
+	first.reset();
+
+	void *fa = first.allocate(128), *fb = first.allocate(64), *fc = first.allocate(32), *fd = first.allocate(64);
+	void *ba = best.allocate(128), *bb = best.allocate(64), *bc = best.allocate(32), *bd = best.allocate(64);
+	first.deallocate(fa);
+	first.deallocate(fc);
+	best.deallocate(ba);
+	best.deallocate(bc);
+	// the 32 byte hole fits 8 bytes and a header exactly
+	REQUIRE(first.allocate(8) == fa);
+	REQUIRE(best.allocate(8) == bc);
+	(void)fb; (void)fd; (void)bb; (void)bd;
+	first.reset();
+
+	// errors
+	using throwing_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, first_fit, null_lock, throw_error>;
+	throwing_pool throwing;
+	REQUIRE_THROWS_AS(throwing.allocate(POOL_SIZE + 1), const std::bad_alloc&);
+	REQUIRE_THROWS_AS(throwing.allocate(POOL_SIZE - 8), const std::bad_alloc&);
+	int outside = 0;
+	REQUIRE_THROWS_AS(throwing.deallocate(&outside), const std::invalid_argument&);
+
+	using handled_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, first_fit, null_lock,
+		handler_error<count_pool_error>>;
+	handled_pool handled;
+	pool_errors = 0;
+	REQUIRE(handled.allocate(POOL_SIZE * 2) == nullptr);
+	REQUIRE(last_pool_error == pool_error::too_large);
+	void *p = handled.allocate(16);
+	handled.deallocate(p);
+	handled.deallocate(p);
+	REQUIRE(last_pool_error == pool_error::not_allocated);
+	REQUIRE(pool_errors == 2);
+
+	using quiet_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, first_fit, null_lock, null_error>;
+	quiet_pool quiet;
+	REQUIRE(quiet.allocate(POOL_SIZE * 2, true) == nullptr);
+
+	// the default returns nullptr for a request no block fits, even with throw_exception
+	static_memory_pool<POOL_SIZE> logging;
+	REQUIRE(logging.allocate(POOL_SIZE - 8, true) == nullptr);
+
+	// backings
+	using mapped_pool = static_memory_pool<(1 << 16), 16, null_stats, first_fit, null_lock, log_error, mmap_backing>;
+	std::unique_ptr<mapped_pool> mapped(new mapped_pool());
+	void *m = mapped->allocate(1000);
+	REQUIRE(mapped->is_inside_pool(reinterpret_cast<uintptr_t>(m)));
+	REQUIRE(reinterpret_cast<uintptr_t>(m) % 16 == 0);
+	REQUIRE(sizeof(mapped_pool) < 1024);
+
+	alignas(uintptr_t) static uint8_t buffer[POOL_SIZE];
+	using external_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, first_fit, null_lock, log_error, external_backing>;
+	external_pool external(buffer);
+	void *e = external.allocate(100);
+	REQUIRE(e >= static_cast<void*>(buffer));
+	REQUIRE(e < static_cast<void*>(buffer + POOL_SIZE));
+}
+
+TEST_CASE("locked static memory pool is shared by threads", "[policies]")
+{
+	using locked_pool = static_memory_pool<(1 << 16), alignof(uintptr_t), per_thread_stats<>, first_fit, spin_lock>;
+	aligned_ptr<locked_pool> pool = make_aligned<locked_pool>();
+
+	std::atomic<int> failed{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&pool, &failed]()
+		{
+			for (int i = 0; i < 2000; ++i)
+			{
+				void *p = pool->allocate(16 + i % 64);
+				if (p == nullptr)
+					++failed;
+				pool->deallocate(p);
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+
+	REQUIRE(failed == 0);
+
+	const pool_stats stats = pool->stats();
+	REQUIRE(stats.allocations == 8000);
+	REQUIRE(stats.live_blocks == 0);
+	REQUIRE(stats.free_blocks == 1);
+}
+
+
+TEST_CASE("bounded search caps probes and falls back", "[bounded]")
+{
+	using bounded_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), per_thread_stats<>, bounded_fit<4, reserve_fallback<256>>>;
+	aligned_ptr<bounded_pool> pool = make_aligned<bounded_pool>();
+
+	// four blocks in front of the free tail, the last one fit with 4 probes
+	std::vector<void*> blocks;
+	for (int i = 0; i < 4; ++i)
+		blocks.push_back(pool->allocate(16));
+	REQUIRE(pool->stats().probe_limit_hits == 0);
+
+	void *a = pool->allocate(16);
+	void *b = pool->allocate(16);
+	REQUIRE(a != nullptr);
+	REQUIRE(false == pool->is_inside_pool(reinterpret_cast<uintptr_t>(a)));
+	REQUIRE(reinterpret_cast<uintptr_t>(a) % alignof(std::max_align_t) == 0);
+
+	pool_stats stats = pool->stats();
+	REQUIRE(stats.probe_limit_hits == 2);
+	REQUIRE(stats.fallback_allocations == 2);
+	for (size_t i = pool_stats::bucket_of(4) + 1; i < pool_stats::SEARCH_BUCKETS; ++i)
+		REQUIRE(stats.search_lengths[i] == 0);
+
+	// the newest reserve block rolls back, an emptied reserve starts over
+	pool->deallocate(b);
+	REQUIRE(pool->allocate(16) == b);
+	pool->deallocate(a);
+	pool->deallocate(b);
+	REQUIRE(pool->allocate(16) == a);
+	pool->deallocate(a);
+
+	// the reserve runs out, then allocation fails
+	std::vector<void*> reserved;
+	while (void *p = pool->allocate(16))
+		reserved.push_back(p);
+	REQUIRE(reserved.size() == 256 / (2 * alignof(std::max_align_t)));
+	REQUIRE(pool->stats().failed_allocations == 1);
+	for (void *p : reserved)
+		pool->deallocate(p);
+
+	// a longer search finds the tail again
+	pool->fit().set_max_probes(64);
+	void *c = pool->allocate(16);
+	REQUIRE(pool->is_inside_pool(reinterpret_cast<uintptr_t>(c)));
+	pool->deallocate(c);
+	for (void *p : blocks)
+		pool->deallocate(p);
+	REQUIRE(pool->stats().live_blocks == 0);
+	REQUIRE(pool->allocated() == pool->deallocated());
+}
+
+TEST_CASE("bounded search falls back to malloc", "[bounded]")
+{
+	using malloc_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, bounded_fit<2, malloc_fallback>>;
+	malloc_pool pool;
+
+	void *a = pool.allocate(16);
+	void *b = pool.allocate(16);
+	void *c = pool.allocate(100);
+	REQUIRE(false == pool.is_inside_pool(reinterpret_cast<uintptr_t>(c)));
+	std::memset(c, 0xab, 100);
+	REQUIRE(pool.fit().fallback().live_blocks() == 1);
+	pool.deallocate(c);
+	REQUIRE(pool.fit().fallback().live_blocks() == 0);
+
+	// pointers malloc_fallback didn't hand out are still invalid
+	int on_stack = 0;
+	std::unique_ptr<int> on_heap(new int(0));
+	REQUIRE_THROWS_AS(pool.deallocate(c, true), const std::runtime_error&);
+	REQUIRE_THROWS_AS(pool.deallocate(&on_stack, true), const std::runtime_error&);
+	REQUIRE_THROWS_AS(pool.deallocate(on_heap.get(), true), const std::runtime_error&);
+	REQUIRE_THROWS_AS(pool.deallocate(reinterpret_cast<uint8_t*>(pool.buffer_start()) + 8, true), const std::runtime_error&);
+	pool.deallocate(b);
+	pool.deallocate(a);
+
+	const pool_stats stats = pool.stats();
+	REQUIRE(stats.fallback_allocations == 1);
+	REQUIRE(stats.probe_limit_hits == 1);
+	REQUIRE(pool.allocated() == pool.deallocated());
+
+	// reset() frees what is still out
+	for (int i = 0; i < 100; ++i)
+		REQUIRE(pool.fit().overflow_allocate(64, alignof(uintptr_t)) != nullptr);
+	REQUIRE(pool.fit().fallback().live_blocks() == 100);
+	pool.reset();
+	REQUIRE(pool.fit().fallback().live_blocks() == 0);
+}
+
+TEST_CASE("next fit resumes after the last block it found", "[fit]")
+{
+	using next_fit_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, next_fit>;
+	next_fit_pool pool;
+
+	void *a = pool.allocate(64);
+	void *b = pool.allocate(64);
+	void *c = pool.allocate(64);
+	pool.deallocate(a);
+	// first fit would take a's hole, the search starts at c instead
+	void *d = pool.allocate(32);
+	REQUIRE(d > c);
+
+	// freeing d merges it into c's block, the rover follows
+	pool.deallocate(c);
+	pool.deallocate(d);
+	REQUIRE(pool.fit().rover() == static_cast<uint8_t*>(c) - next_fit_pool::ALIGNED_HEADER_SIZE);
+	REQUIRE(pool.allocate(16) == c);
+
+	// wraps around to a's hole once the tail is gone
+	void *rest = pool.allocate(POOL_SIZE - 2 * (next_fit_pool::ALIGNED_HEADER_SIZE + 64) - 3 * next_fit_pool::ALIGNED_HEADER_SIZE - 16);
+	REQUIRE(rest != nullptr);
+	REQUIRE(pool.allocate(32) == a);
+	(void)b;
+}
+
+TEST_CASE("tree best fit picks the blocks best fit does", "[fit]")
+{
+	constexpr size_t SIZE = 1 << 16;
+	using list_pool = static_memory_pool<SIZE, alignof(uintptr_t), per_thread_stats<>, best_fit>;
+	using tree_pool = static_memory_pool<SIZE, alignof(uintptr_t), per_thread_stats<>, tree_best_fit>;
+	aligned_ptr<list_pool> list = make_aligned<list_pool>();
+	aligned_ptr<tree_pool> tree = make_aligned<tree_pool>();
+
+	std::mt19937 rng(7);
+	std::vector<void*> list_blocks(200, nullptr), tree_blocks(200, nullptr);
+	for (int i = 0; i < 20000; ++i)
+	{
+		const size_t slot = rng() % list_blocks.size();
+		if (list_blocks[slot] != nullptr)
+		{
+			list->deallocate(list_blocks[slot]);
+			tree->deallocate(tree_blocks[slot]);
+			list_blocks[slot] = tree_blocks[slot] = nullptr;
+			continue;
+		}
+
+		const size_t size = 1 + rng() % 500;
+		list_blocks[slot] = list->allocate(size);
+		tree_blocks[slot] = tree->allocate(size);
+		REQUIRE((list_blocks[slot] == nullptr) == (tree_blocks[slot] == nullptr));
+		if (list_blocks[slot] != nullptr)
+			REQUIRE(reinterpret_cast<uintptr_t>(list_blocks[slot]) - list->buffer_start() ==
+				reinterpret_cast<uintptr_t>(tree_blocks[slot]) - tree->buffer_start());
+	}
+
+	// every free block big enough for a request is in the tree
+	pool_stats stats = tree->stats();
+	REQUIRE(tree->fit().indexed_blocks() <= stats.free_blocks);
+	REQUIRE(tree->fit().indexed_blocks() > 0);
+
+	// a search is one path down the tree, not a walk over every block
+	const pool_stats list_stats = list->stats();
+	size_t list_long = 0, tree_long = 0;
+	for (size_t i = pool_stats::bucket_of(64) + 1; i < pool_stats::SEARCH_BUCKETS; ++i)
+	{
+		list_long += list_stats.search_lengths[i];
+		tree_long += stats.search_lengths[i];
+	}
+	REQUIRE(tree_long < list_long);
+	REQUIRE(stats.probes < list_stats.probes / 10);
+
+	for (size_t i = 0; i < list_blocks.size(); ++i)
+	{
+		// slots of failed allocations hold nullptr
+		if (list_blocks[i] != nullptr)
+			list->deallocate(list_blocks[i]);
+		if (tree_blocks[i] != nullptr)
+			tree->deallocate(tree_blocks[i]);
+	}
+	stats = tree->stats();
+	REQUIRE(stats.free_blocks == 1);
+	REQUIRE(tree->fit().indexed_blocks() == 1);
+	tree->reset();
+	REQUIRE(tree->fit().indexed_blocks() == 1);
+}
+
+TEST_CASE("quick lists recycle freed blocks of the same size", "[fit]")
+{
+	using quick_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), per_thread_stats<>, quick_fit<64>>;
+	quick_pool pool;
+
+	// freed without coalescing, popped without a search
+	void *a = pool.allocate(48);
+	void *b = pool.allocate(48);
+	pool.deallocate(a);
+	pool_stats stats = pool.stats();
+	REQUIRE(stats.deferred_blocks == 1);
+	REQUIRE(stats.live_blocks == 1);
+	REQUIRE(stats.bytes_in_use == 48);
+	REQUIRE(pool.allocate(48) == a);
+	REQUIRE(pool.stats().probes == 1 + 2);
+
+	// LIFO, other sizes go to the block list
+	pool.deallocate(a);
+	pool.deallocate(b);
+	REQUIRE(pool.allocate(48) == b);
+	REQUIRE(pool.allocate(48) == a);
+	void *c = pool.allocate(100);
+	pool.deallocate(c);
+	REQUIRE(pool.fit().deferred_blocks() == 0);
+
+	// a second free of the newest block is reported
+	pool.deallocate(a);
+	REQUIRE_THROWS_AS(pool.deallocate(a, true), const std::runtime_error&);
+	REQUIRE(pool.fit().deferred_blocks() == 1);
+	pool.deallocate(b);
+
+	// small blocks fill the pool, taking a and b back once the tail runs
+	// out; freeing them defers them all
+	std::vector<void*> blocks;
+	while (void *p = pool.allocate(32))
+		blocks.push_back(p);
+	REQUIRE(pool.fit().deferred_blocks() == 0);
+	for (void *p : blocks)
+		pool.deallocate(p);
+	REQUIRE(pool.fit().deferred_blocks() == blocks.size());
+	REQUIRE(pool.stats().live_blocks == 0);
+
+	// a large request fails its search and coalesces them
+	void *large = pool.allocate(POOL_SIZE / 2);
+	REQUIRE(large != nullptr);
+	stats = pool.stats();
+	REQUIRE(stats.deferred_blocks == 0);
+	REQUIRE(stats.live_blocks == 1);
+	pool.deallocate(large);
+	REQUIRE(pool.stats().free_blocks == 1);
+	REQUIRE(pool.allocated() == pool.deallocated());
+}
+
+TEST_CASE("unsorted bin coalesces on a miss", "[fit]")
+{
+	using unsorted_pool = static_memory_pool<POOL_SIZE, alignof(uintptr_t), null_stats, unsorted_fit<>>;
+	unsorted_pool pool;
+
+	// the same size comes back from the bin
+	void *a = pool.allocate(40);
+	void *b = pool.allocate(100);
+	void *c = pool.allocate(60);
+	void *d = pool.allocate(16);
+	pool.deallocate(b);
+	REQUIRE(pool.stats().deferred_blocks == 1);
+	REQUIRE(pool.allocate(100) == b);
+	REQUIRE(pool.fit().deferred_blocks() == 0);
+
+	// a miss sorts the bin and merges a, b and c back into one block
+	pool.deallocate(c);
+	pool.deallocate(a);
+	pool.deallocate(b);
+	REQUIRE_THROWS_AS(pool.deallocate(b, true), const std::runtime_error&);
+	REQUIRE(pool.stats().free_blocks == 1);
+	void *e = pool.allocate(200);
+	REQUIRE(e == a);
+	pool_stats stats = pool.stats();
+	REQUIRE(stats.deferred_blocks == 0);
+	REQUIRE(stats.live_blocks == 2);
+	REQUIRE(stats.free_blocks == 2);
+
+	// consolidate() empties the bin whenever asked
+	pool.deallocate(d);
+	pool.deallocate(e);
+	REQUIRE(pool.fit().deferred_blocks() == 2);
+	pool.consolidate();
+	stats = pool.stats();
+	REQUIRE(stats.deferred_blocks == 0);
+	REQUIRE(stats.live_blocks == 0);
+	REQUIRE(stats.free_blocks == 1);
+	REQUIRE(pool.allocated() == pool.deallocated());
+}
+
+TEST_CASE("deferring policies end with one free block", "[fit]")
+{
+	constexpr size_t SIZE = 1 << 17;
+	using quick_pool = static_memory_pool<SIZE, alignof(uintptr_t), null_stats, quick_fit<128, tree_best_fit>>;
+	using unsorted_pool = static_memory_pool<SIZE, alignof(uintptr_t), null_stats, unsorted_fit<next_fit>>;
+	std::unique_ptr<quick_pool> quick(new quick_pool());
+	std::unique_ptr<unsorted_pool> unsorted(new unsorted_pool());
+
+	std::mt19937 rng(11);
+	std::vector<void*> quick_blocks(300, nullptr), unsorted_blocks(300, nullptr);
+	size_t quick_failed = 0, unsorted_failed = 0;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const size_t slot = rng() % quick_blocks.size();
+		if (quick_blocks[slot] != nullptr)
+			quick->deallocate(quick_blocks[slot]);
+		if (unsorted_blocks[slot] != nullptr)
+			unsorted->deallocate(unsorted_blocks[slot]);
+		const size_t size = rng() % 4 == 0 ? 1 + rng() % 1000 : 8 * (1 + rng() % 8);
+		quick_blocks[slot] = quick->allocate(size);
+		unsorted_blocks[slot] = unsorted->allocate(size);
+		quick_failed += quick_blocks[slot] == nullptr;
+		unsorted_failed += unsorted_blocks[slot] == nullptr;
+	}
+	REQUIRE(quick_failed == 0);
+	REQUIRE(unsorted_failed == 0);
+
+	for (size_t i = 0; i < quick_blocks.size(); ++i)
+	{
+		// slots of failed allocations hold nullptr
+		if (quick_blocks[i] != nullptr)
+			quick->deallocate(quick_blocks[i]);
+		if (unsorted_blocks[i] != nullptr)
+			unsorted->deallocate(unsorted_blocks[i]);
+	}
+	quick->consolidate();
+	unsorted->consolidate();
+	REQUIRE(quick->stats().free_blocks == 1);
+	REQUIRE(unsorted->stats().free_blocks == 1);
+	REQUIRE(quick->fit().indexed_blocks() == 1);
+	REQUIRE(quick->allocated() == quick->deallocated());
+	REQUIRE(unsorted->allocated() == unsorted->deallocated());
+}
+
+TEST_CASE("span pool keeps small objects without headers", "[span]")
+{
+	using spans_t = span_pool<(1 << 22)>;
+	std::unique_ptr<spans_t> spans(new spans_t());
+
+	// objects of one class sit next to each other
+	void *a = spans->allocate(24);
+	void *b = spans->allocate(32);
+	REQUIRE(static_cast<uint8_t*>(b) - static_cast<uint8_t*>(a) == 32);
+	REQUIRE(reinterpret_cast<uintptr_t>(a) % spans_t::ALIGNMENT == 0);
+	REQUIRE(spans->usable_size(a) == 32);
+	REQUIRE(spans->num_spans() == 1);
+	spans->deallocate(a);
+	REQUIRE(spans->allocate(17) == a);
+	spans->deallocate(a);
+	spans->deallocate(b);
+
+	// freed without a size, each class keeps one span until trim()
+	std::mt19937 rng(3);
+	std::vector<std::pair<void*, size_t>> objects;
+	for (int i = 0; i < 3000; ++i)
+	{
+		const size_t size = 1 + rng() % 256;
+		void *p = spans->allocate(size);
+		REQUIRE(p != nullptr);
+		REQUIRE(spans->usable_size(p) >= size);
+		std::memset(p, 0x5a, size);
+		objects.emplace_back(p, size);
+	}
+	std::shuffle(objects.begin(), objects.end(), rng);
+	for (const auto &o : objects)
+		spans->deallocate(o.first);
+	REQUIRE(spans->num_spans() <= size_t(size_class_table<16, 128, 4, 1024>::class_of(256)) + 1);
+	spans->trim();
+	REQUIRE(spans->num_spans() == 0);
+	REQUIRE(spans->pool().stats().live_blocks == 0);
+
+	// empty spans go back to the pool
+	std::vector<void*> large_class;
+	for (size_t i = 0; i < 3 * (1 << 16) / 1024; ++i)
+		large_class.push_back(spans->allocate(1024));
+	REQUIRE(spans->num_spans() >= 3);
+	for (void *p : large_class)
+		spans->deallocate(p);
+	REQUIRE(spans->num_spans() == 1);
+
+	// large objects come from the pool itself
+	void *big = spans->allocate(5000);
+	REQUIRE(spans->is_inside_pool(reinterpret_cast<uintptr_t>(big)));
+	REQUIRE(spans->usable_size(big) == 0);
+	spans->deallocate(big);
+	spans->trim();
+	REQUIRE(spans->pool().stats().live_blocks == 0);
+	REQUIRE(spans->pool().allocated() == spans->pool().deallocated());
+}
+
+TEST_CASE("span pool reports objects freed twice", "[span]")
+{
+	using classes = size_class_table<16, 128, 4, 1024>;
+	using spans_t = span_pool<(1 << 22), classes, (1 << 16), 12, static_memory_pool<(1 << 22), classes::QUANTUM>, throw_error>;
+	std::unique_ptr<spans_t> spans(new spans_t());
+
+	// the first span fills up, the last object opens a second one
+	std::vector<void*> objects;
+	while (spans->num_spans() < 2)
+		objects.push_back(spans->allocate(1024));
+	void *last = objects.back();
+	objects.pop_back();
+
+	spans->deallocate(objects[0]);
+	REQUIRE_THROWS_AS(spans->deallocate(objects[0]), const std::invalid_argument&);
+
+	// the span goes back only once its last object is freed
+	for (size_t i = 1; i < objects.size(); ++i)
+	{
+		REQUIRE(spans->num_spans() == 2);
+		spans->deallocate(objects[i]);
+	}
+	REQUIRE(spans->num_spans() == 1);
+
+	spans->deallocate(last);
+	REQUIRE_THROWS_AS(spans->deallocate(last), const std::invalid_argument&);
+	REQUIRE(spans->num_spans() == 1);
+	spans->trim();
+	REQUIRE(spans->num_spans() == 0);
+	REQUIRE(spans->pool().allocated() == spans->pool().deallocated());
+}
+
+TEST_CASE("pool registry routes pointers to their pools", "[registry]")
+{
+	using heap_pool_t = static_memory_pool<(1 << 16)>;
+	using tiny_pool_t = static_memory_pool<1024>;
+	using mapped_pool_t = static_memory_pool<(1 << 16), 8, null_stats, first_fit, null_lock, log_error, mmap_backing>;
+	std::unique_ptr<basic_pool_registry<>> registry(new basic_pool_registry<>());
+
+	// unaligned heap pools, two tiny ones on a page and a page aligned mapping
+	std::unique_ptr<heap_pool_t> a(new heap_pool_t()), b(new heap_pool_t());
+	std::unique_ptr<std::array<tiny_pool_t, 2>> tiny(new std::array<tiny_pool_t, 2>());
+	std::unique_ptr<mapped_pool_t> mapped(new mapped_pool_t());
+	const pool_owner owners[] = { make_pool_owner(*a, "a"), make_pool_owner(*b, "b"), make_pool_owner((*tiny)[0], "tiny 0"),
+		make_pool_owner((*tiny)[1], "tiny 1"), make_pool_owner(*mapped, "mapped") };
+
+	REQUIRE(registry->add(reinterpret_cast<void*>(a->buffer_start()), 1 << 16, &owners[0]));
+	REQUIRE(registry->add(reinterpret_cast<void*>(b->buffer_start()), 1 << 16, &owners[1]));
+	REQUIRE(registry->add(reinterpret_cast<void*>((*tiny)[0].buffer_start()), 1024, &owners[2]));
+	REQUIRE(registry->add(reinterpret_cast<void*>((*tiny)[1].buffer_start()), 1024, &owners[3]));
+	REQUIRE(registry->add(reinterpret_cast<void*>(mapped->buffer_start()), 1 << 16, &owners[4]));
+	REQUIRE(false == registry->add(nullptr, 0, &owners[0]));
+
+	void *pa = a->allocate(100), *pb = b->allocate(5000);
+	void *pt0 = (*tiny)[0].allocate(16), *pt1 = (*tiny)[1].allocate(16);
+	void *pm = mapped->allocate(40000);
+	REQUIRE(registry->find(pa) == &owners[0]);
+	REQUIRE(registry->find(pb) == &owners[1]);
+	REQUIRE(registry->find(pt0) == &owners[2]);
+	REQUIRE(registry->find(pt1) == &owners[3]);
+	REQUIRE(registry->find(pm) == &owners[4]);
+	REQUIRE(std::string(registry->find(pm)->engine) == "mapped");
+
+	int on_stack = 0;
+	std::unique_ptr<int> on_heap(new int(0));
+	REQUIRE(registry->find(&on_stack) == nullptr);
+	REQUIRE(registry->find(on_heap.get()) == nullptr);
+	REQUIRE(false == registry->deallocate(on_heap.get()));
+
+	// deallocate() frees into the owner
+	for (void *p : { pa, pb, pt0, pt1, pm })
+		REQUIRE(registry->deallocate(p));
+	REQUIRE(a->deallocated() == a->allocated());
+	REQUIRE(b->deallocated() == b->allocated());
+	REQUIRE((*tiny)[0].deallocated() == (*tiny)[0].allocated());
+	REQUIRE((*tiny)[1].deallocated() == (*tiny)[1].allocated());
+	REQUIRE(mapped->deallocated() == mapped->allocated());
+
+	// removing one tiny pool leaves its neighbour on the shared page
+	registry->remove(reinterpret_cast<void*>((*tiny)[0].buffer_start()), 1024);
+	REQUIRE(registry->find(reinterpret_cast<void*>((*tiny)[0].buffer_start())) == nullptr);
+	REQUIRE(registry->find(reinterpret_cast<void*>((*tiny)[1].buffer_start())) == &owners[3]);
+	registry->remove(reinterpret_cast<void*>((*tiny)[1].buffer_start()), 1024);
+	REQUIRE(registry->find(reinterpret_cast<void*>((*tiny)[1].buffer_start())) == nullptr);
+	registry->remove(reinterpret_cast<void*>(mapped->buffer_start()), 1 << 16);
+	REQUIRE(registry->find(reinterpret_cast<void*>(mapped->buffer_start() + 1000)) == nullptr);
+	REQUIRE(registry->find(reinterpret_cast<void*>(a->buffer_start() + 1000)) == &owners[0]);
+}
+
+
+TEST_CASE("pool registry still routes pointers during static destruction", "[registry]")
+{
+	// a registry type of its own, created after the handler below is
+	// registered, so it would be destroyed before the handler runs
+	using exit_registry_t = basic_pool_registry<12, 48, 8>;
+	using heap_pool_t = static_memory_pool<(1 << 16)>;
+	static heap_pool_t *pool = nullptr;
+	static void *block = nullptr;
+
+	std::fflush(nullptr);
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		std::atexit([]()
+		{
+			const bool routed = exit_registry_t::get_instance().deallocate(block);
+			_exit(routed && pool->allocated() == pool->deallocated() ? 0 : 3);
+		});
+
+		pool = new heap_pool_t();
+		static const pool_owner owner = make_pool_owner(*pool, "exit");
+		exit_registry_t::get_instance().add(reinterpret_cast<void*>(pool->buffer_start()), 1 << 16, &owner);
+		block = pool->allocate(100);
+		std::exit(0);
+	}
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	REQUIRE(WIFEXITED(status));
+	REQUIRE(WEXITSTATUS(status) == 0);
+}
@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace ss
 {
@@ -29,4 +37,222 @@ namespace ss
 
 		}
 	};
-}
\ No newline at end of file
+
+
+	// Cycle counter: rdtsc on x86, the virtual counter on aarch64, steady_clock
+	// nanoseconds elsewhere. Assumes an invariant TSC, which every x86 CPU of
+	// the last decade has, so ticks convert to time at a fixed rate.
+	struct tsc_clock
+	{
+		static uint64_t now() noexcept
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#elif defined(__aarch64__)
+			uint64_t ticks;
+			asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+			return ticks;
+#else
+			return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+		}
+
+		// Read before the measured code: earlier instructions retire first and
+		// the measured ones don't start before the read.
+		static uint64_t start() noexcept
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			_mm_lfence();
+			const uint64_t ticks = __rdtsc();
+			_mm_lfence();
+			return ticks;
+#else
+			return now();
+#endif
+		}
+
+		// Read after the measured code: rdtscp waits for it to retire.
+		static uint64_t stop() noexcept
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			unsigned int aux;
+			const uint64_t ticks = __rdtscp(&aux);
+			_mm_lfence();
+			return ticks;
+#else
+			return now();
+#endif
+		}
+
+		// Ticks per nanosecond, measured against steady_clock over about 10ms
+		// on first use.
+		static double ticks_per_ns() noexcept
+		{
+			static const double rate = calibrate();
+			return rate;
+		}
+
+		static uint64_t to_ns(uint64_t ticks) noexcept
+		{
+			return static_cast<uint64_t>(double(ticks) / ticks_per_ns());
+		}
+
+	private:
+		static double calibrate() noexcept
+		{
+			using clock_type = std::chrono::steady_clock;
+			const auto begin = clock_type::now();
+			const uint64_t begin_ticks = start();
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			const uint64_t end_ticks = stop();
+			const auto end = clock_type::now();
+
+			const double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+			return ns > 0 && end_ticks > begin_ticks ? double(end_ticks - begin_ticks) / ns : 1.0;
+		}
+	};
+
+
+	// timer counterpart on tsc_clock, a tick()/tock() pair costs a few
+	// nanoseconds instead of two clock_gettime calls.
+	class tsc_timer
+	{
+		uint64_t _tick = 0;
+		uint64_t _tock = 0;
+
+	public:
+		void tick() noexcept
+		{
+			_tick = tsc_clock::start();
+		}
+
+		void tock() noexcept
+		{
+			_tock = tsc_clock::stop();
+		}
+
+		uint64_t ticks() const noexcept
+		{
+			return _tock - _tick;
+		}
+
+		template<typename DURATION_TYPE>
+		uint64_t duration() const noexcept
+		{
+			return std::chrono::duration_cast<DURATION_TYPE>(std::chrono::nanoseconds(tsc_clock::to_ns(ticks()))).count();
+		}
+	};
+
+
+	// Log-linear histogram in the style of HdrHistogram: values below
+	// 2^(SUB_BUCKET_BITS + 1) get a bucket each, above that every power of two
+	// is split into 2^SUB_BUCKET_BITS buckets, so any recorded value is known
+	// within 1 / 2^SUB_BUCKET_BITS of itself (3% with the default). Memory is
+	// fixed and covers all of uint64_t. Not thread safe: keep one per thread
+	// and merge() them for the report.
+	template<size_t SUB_BUCKET_BITS = 5>
+	class latency_histogram
+	{
+		static_assert(SUB_BUCKET_BITS > 0 && SUB_BUCKET_BITS < 16, "SUB_BUCKET_BITS out of range");
+
+		static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+
+	public:
+		static constexpr size_t BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	private:
+		std::array<uint64_t, BUCKETS> _counts = {};
+		uint64_t _total = 0;
+		uint64_t _min = UINT64_MAX;
+		uint64_t _max = 0;
+		double _sum = 0;
+
+		static size_t msb(uint64_t value) noexcept
+		{
+#if defined(__GNUC__)
+			return 63 - static_cast<size_t>(__builtin_clzll(value | 1));
+#else
+			size_t bit = 0;
+			while (value >>= 1)
+				++bit;
+			return bit;
+#endif
+		}
+
+	public:
+		static size_t bucket_of(uint64_t value) noexcept
+		{
+			const size_t top = msb(value);
+			const size_t shift = top > SUB_BUCKET_BITS ? top - SUB_BUCKET_BITS : 0;
+			return (shift << SUB_BUCKET_BITS) + static_cast<size_t>(value >> shift);
+		}
+
+		// Smallest value that lands in bucket.
+		static uint64_t lowest_of(size_t bucket) noexcept
+		{
+			if (bucket < 2 * SUB_BUCKETS)
+				return bucket;
+			const size_t shift = (bucket >> SUB_BUCKET_BITS) - 1;
+			return static_cast<uint64_t>(bucket - (shift << SUB_BUCKET_BITS)) << shift;
+		}
+
+		// Largest value that lands in bucket.
+		static uint64_t highest_of(size_t bucket) noexcept
+		{
+			if (bucket < 2 * SUB_BUCKETS)
+				return bucket;
+			const size_t shift = (bucket >> SUB_BUCKET_BITS) - 1;
+			return lowest_of(bucket) + ((uint64_t(1) << shift) - 1);
+		}
+
+		void record(uint64_t value, uint64_t count = 1) noexcept
+		{
+			_counts[bucket_of(value)] += count;
+			_total += count;
+			_sum += double(value) * double(count);
+			_min = std::min(_min, value);
+			_max = std::max(_max, value);
+		}
+
+		void merge(const latency_histogram &other) noexcept
+		{
+			for (size_t i = 0; i < BUCKETS; ++i)
+				_counts[i] += other._counts[i];
+			_total += other._total;
+			_sum += other._sum;
+			_min = std::min(_min, other._min);
+			_max = std::max(_max, other._max);
+		}
+
+		void reset() noexcept
+		{
+			*this = latency_histogram();
+		}
+
+		// Value at quantile q in [0, 1], reported as the top of its bucket and
+		// clamped to the recorded range, so percentile(1.0) == max().
+		uint64_t percentile(double q) const noexcept
+		{
+			if (_total == 0)
+				return 0;
+
+			const double clamped = std::min(1.0, std::max(0.0, q));
+			const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(clamped * double(_total) + 0.5));
+			uint64_t seen = 0;
+			for (size_t i = 0; i < BUCKETS; ++i)
+			{
+				seen += _counts[i];
+				if (seen >= rank)
+					return std::max(_min, std::min(_max, highest_of(i)));
+			}
+			return _max;
+		}
+
+		uint64_t count() const noexcept { return _total; }
+		uint64_t min() const noexcept { return _total == 0 ? 0 : _min; }
+		uint64_t max() const noexcept { return _max; }
+		double mean() const noexcept { return _total == 0 ? 0.0 : _sum / double(_total); }
+		uint64_t count_in(size_t bucket) const noexcept { return _counts[bucket]; }
+	};
+}
@@ -0,0 +1,355 @@
+// Compares two allocator_bench --json result sets, normally each run with
+// --repeat so every benchmark has several trials, and tells which
+// differences are real.
+//
+// usage: bench_compare <baseline.json> <candidate.json> [--metric name] [--alpha p]
+//                      [--threshold fraction] [--noise cv] [--fail-on-noisy]
+//
+// Trials are grouped by workload, engine and thread count. For each group
+// the median change gets a 95% bootstrap interval and a Mann-Whitney U test.
+// A change counts when p < alpha, the interval excludes 0 and the change is
+// beyond threshold. A side with fewer than 3 trials or a coefficient of
+// variation above noise is flagged noisy.
+//
+// metric is any numeric field of a result, nested ones with a dot:
+// ops_per_second (default, higher is better), latency_ns.p99,
+// peak_footprint_bytes, per_operation.cycles, ... (lower is better).
+//
+// Exits 1 when a benchmark regressed (or is noisy with --fail-on-noisy),
+// so it can gate a change.
+
+#include "bench_statistics.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace ss;
+
+namespace
+{
+	// as much JSON as allocator_bench writes
+	struct json_value
+	{
+		enum kind_t { null, boolean, number, string, array, object };
+
+		kind_t kind = null;
+		bool flag = false;
+		double value = 0;
+		std::string text;
+		std::vector<json_value> items;
+		std::vector<std::pair<std::string, json_value>> members;
+
+		const json_value *find(const std::string &key) const
+		{
+			for (const auto &m : members)
+				if (m.first == key)
+					return &m.second;
+			return nullptr;
+		}
+
+		// a.b.c through nested objects
+		const json_value *path(const std::string &dotted) const
+		{
+			const json_value *v = this;
+			std::stringstream in(dotted);
+			std::string key;
+			while (v != nullptr && std::getline(in, key, '.'))
+				v = v->find(key);
+			return v;
+		}
+	};
+
+	class json_parser
+	{
+		const std::string &_in;
+		size_t _pos = 0;
+
+		[[noreturn]] void fail(const char *what) const
+		{
+			throw std::runtime_error(std::string(what) + " at offset " + std::to_string(_pos));
+		}
+
+		void skip_space()
+		{
+			while (_pos < _in.size() && std::isspace(static_cast<unsigned char>(_in[_pos])))
+				++_pos;
+		}
+
+		bool consume(const char *literal)
+		{
+			const size_t n = std::strlen(literal);
+			if (_in.compare(_pos, n, literal) != 0)
+				return false;
+			_pos += n;
+			return true;
+		}
+
+		std::string parse_string()
+		{
+			std::string s;
+			++_pos;
+			while (_pos < _in.size() && _in[_pos] != '"')
+			{
+				char c = _in[_pos++];
+				if (c == '\\' && _pos < _in.size())
+				{
+					c = _in[_pos++];
+					switch (c)
+					{
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'r': c = '\r'; break;
+					case 'b': c = '\b'; break;
+					case 'f': c = '\f'; break;
+					case 'u': c = '?'; _pos += 4; break;
+					default: break;
+					}
+				}
+				s.push_back(c);
+			}
+			if (_pos >= _in.size())
+				fail("unterminated string");
+			++_pos;
+			return s;
+		}
+
+		json_value parse_value()
+		{
+			skip_space();
+			if (_pos >= _in.size())
+				fail("unexpected end");
+
+			json_value v;
+			const char c = _in[_pos];
+			if (c == '{')
+			{
+				v.kind = json_value::object;
+				++_pos;
+				skip_space();
+				if (_pos < _in.size() && _in[_pos] == '}')
+				{
+					++_pos;
+					return v;
+				}
+				while (true)
+				{
+					skip_space();
+					if (_pos >= _in.size() || _in[_pos] != '"')
+						fail("expected key");
+					std::string key = parse_string();
+					skip_space();
+					if (false == consume(":"))
+						fail("expected ':'");
+					v.members.emplace_back(std::move(key), parse_value());
+					skip_space();
+					if (consume(","))
+						continue;
+					if (consume("}"))
+						return v;
+					fail("expected ',' or '}'");
+				}
+			}
+			if (c == '[')
+			{
+				v.kind = json_value::array;
+				++_pos;
+				skip_space();
+				if (_pos < _in.size() && _in[_pos] == ']')
+				{
+					++_pos;
+					return v;
+				}
+				while (true)
+				{
+					v.items.push_back(parse_value());
+					skip_space();
+					if (consume(","))
+						continue;
+					if (consume("]"))
+						return v;
+					fail("expected ',' or ']'");
+				}
+			}
+			if (c == '"')
+			{
+				v.kind = json_value::string;
+				v.text = parse_string();
+				return v;
+			}
+			if (consume("true") || consume("false"))
+			{
+				v.kind = json_value::boolean;
+				v.flag = c == 't';
+				return v;
+			}
+			if (consume("null"))
+				return v;
+
+			const char *begin = _in.c_str() + _pos;
+			char *end = nullptr;
+			v.kind = json_value::number;
+			v.value = std::strtod(begin, &end);
+			if (end == begin)
+				fail("unexpected character");
+			_pos += static_cast<size_t>(end - begin);
+			return v;
+		}
+
+	public:
+		explicit json_parser(const std::string &in) : _in(in) {}
+
+		json_value parse()
+		{
+			json_value v = parse_value();
+			skip_space();
+			if (_pos != _in.size())
+				fail("trailing data");
+			return v;
+		}
+	};
+
+	// metric values per benchmark key
+	using trials = std::map<std::string, std::vector<double>>;
+
+	trials load(const std::string &path, const std::string &metric)
+	{
+		std::ifstream in(path);
+		if (false == in.good())
+			throw std::runtime_error("cannot read " + path);
+		std::stringstream buffer;
+		buffer << in.rdbuf();
+		const std::string text = buffer.str();
+		const json_value root = json_parser(text).parse();
+
+		const json_value *results = root.find("results");
+		if (results == nullptr || results->kind != json_value::array)
+			throw std::runtime_error(path + " has no results array");
+
+		trials t;
+		for (const json_value &r : results->items)
+		{
+			const json_value *workload = r.find("workload");
+			const json_value *engine = r.find("engine");
+			const json_value *threads = r.find("threads");
+			const json_value *value = r.path(metric);
+			if (workload == nullptr || engine == nullptr || value == nullptr || value->kind != json_value::number)
+				continue;
+
+			std::string key = workload->text + "/" + engine->text;
+			if (threads != nullptr)
+				key += "/" + std::to_string(static_cast<long long>(threads->value));
+			t[key].push_back(value->value);
+		}
+		return t;
+	}
+
+	int usage()
+	{
+		std::fprintf(stderr, "usage: bench_compare <baseline.json> <candidate.json> [--metric name] [--alpha p]\n"
+			"                     [--threshold fraction] [--noise cv] [--fail-on-noisy]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+		return usage();
+
+	std::string metric = "ops_per_second";
+	double alpha = 0.05;
+	double threshold = 0.02;
+	double noise = 0.05;
+	bool fail_on_noisy = false;
+
+	for (int i = 3; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--metric") == 0 && i + 1 < argc)
+			metric = argv[++i];
+		else if (std::strcmp(argv[i], "--alpha") == 0 && i + 1 < argc)
+			alpha = std::stod(argv[++i]);
+		else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			threshold = std::stod(argv[++i]);
+		else if (std::strcmp(argv[i], "--noise") == 0 && i + 1 < argc)
+			noise = std::stod(argv[++i]);
+		else if (std::strcmp(argv[i], "--fail-on-noisy") == 0)
+			fail_on_noisy = true;
+		else
+			return usage();
+	}
+
+	trials baseline, candidate;
+	try
+	{
+		baseline = load(argv[1], metric);
+		candidate = load(argv[2], metric);
+	}
+	catch (const std::exception &e)
+	{
+		std::fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	const bool higher_is_better = metric == "ops_per_second";
+	size_t regressions = 0, improvements = 0, noisy = 0;
+
+	std::printf("metric %s, %s is better\n\n", metric.c_str(), higher_is_better ? "higher" : "lower");
+	std::printf("%-40s %5s %14s %14s %9s %21s %8s  %s\n", "benchmark", "n", "baseline", "candidate",
+		"change", "95% interval", "p", "verdict");
+
+	for (const auto &b : baseline)
+	{
+		const auto c = candidate.find(b.first);
+		if (c == candidate.end())
+		{
+			std::printf("%-40s only in baseline\n", b.first.c_str());
+			continue;
+		}
+
+		const std::vector<double> &before = b.second;
+		const std::vector<double> &after = c->second;
+		const confidence_interval change = bootstrap_relative_change(before, after);
+		const mann_whitney_result test = mann_whitney_u(before, after);
+
+		const bool is_noisy = before.size() < 3 || after.size() < 3 ||
+			coefficient_of_variation(before) > noise || coefficient_of_variation(after) > noise;
+		const bool significant = test.p_value < alpha && (change.low > 0 || change.high < 0) &&
+			std::fabs(change.estimate) > threshold;
+		const bool better = (change.estimate > 0) == higher_is_better;
+
+		std::string verdict = "same";
+		if (significant)
+		{
+			verdict = better ? "improved" : "REGRESSION";
+			if (better)
+				++improvements;
+			else
+				++regressions;
+		}
+		if (is_noisy)
+		{
+			verdict += " (noisy)";
+			++noisy;
+		}
+
+		char n[16], interval[32];
+		std::snprintf(n, sizeof(n), "%zu/%zu", before.size(), after.size());
+		std::snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", 100 * change.low, 100 * change.high);
+		std::printf("%-40s %5s %14.4g %14.4g %+8.1f%% %21s %8.4f  %s\n", b.first.c_str(), n,
+			median(before), median(after), 100 * change.estimate, interval, test.p_value, verdict.c_str());
+	}
+
+	for (const auto &c : candidate)
+		if (baseline.find(c.first) == baseline.end())
+			std::printf("%-40s only in candidate\n", c.first.c_str());
+
+	std::printf("\n%zu regressions, %zu improvements, %zu noisy\n", regressions, improvements, noisy);
+	return regressions > 0 || (fail_on_noisy && noisy > 0) ? 1 : 0;
+}
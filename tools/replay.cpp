@@ -0,0 +1,227 @@
+// Replays an allocation trace recorded through traced_stats against a pool
+// engine and reports throughput, per call latency and peak footprint.
+//
+// usage: replay <trace> [--engine static|growable|shared|malloc] [--pool-size bytes]
+//
+// Records are replayed on one thread in timestamp order. A deallocate is
+// paired with its allocate through the recorded pointer, allocations that
+// fail in the replayed engine are counted and their deallocates skipped.
+
+#include "allocation_trace.h"
+#include "basic_memory_pool.h"
+#include "growable_memory_pool.h"
+#include "shared_memory_pool.h"
+#include "chunk_source.h"
+#include "timer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace ss;
+
+namespace
+{
+	struct replay_result
+	{
+		uint64_t operations = 0;
+		uint64_t failed = 0;
+		uint64_t total_ticks = 0;
+		size_t peak_live_bytes = 0;
+		size_t peak_footprint = 0;
+		// in tsc_clock ticks
+		latency_histogram<> latencies;
+	};
+
+	// basic_memory_pool over one mapping, the engine behind static_memory_pool
+	class static_engine
+	{
+		size_t _size;
+		void *_memory;
+		basic_memory_pool<> _pool;
+
+	public:
+		explicit static_engine(size_t size)
+			: _size(size), _memory(mmap_chunk_source::acquire(size))
+		{
+			if (_memory == nullptr)
+				throw std::runtime_error("cannot map pool buffer");
+			_pool.init(_memory, size);
+		}
+
+		~static_engine() { mmap_chunk_source::release(_memory, _size); }
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+
+		// high water mark of the block list
+		size_t footprint(const void *p, size_t size) const
+		{
+			return static_cast<const uint8_t*>(p) + size - static_cast<const uint8_t*>(_memory);
+		}
+	};
+
+	class growable_engine
+	{
+		growable_memory_pool<> _pool;
+
+	public:
+		explicit growable_engine(size_t) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+		size_t footprint(const void *, size_t) const { return _pool.capacity(); }
+	};
+
+	class shared_engine
+	{
+		shared_memory_pool<> _pool;
+
+	public:
+		explicit shared_engine(size_t size) : _pool(shared_memory_pool<>::create_anonymous(size)) {}
+
+		void *allocate(size_t size) { return _pool.allocate(size); }
+		void deallocate(void *p, size_t) { _pool.deallocate(p); }
+
+		size_t footprint(const void *p, size_t size) const
+		{
+			return static_cast<const uint8_t*>(p) + size - static_cast<const uint8_t*>(_pool.base());
+		}
+	};
+
+	class malloc_engine
+	{
+		size_t _live = 0;
+
+	public:
+		explicit malloc_engine(size_t) {}
+
+		void *allocate(size_t size) { _live += size; return std::malloc(size); }
+		void deallocate(void *p, size_t size) { _live -= size; std::free(p); }
+		size_t footprint(const void *, size_t) const { return _live; }
+	};
+
+	template<typename ENGINE>
+	replay_result replay(const std::vector<trace_record> &records, size_t pool_size)
+	{
+		ENGINE engine(pool_size);
+		replay_result result;
+
+		struct live_block
+		{
+			void *p;
+			size_t size;
+		};
+		std::unordered_map<uint64_t, live_block> live;
+		live.reserve(records.size() / 2 + 1);
+
+		size_t live_bytes = 0;
+		tsc_timer t;
+
+		for (const trace_record &rec : records)
+		{
+			if (rec.op == trace_op::allocate)
+			{
+				t.tick();
+				void *p = engine.allocate(rec.size);
+				t.tock();
+
+				if (p == nullptr)
+				{
+					++result.failed;
+					continue;
+				}
+
+				live[rec.pointer] = { p, rec.size };
+				live_bytes += rec.size;
+				result.peak_live_bytes = std::max(result.peak_live_bytes, live_bytes);
+				result.peak_footprint = std::max(result.peak_footprint, engine.footprint(p, rec.size));
+			}
+			else
+			{
+				auto it = live.find(rec.pointer);
+				if (it == live.end())
+					continue;
+
+				t.tick();
+				engine.deallocate(it->second.p, it->second.size);
+				t.tock();
+
+				live_bytes -= it->second.size;
+				live.erase(it);
+			}
+
+			result.latencies.record(t.ticks());
+			result.total_ticks += t.ticks();
+			++result.operations;
+		}
+
+		for (auto &block : live)
+			engine.deallocate(block.second.p, block.second.size);
+
+		return result;
+	}
+
+	int usage()
+	{
+		std::fprintf(stderr, "usage: replay <trace> [--engine static|growable|shared|malloc] [--pool-size bytes]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		return usage();
+
+	const std::string path = argv[1];
+	std::string engine = "static";
+	size_t pool_size = size_t(1) << 30;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+			engine = argv[++i];
+		else if (std::strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc)
+			pool_size = std::stoull(argv[++i]);
+		else
+			return usage();
+	}
+
+	std::vector<trace_record> records = read_trace(path);
+	std::stable_sort(records.begin(), records.end(), [](const trace_record &a, const trace_record &b)
+	{
+		return a.timestamp < b.timestamp;
+	});
+
+	replay_result result;
+	if (engine == "static")
+		result = replay<static_engine>(records, pool_size);
+	else if (engine == "growable")
+		result = replay<growable_engine>(records, pool_size);
+	else if (engine == "shared")
+		result = replay<shared_engine>(records, pool_size);
+	else if (engine == "malloc")
+		result = replay<malloc_engine>(records, pool_size);
+	else
+		return usage();
+
+	const double seconds = tsc_clock::to_ns(result.total_ticks) / 1e9;
+	const latency_histogram<> &latencies = result.latencies;
+
+	std::printf("engine          %s\n", engine.c_str());
+	std::printf("records         %zu\n", records.size());
+	std::printf("operations      %llu\n", static_cast<unsigned long long>(result.operations));
+	std::printf("failed          %llu\n", static_cast<unsigned long long>(result.failed));
+	std::printf("throughput      %.0f ops/s\n", seconds > 0 ? result.operations / seconds : 0.0);
+	std::printf("latency p50     %llu ns\n", static_cast<unsigned long long>(tsc_clock::to_ns(latencies.percentile(0.50))));
+	std::printf("latency p99     %llu ns\n", static_cast<unsigned long long>(tsc_clock::to_ns(latencies.percentile(0.99))));
+	std::printf("latency p99.9   %llu ns\n", static_cast<unsigned long long>(tsc_clock::to_ns(latencies.percentile(0.999))));
+	std::printf("latency max     %llu ns\n", static_cast<unsigned long long>(tsc_clock::to_ns(latencies.max())));
+	std::printf("peak live bytes %zu\n", result.peak_live_bytes);
+	std::printf("peak footprint  %zu\n", result.peak_footprint);
+	return 0;
+}
@@ -0,0 +1,220 @@
+// Evaluates fit policies and pool sizes offline against a recorded trace,
+// see pool_simulator.h. Only block metadata is simulated, every policy and
+// pool size combination runs on its own thread over the same mapped trace.
+//
+// usage: simulate <trace> [--policy all|first-fit|best-fit|segregated|tlsf|buddy]
+//                 [--pool-size bytes[,bytes...]] [--samples n] [--timeline]
+//
+// Without --pool-size the candidates are powers of two around the trace's
+// peak live bytes, starting one below so the failure points show up.
+
+#include "pool_simulator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ss;
+
+namespace
+{
+	struct mapped_trace
+	{
+		const trace_record *records = nullptr;
+		size_t count = 0;
+		std::vector<trace_record> sorted;
+		void *mapping = MAP_FAILED;
+		size_t mapping_size = 0;
+
+		explicit mapped_trace(const std::string &path)
+		{
+			// validates the header
+			trace_reader reader(path);
+
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			struct stat st;
+			if (fd < 0 || fstat(fd, &st) != 0)
+				throw std::runtime_error("cannot open trace file " + path);
+
+			mapping_size = static_cast<size_t>(st.st_size);
+			mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (mapping == MAP_FAILED)
+				throw std::runtime_error("cannot map trace file " + path);
+
+			records = reinterpret_cast<const trace_record*>(static_cast<const uint8_t*>(mapping) + sizeof(trace_file_header));
+			count = (mapping_size - sizeof(trace_file_header)) / sizeof(trace_record);
+
+			// records of different threads are drained in batches
+			auto by_time = [](const trace_record &a, const trace_record &b) { return a.timestamp < b.timestamp; };
+			if (false == std::is_sorted(records, records + count, by_time))
+			{
+				sorted.assign(records, records + count);
+				std::stable_sort(sorted.begin(), sorted.end(), by_time);
+				records = sorted.data();
+			}
+		}
+
+		~mapped_trace()
+		{
+			if (mapping != MAP_FAILED)
+				munmap(mapping, mapping_size);
+		}
+	};
+
+	struct job
+	{
+		std::string policy;
+		size_t pool_size;
+		simulation_result result;
+	};
+
+	simulation_result run(const std::string &policy, const mapped_trace &trace, const trace_slots &slots, size_t pool_size, size_t samples)
+	{
+		if (policy == "first-fit")
+			return simulate<simulated_heap<simulated_first_fit>>(trace.records, slots, trace.count, pool_size, samples);
+		if (policy == "best-fit")
+			return simulate<simulated_heap<simulated_best_fit>>(trace.records, slots, trace.count, pool_size, samples);
+		if (policy == "segregated")
+			return simulate<simulated_heap<simulated_segregated_fit>>(trace.records, slots, trace.count, pool_size, samples);
+		if (policy == "tlsf")
+			return simulate<simulated_heap<simulated_tlsf>>(trace.records, slots, trace.count, pool_size, samples);
+		return simulate<simulated_buddy_heap>(trace.records, slots, trace.count, pool_size, samples);
+	}
+
+	size_t peak_live_bytes(const mapped_trace &trace, const trace_slots &slots)
+	{
+		std::vector<uint64_t> sizes(slots.count);
+		size_t bytes = 0;
+		size_t peak = 0;
+		for (size_t i = 0; i < trace.count; ++i)
+		{
+			const uint32_t slot = slots.slot[i];
+			if (trace.records[i].op == trace_op::allocate)
+			{
+				sizes[slot] = trace.records[i].size;
+				bytes += sizes[slot];
+				peak = std::max(peak, bytes);
+			}
+			else if (slot != NO_BLOCK)
+			{
+				bytes -= sizes[slot];
+			}
+		}
+		return peak;
+	}
+
+	int usage()
+	{
+		std::fprintf(stderr, "usage: simulate <trace> [--policy all|first-fit|best-fit|segregated|tlsf|buddy]\n"
+			"                [--pool-size bytes[,bytes...]] [--samples n] [--timeline]\n");
+		return 2;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		return usage();
+
+	const std::vector<std::string> all_policies = { "first-fit", "best-fit", "segregated", "tlsf", "buddy" };
+	std::vector<std::string> policies = all_policies;
+	std::vector<size_t> pool_sizes;
+	size_t samples = 32;
+	bool timeline = false;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--policy") == 0 && i + 1 < argc)
+		{
+			const std::string policy = argv[++i];
+			if (policy != "all")
+			{
+				if (std::find(all_policies.begin(), all_policies.end(), policy) == all_policies.end())
+					return usage();
+				policies = { policy };
+			}
+		}
+		else if (std::strcmp(argv[i], "--pool-size") == 0 && i + 1 < argc)
+		{
+			std::stringstream list(argv[++i]);
+			std::string size;
+			while (std::getline(list, size, ','))
+				pool_sizes.push_back(std::stoull(size));
+		}
+		else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+			samples = std::stoull(argv[++i]);
+		else if (std::strcmp(argv[i], "--timeline") == 0)
+			timeline = true;
+		else
+			return usage();
+	}
+
+	const mapped_trace trace(argv[1]);
+	const trace_slots slots(trace.records, trace.count);
+
+	if (pool_sizes.empty())
+	{
+		size_t base = 4096;
+		const size_t peak = peak_live_bytes(trace, slots);
+		while (base < peak)
+			base <<= 1;
+		pool_sizes = { base / 2, base, base * 2, base * 4 };
+	}
+
+	std::vector<job> jobs;
+	for (const std::string &policy : policies)
+		for (size_t pool_size : pool_sizes)
+			jobs.push_back({ policy, pool_size, simulation_result() });
+
+	std::atomic<size_t> next{ 0 };
+	std::vector<std::thread> workers;
+	const size_t num_workers = std::max<size_t>(1, std::min<size_t>(jobs.size(), std::thread::hardware_concurrency()));
+	for (size_t w = 0; w < num_workers; ++w)
+	{
+		workers.emplace_back([&]()
+		{
+			for (size_t j; (j = next.fetch_add(1)) < jobs.size(); )
+				jobs[j].result = run(jobs[j].policy, trace, slots, jobs[j].pool_size, samples);
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+
+	std::printf("%zu records\n\n", trace.count);
+	std::printf("%-11s %14s %14s %14s %10s %14s %9s %9s\n",
+		"policy", "pool size", "peak footprnt", "peak live", "failures", "first fail", "max frag", "end frag");
+
+	for (const job &j : jobs)
+	{
+		const simulation_result &r = j.result;
+		const double end_fragmentation = r.fragmentation.empty() ? 0.0 : r.fragmentation.back();
+		std::printf("%-11s %14zu %14zu %14zu %10llu %14lld %9.3f %9.3f\n",
+			j.policy.c_str(), r.pool_size, r.peak_footprint, r.peak_live_bytes,
+			static_cast<unsigned long long>(r.failures), static_cast<long long>(r.first_failure),
+			r.max_fragmentation, end_fragmentation);
+	}
+
+	if (timeline)
+	{
+		std::printf("\nfragmentation over time (%zu samples)\n", samples);
+		for (const job &j : jobs)
+		{
+			std::printf("%-11s %14zu", j.policy.c_str(), j.pool_size);
+			for (double f : j.result.fragmentation)
+				std::printf(" %.2f", f);
+			std::printf("\n");
+		}
+	}
+
+	return 0;
+}